@@ -0,0 +1,52 @@
+#include "args.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+constexpr size_t kChunkSize = 1 << 12;
+
+struct Chunk {
+    std::unique_ptr<std::shared_ptr<Object>[]> data;
+    size_t size;
+};
+
+struct ArgStack {
+    std::vector<Chunk> chunks;
+    size_t chunk = 0;  // index of the chunk in use
+    size_t top = 0;    // first free slot in it
+};
+
+thread_local ArgStack stack;
+
+Chunk MakeChunk(size_t size) {
+    return {std::make_unique<std::shared_ptr<Object>[]>(size), size};
+}
+
+}  // namespace
+
+ArgFrame::ArgFrame(size_t count)
+    : count_(count), previous_chunk_(stack.chunk), previous_top_(stack.top) {
+    if (stack.chunks.empty() || stack.top + count > stack.chunks[stack.chunk].size) {
+        // the arguments must be contiguous, so they go to the next chunk. Chunks above
+        // the one in use are free, a too small one is replaced.
+        size_t next = stack.chunks.empty() ? 0 : stack.chunk + 1;
+        if (next == stack.chunks.size()) {
+            stack.chunks.push_back(MakeChunk(std::max(kChunkSize, count)));
+        } else if (stack.chunks[next].size < count) {
+            stack.chunks[next] = MakeChunk(count);
+        }
+        stack.chunk = next;
+        stack.top = 0;
+    }
+    data_ = stack.chunks[stack.chunk].data.get() + stack.top;
+    stack.top += count;
+}
+
+ArgFrame::~ArgFrame() {
+    for (size_t i = 0; i < count_; i++) {
+        data_[i] = nullptr;
+    }
+    stack.chunk = previous_chunk_;
+    stack.top = previous_top_;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "object.h"
+#include <memory>
+
+// Arguments of a call, on top of the argument stack of the calling thread. The stack is
+// made of chunks that are reused and never move, so calls get their arguments as spans
+// without allocating anything.
+class ArgFrame {
+public:
+    // Space for `count` arguments, empty at first
+    explicit ArgFrame(size_t count);
+
+    ArgFrame(const ArgFrame&) = delete;
+    ArgFrame& operator=(const ArgFrame&) = delete;
+
+    // Releases the arguments. Frames must be destroyed in the reverse order of creation.
+    ~ArgFrame();
+
+    std::shared_ptr<Object>& operator[](size_t i) {
+        return data_[i];
+    }
+
+    ObjectSpan Get() const {
+        return {data_, count_};
+    }
+
+private:
+    std::shared_ptr<Object>* data_;
+    size_t count_;
+    size_t previous_chunk_;
+    size_t previous_top_;
+};
@@ -0,0 +1,743 @@
+#include "ast.h"
+#include "args.h"
+#include "functors.h"
+#include "helpers.h"
+#include "profiler.h"
+#include <array>
+#include <type_traits>
+
+// Call of a lambda left by a node in tail position to the loop in Tree::Execute
+struct PendingCall {
+    std::shared_ptr<Object> lambda;
+    std::shared_ptr<Scope> frame;
+};
+
+class Node {
+public:
+    explicit Node(Tree* tree) : tree_(tree) {
+    }
+
+    virtual ~Node() = default;
+
+    // Value of the node in `scope`. `tail` is set if the node is in tail position: a call of
+    // a lambda may then be stored there instead of made, and the result is meaningless.
+    virtual std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                            PendingCall* tail) = 0;
+
+    virtual void Trace([[maybe_unused]] const std::function<void(Object*)>& visit) const {
+    }
+
+    // Pointer to this node in its parent, which Replace changes
+    void SetParentSlot(Node** slot) {
+        parent_slot_ = slot;
+    }
+
+protected:
+    Tree* tree_;
+
+    // The parent doesn't point to this node anymore if it was already replaced, e.g. by an
+    // execution started in a recursive call
+    bool IsReplaced() const {
+        return *parent_slot_ != this;
+    }
+
+    // Makes `replacement` take the place of this node in the parent
+    void Replace(std::unique_ptr<Node> replacement) {
+        replacement->SetParentSlot(parent_slot_);
+        *parent_slot_ = tree_->Add(std::move(replacement));
+    }
+
+    static void Adopt(Node*& child) {
+        if (child) {
+            child->SetParentSlot(&child);
+        }
+    }
+
+private:
+    Node** parent_slot_ = nullptr;
+};
+
+namespace {
+
+// Calls a procedure or a lambda with evaluated arguments
+std::shared_ptr<Object> Call(const std::shared_ptr<Object>& callee, ObjectSpan args,
+                             PendingCall* tail) {
+    if (callee->GetType() == ObjectType::kProcedure) {
+        ProfileScope profile;
+        profile.Call(callee.get());
+        return static_cast<IProcedure*>(callee.get())->Apply(args);
+    }
+    const LambdaFunctor* lambda = static_cast<const LambdaFunctor*>(callee.get());
+    std::shared_ptr<Scope> frame = lambda->MakeFrame(args);
+    if (tail && lambda->GetPrototype()->tree) {
+        *tail = {callee, std::move(frame)};
+        return nullptr;
+    }
+    return lambda->Run(frame);
+}
+
+void CheckCallee(const std::shared_ptr<Object>& callee) {
+    if (!Is<IFunctor>(callee)) {
+        throw RuntimeError("Cell::first is not a functor");
+    }
+}
+
+class ConstNode : public Node {
+public:
+    ConstNode(Tree* tree, std::shared_ptr<Object> value) : Node(tree), value_(std::move(value)) {
+    }
+
+    std::shared_ptr<Object> Execute([[maybe_unused]] const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        return value_;
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        visit(value_.get());
+    }
+
+private:
+    std::shared_ptr<Object> value_;
+};
+
+class LocalRefNode : public Node {
+public:
+    LocalRefNode(Tree* tree, size_t depth, size_t slot) : Node(tree), depth_(depth), slot_(slot) {
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        return scope->GetSlot(depth_, slot_);
+    }
+
+private:
+    size_t depth_;
+    size_t slot_;
+};
+
+class GlobalRefNode : public Node {
+public:
+    GlobalRefNode(Tree* tree, std::shared_ptr<Symbol> symbol)
+        : Node(tree), symbol_(std::move(symbol)) {
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        if (std::shared_ptr<Object>* binding = scope->FindGlobal(symbol_->GetId(), &cache_)) {
+            return *binding;
+        }
+        return symbol_->Eval(scope);  // throws NameError
+    }
+
+private:
+    std::shared_ptr<Symbol> symbol_;
+    GlobalCache cache_;
+};
+
+class IfNode : public Node {
+public:
+    IfNode(Tree* tree, Node* condition, Node* then_branch, Node* else_branch)
+        : Node(tree), condition_(condition), then_(then_branch), else_(else_branch) {
+        Adopt(condition_), Adopt(then_), Adopt(else_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    PendingCall* tail) override {
+        std::shared_ptr<Object> condition = condition_->Execute(scope, nullptr);
+        if (!Is<Boolean>(condition)) {
+            throw RuntimeError("If statement returned not boolean");
+        }
+        if (IsTrue(condition)) {
+            return then_->Execute(scope, tail);
+        }
+        return else_ ? else_->Execute(scope, tail) : nullptr;
+    }
+
+private:
+    Node* condition_;
+    Node* then_;
+    Node* else_;
+};
+
+// and (stops on #f) or or (stops on anything else)
+class BooleanNode : public Node {
+public:
+    BooleanNode(Tree* tree, std::vector<Node*> args, bool stop_value)
+        : Node(tree), args_(std::move(args)), stop_value_(stop_value) {
+        for (auto& i : args_) {
+            Adopt(i);
+        }
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    PendingCall* tail) override {
+        if (args_.empty()) {
+            return Boolean::FromValue(!stop_value_);
+        }
+        for (size_t i = 0; i + 1 < args_.size(); i++) {
+            std::shared_ptr<Object> value = args_[i]->Execute(scope, nullptr);
+            if (IsTrue(value) == stop_value_) {
+                return value;
+            }
+        }
+        return args_.back()->Execute(scope, tail);
+    }
+
+private:
+    std::vector<Node*> args_;
+    bool stop_value_;
+};
+
+class DefineNode : public Node {
+public:
+    DefineNode(Tree* tree, std::shared_ptr<Symbol> symbol, Node* value)
+        : Node(tree), symbol_(std::move(symbol)), value_(value) {
+        Adopt(value_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        scope->Define(*symbol_, value_->Execute(scope, nullptr));
+        return symbol_;
+    }
+
+private:
+    std::shared_ptr<Symbol> symbol_;
+    Node* value_;
+};
+
+class SetLocalNode : public Node {
+public:
+    SetLocalNode(Tree* tree, size_t depth, size_t slot, Node* value)
+        : Node(tree), depth_(depth), slot_(slot), value_(value) {
+        Adopt(value_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        std::shared_ptr<Object> value = value_->Execute(scope, nullptr);
+        scope->AssignSlot(depth_, slot_, value);
+        return value;
+    }
+
+private:
+    size_t depth_;
+    size_t slot_;
+    Node* value_;
+};
+
+class SetGlobalNode : public Node {
+public:
+    SetGlobalNode(Tree* tree, std::shared_ptr<Symbol> symbol, Node* value)
+        : Node(tree), symbol_(std::move(symbol)), value_(value) {
+        Adopt(value_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        std::shared_ptr<Object> value = value_->Execute(scope, nullptr);
+        if (std::shared_ptr<Object>* binding = scope->FindGlobal(symbol_->GetId(), &cache_)) {
+            *binding = value;
+        } else {
+            scope->Set(*symbol_, value);  // throws NameError
+        }
+        return value;
+    }
+
+private:
+    std::shared_ptr<Symbol> symbol_;
+    Node* value_;
+    GlobalCache cache_;
+};
+
+// Lambda expression. All the closures it creates have frames of the same shape as parents,
+// so it is resolved and built once, when first evaluated.
+class LambdaNode : public Node {
+public:
+    LambdaNode(Tree* tree, SlotNames args, ObjectVector body, LambdaOrigin origin)
+        : Node(tree), args_(std::move(args)), body_(std::move(body)), origin_(std::move(origin)) {
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        if (!prototype_) {
+            prototype_ = std::make_shared<LambdaPrototype>(args_, body_, scope, origin_);
+        }
+        return Make<LambdaFunctor>(prototype_, scope);
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        for (auto& i : body_) {
+            visit(i.get());
+        }
+        if (prototype_) {
+            prototype_->Trace(visit);
+        }
+    }
+
+private:
+    SlotNames args_;
+    ObjectVector body_;
+    LambdaOrigin origin_;
+    std::shared_ptr<const LambdaPrototype> prototype_;
+};
+
+// Guard of the optimizer, see GuardFunctor
+class GuardNode : public Node {
+public:
+    GuardNode(Tree* tree, std::vector<SymbolId> names, ObjectVector values, Node* rewritten,
+              Node* original)
+        : Node(tree),
+          names_(std::move(names)),
+          values_(std::move(values)),
+          caches_(names_.size()),
+          rewritten_(rewritten),
+          original_(original) {
+        Adopt(rewritten_), Adopt(original_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    PendingCall* tail) override {
+        for (size_t i = 0; i < names_.size(); i++) {
+            std::shared_ptr<Object>* binding = scope->FindGlobal(names_[i], &caches_[i]);
+            if (!HoldsGuard(binding, values_[i])) {
+                return original_->Execute(scope, tail);
+            }
+        }
+        return rewritten_->Execute(scope, tail);
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        for (auto& i : values_) {
+            visit(i.get());
+        }
+    }
+
+private:
+    std::vector<SymbolId> names_;
+    ObjectVector values_;
+    std::vector<GlobalCache> caches_;
+    Node* rewritten_;
+    Node* original_;
+};
+
+// Anything else, left to the tree walker
+class EvalNode : public Node {
+public:
+    EvalNode(Tree* tree, std::shared_ptr<Object> expr) : Node(tree), expr_(std::move(expr)) {
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    [[maybe_unused]] PendingCall* tail) override {
+        return expr_->Eval(scope);
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        visit(expr_.get());
+    }
+
+private:
+    std::shared_ptr<Object> expr_;
+};
+
+// Generic call: procedures and lambdas get evaluated arguments, other functors get the
+// source ones. Until the first execution it may specialize into a FixnumNode.
+class CallNode : public Node {
+public:
+    CallNode(Tree* tree, Node* callee, std::vector<Node*> args, ObjectVector source_args,
+             bool specialize)
+        : Node(tree),
+          callee_(callee),
+          args_(std::move(args)),
+          source_args_(std::move(source_args)),
+          specialize_(specialize) {
+        Adopt(callee_);
+        for (auto& i : args_) {
+            Adopt(i);
+        }
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    PendingCall* tail) override {
+        return ExecuteWith(callee_->Execute(scope, nullptr), scope, tail);
+    }
+
+    // Finishes the call once the callee is evaluated
+    std::shared_ptr<Object> ExecuteWith(const std::shared_ptr<Object>& callee,
+                                        const std::shared_ptr<Scope>& scope, PendingCall* tail) {
+        CheckCallee(callee);
+        if (callee->GetType() == ObjectType::kFunctor) {
+            ProfileScope profile;
+            profile.Call(callee.get());
+            return AsPtr<IFunctor>(callee)->Calc(source_args_, scope);
+        }
+        ArgFrame frame(args_.size());
+        for (size_t i = 0; i < args_.size(); i++) {
+            frame[i] = args_[i]->Execute(scope, nullptr);
+        }
+        ObjectSpan args = frame.Get();
+        if (specialize_) {
+            specialize_ = false;
+            Specialize(callee, args);
+        }
+        return Call(callee, args, tail);
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        for (auto& i : source_args_) {
+            visit(i.get());
+        }
+    }
+
+private:
+    Node* callee_;
+    std::vector<Node*> args_;
+    ObjectVector source_args_;
+    bool specialize_;
+
+    void Specialize(const std::shared_ptr<Object>& callee, ObjectSpan args);
+
+    template <class F>
+    bool TrySpecialize(const std::shared_ptr<Object>& callee);
+};
+
+template <class F>
+constexpr bool kIsComparison = std::is_invocable_r_v<bool, F, int64_t, int64_t>;
+
+template <class F>
+using BuiltinOf = std::conditional_t<kIsComparison<F>, ComparisonFunctor<F>, NumberFunctor<F>>;
+
+// Call of a builtin arithmetic or comparison `F` with two numbers, done inline. Falls back
+// to CallNode if the operator is redefined or an operand is not a number.
+template <class F>
+class FixnumNode : public Node {
+public:
+    FixnumNode(Tree* tree, Node* callee, Node* left, Node* right, ObjectVector source_args,
+               std::shared_ptr<Object> builtin)
+        : Node(tree),
+          callee_(callee),
+          left_(left),
+          right_(right),
+          source_args_(std::move(source_args)),
+          builtin_(std::move(builtin)) {
+        Adopt(callee_), Adopt(left_), Adopt(right_);
+    }
+
+    std::shared_ptr<Object> Execute(const std::shared_ptr<Scope>& scope,
+                                    PendingCall* tail) override {
+        std::shared_ptr<Object> callee = callee_->Execute(scope, nullptr);
+        if (callee != builtin_) {
+            return Generalize()->ExecuteWith(callee, scope, tail);
+        }
+        std::array<std::shared_ptr<Object>, 2> args = {left_->Execute(scope, nullptr),
+                                                       right_->Execute(scope, nullptr)};
+        if (!Is<Number>(args[0]) || !Is<Number>(args[1])) {
+            Generalize();
+            return Call(callee, args, tail);
+        }
+        ProfileScope profile;
+        profile.Call(builtin_.get());
+        int64_t left = AsPtr<Number>(args[0])->GetValue();
+        int64_t right = AsPtr<Number>(args[1])->GetValue();
+        if constexpr (kIsComparison<F>) {
+            return Boolean::FromValue(F()(left, right));
+        } else {
+            int64_t res;
+            if (F().Fixnum(left, right, &res)) {
+                return Number::FromValue(res);
+            }
+            return F().Generic(args[0], args[1]);
+        }
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override {
+        for (auto& i : source_args_) {
+            visit(i.get());
+        }
+    }
+
+private:
+    Node* callee_;
+    Node* left_;
+    Node* right_;
+    ObjectVector source_args_;
+    std::shared_ptr<Object> builtin_;
+
+    // Replaces the node by a CallNode, which doesn't try to specialize again
+    CallNode* Generalize() {
+        auto node = std::make_unique<CallNode>(tree_, callee_, std::vector<Node*>{left_, right_},
+                                               source_args_, false);
+        CallNode* res = node.get();
+        if (!IsReplaced()) {
+            Replace(std::move(node));
+        } else {
+            tree_->Add(std::move(node));
+        }
+        return res;
+    }
+};
+
+template <class F>
+bool CallNode::TrySpecialize(const std::shared_ptr<Object>& callee) {
+    if (!dynamic_cast<BuiltinOf<F>*>(callee.get())) {
+        return false;
+    }
+    Replace(std::make_unique<FixnumNode<F>>(tree_, callee_, args_[0], args_[1], source_args_,
+                                            callee));
+    return true;
+}
+
+void CallNode::Specialize(const std::shared_ptr<Object>& callee, ObjectSpan args) {
+    if (IsReplaced() || args.size() != 2 || !Is<Number>(args[0]) || !Is<Number>(args[1])) {
+        return;
+    }
+    TrySpecialize<AddOp>(callee) || TrySpecialize<SubtractOp>(callee) ||
+        TrySpecialize<MultiplyOp>(callee) || TrySpecialize<std::less<int64_t>>(callee) ||
+        TrySpecialize<std::greater<int64_t>>(callee) ||
+        TrySpecialize<std::equal_to<int64_t>>(callee) ||
+        TrySpecialize<std::less_equal<int64_t>>(callee) ||
+        TrySpecialize<std::greater_equal<int64_t>>(callee);
+}
+
+class TreeBuilder {
+public:
+    TreeBuilder(Tree* tree, const std::shared_ptr<Scope>& scope) : tree_(tree), scope_(scope) {
+    }
+
+    Node* Build(const std::shared_ptr<Object>& expr) {
+        if (!expr) {
+            return New<ConstNode>(nullptr);
+        }
+        switch (expr->GetType()) {
+            case ObjectType::kNumber:
+            case ObjectType::kBigNumber:
+            case ObjectType::kBoolean:
+            case ObjectType::kString:
+            case ObjectType::kCharacter:
+                return New<ConstNode>(expr);
+            case ObjectType::kLocalSymbol: {
+                const LocalSymbol* local = AsPtr<LocalSymbol>(expr);
+                return New<LocalRefNode>(local->GetDepth(), local->GetSlot());
+            }
+            case ObjectType::kSymbol:
+                return New<GlobalRefNode>(Canonical(expr));
+            case ObjectType::kCell:
+                return BuildForm(expr);
+            default:
+                return New<EvalNode>(expr);
+        }
+    }
+
+private:
+    Tree* tree_;
+    const std::shared_ptr<Scope>& scope_;
+
+    template <class T, class... Args>
+    Node* New(Args&&... args) {
+        return tree_->Add(std::make_unique<T>(tree_, std::forward<Args>(args)...));
+    }
+
+    // Canonical symbol for a Symbol or a LocalSymbol
+    static std::shared_ptr<Symbol> Canonical(const std::shared_ptr<Object>& symbol) {
+        return Symbol::FromId(AsPtr<Symbol>(symbol)->GetId());
+    }
+
+    std::vector<Node*> BuildAll(ObjectSpan exprs) {
+        std::vector<Node*> res;
+        res.reserve(exprs.size());
+        for (auto& i : exprs) {
+            res.push_back(Build(i));
+        }
+        return res;
+    }
+
+    Node* BuildForm(const std::shared_ptr<Object>& form) {
+        std::optional<ObjectVector> items = ProperList2Vector(form);
+        if (!items || !items->front()) {
+            // left for the tree walker to report
+            return New<EvalNode>(form);
+        }
+        std::shared_ptr<Object> head = items->front();
+        ObjectVector args(items->begin() + 1, items->end());
+        if (head->GetType() == ObjectType::kSymbol) {
+            if (Node* node = BuildSpecialForm(AsPtr<Symbol>(head)->GetId(), args)) {
+                return node;
+            }
+        }
+        if (GetSpecialForm(head) == SpecialForm::kGuard) {
+            if (Node* node = BuildGuard(args)) {
+                return node;
+            }
+        }
+        return New<CallNode>(Build(head), BuildAll(args), args, true);
+    }
+
+    // nullptr if `name` isn't bound to a special form or the form is malformed, in which case
+    // it is built as a call and the functor reports the error
+    Node* BuildSpecialForm(SymbolId name, const ObjectVector& args) {
+        std::shared_ptr<Object>* binding = scope_->Find(name);
+        if (!binding) {
+            return nullptr;
+        }
+        switch (GetSpecialForm(*binding)) {
+            case SpecialForm::kQuote:
+                return args.size() == 1 ? New<ConstNode>(args[0]) : nullptr;
+            case SpecialForm::kIf:
+                if (args.size() != 2 && args.size() != 3) {
+                    return nullptr;
+                }
+                return New<IfNode>(Build(args[0]), Build(args[1]),
+                                   args.size() == 3 ? Build(args[2]) : nullptr);
+            case SpecialForm::kAnd:
+            case SpecialForm::kOr:
+                if (!CheckForNoNulls(args)) {
+                    return nullptr;
+                }
+                return New<BooleanNode>(BuildAll(args),
+                                        GetSpecialForm(*binding) == SpecialForm::kOr);
+            case SpecialForm::kDefine:
+                return BuildDefine(args);
+            case SpecialForm::kSet:
+                return BuildSet(args);
+            case SpecialForm::kLambda:
+                return BuildLambda(args);
+            case SpecialForm::kGuard:
+            case SpecialForm::kNone:
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    Node* BuildGuard(const ObjectVector& args) {
+        std::vector<SymbolId> names;
+        ObjectVector values;
+        if (args.size() != 3 || !GetGuardBindings(args[0], &names, &values)) {
+            return nullptr;
+        }
+        if (!BindGuardSpecialForms(scope_, &names, &values)) {
+            return Build(args[2]);
+        }
+        if (names.empty()) {
+            return Build(args[1]);
+        }
+        return New<GuardNode>(std::move(names), std::move(values), Build(args[1]),
+                              Build(args[2]));
+    }
+
+    Node* BuildDefine(const ObjectVector& args) {
+        if (args.size() < 2 || !args[0]) {
+            return nullptr;
+        }
+        if (Is<Symbol>(args[0])) {
+            if (args.size() != 2) {
+                return nullptr;
+            }
+            std::optional<ObjectVector> lambda = GetLambdaArgs(args[1]);
+            Node* value = lambda ? BuildLambda(*lambda, Canonical(args[0])) : nullptr;
+            return New<DefineNode>(Canonical(args[0]), value ? value : Build(args[1]));
+        }
+        std::optional<ObjectVector> signature = ProperList2Vector(args[0]);
+        if (!signature || signature->empty() || !Is<Symbol>(signature->front())) {
+            return nullptr;
+        }
+        std::optional<SlotNames> params =
+            Symbols2SlotNames(ObjectVector(signature->begin() + 1, signature->end()));
+        if (!params) {
+            return nullptr;
+        }
+        ObjectVector body(args.begin() + 1, args.end());
+        LambdaOrigin origin = GetLambdaOrigin(args[0], body, Canonical(signature->front()));
+        Node* lambda = New<LambdaNode>(*params, std::move(body), std::move(origin));
+        return New<DefineNode>(Canonical(signature->front()), lambda);
+    }
+
+    Node* BuildSet(const ObjectVector& args) {
+        if (args.size() != 2 || !Is<Symbol>(args[0])) {
+            return nullptr;
+        }
+        if (Is<LocalSymbol>(args[0])) {
+            const LocalSymbol* local = AsPtr<LocalSymbol>(args[0]);
+            return New<SetLocalNode>(local->GetDepth(), local->GetSlot(), Build(args[1]));
+        }
+        return New<SetGlobalNode>(Canonical(args[0]), Build(args[1]));
+    }
+
+    // The arguments of `expr` if it's a lambda expression
+    std::optional<ObjectVector> GetLambdaArgs(const std::shared_ptr<Object>& expr) const {
+        std::optional<ObjectVector> items = ProperList2Vector(expr);
+        if (!items || items->empty() || !items->front() ||
+            items->front()->GetType() != ObjectType::kSymbol) {
+            return std::nullopt;
+        }
+        std::shared_ptr<Object>* binding = scope_->Find(AsPtr<Symbol>(items->front())->GetId());
+        if (!binding || GetSpecialForm(*binding) != SpecialForm::kLambda) {
+            return std::nullopt;
+        }
+        return ObjectVector(items->begin() + 1, items->end());
+    }
+
+    // `name` is the variable the lambda is defined as, if any
+    Node* BuildLambda(const ObjectVector& args, std::shared_ptr<Symbol> name = nullptr) {
+        if (args.size() < 2 || (args[0] && !Is<Cell>(args[0]))) {
+            return nullptr;
+        }
+        std::optional<ObjectVector> names = ProperList2Vector(args[0]);
+        if (!names) {
+            return nullptr;
+        }
+        std::optional<SlotNames> params = Symbols2SlotNames(*names);
+        if (!params) {
+            return nullptr;
+        }
+        ObjectVector body(args.begin() + 1, args.end());
+        LambdaOrigin origin = GetLambdaOrigin(args[0], body, std::move(name));
+        return New<LambdaNode>(*params, std::move(body), std::move(origin));
+    }
+};
+
+}  // namespace
+
+Tree::Tree() = default;
+
+Tree::~Tree() = default;
+
+std::shared_ptr<Object> Tree::Execute(std::shared_ptr<Scope> scope) {
+    Tree* tree = this;
+    std::shared_ptr<Object> holder;  // keeps `tree` alive after a tail call
+    ProfileScope profile;
+    while (true) {
+        for (size_t i = 0; i + 1 < tree->body_.size(); i++) {
+            tree->body_[i]->Execute(scope, nullptr);
+        }
+        PendingCall tail;
+        std::shared_ptr<Object> res = tree->body_.back()->Execute(scope, &tail);
+        if (!tail.lambda) {
+            return res;
+        }
+        holder = std::move(tail.lambda);
+        profile.TailCall(holder.get());
+        tree = AsPtr<LambdaFunctor>(holder)->GetPrototype()->tree.get();
+        scope = std::move(tail.frame);
+    }
+}
+
+void Tree::Trace(const std::function<void(Object*)>& visit) const {
+    for (auto& i : nodes_) {
+        i->Trace(visit);
+    }
+}
+
+std::shared_ptr<Tree> BuildTree(const ObjectVector& body, const std::shared_ptr<Scope>& scope) {
+    auto tree = std::make_shared<Tree>();
+    TreeBuilder builder(tree.get(), scope);
+    for (auto& i : body) {
+        tree->body_.push_back(builder.Build(i));
+    }
+    if (body.empty()) {
+        tree->body_.push_back(builder.Build(nullptr));
+    }
+    for (auto& i : tree->body_) {
+        i->SetParentSlot(&i);
+    }
+    return tree;
+}
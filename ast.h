@@ -0,0 +1,54 @@
+#pragma once
+
+#include "object.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+class Node;
+
+// Lambda body or top-level form rewritten for the kAst engine into a tree of nodes: if,
+// calls, variable references and so on get dedicated classes instead of being looked up
+// and dispatched through IFunctor every time.
+//
+// Call nodes specialize themselves on the first execution: a call of a builtin like + or <
+// that gets two numbers becomes a node doing the arithmetic inline, as long as the operator
+// stays the same builtin and the operands stay numbers. When the guess fails the node is
+// replaced by the generic one for good. Replaced nodes are kept until the tree dies, since
+// a recursive call may still be executing them.
+//
+// Special forms are bound when the tree is built, like in the bytecode engine.
+class Tree {
+public:
+    Tree();
+
+    Tree(const Tree&) = delete;
+    Tree& operator=(const Tree&) = delete;
+
+    ~Tree();
+
+    // Evaluates the body in `scope` (a frame of the lambda) and returns the last value
+    std::shared_ptr<Object> Execute(std::shared_ptr<Scope> scope);
+
+    // Visits the objects the nodes reference (see Object::Trace)
+    void Trace(const std::function<void(Object*)>& visit) const;
+
+    // Takes ownership of `node`
+    template <class T>
+    T* Add(std::unique_ptr<T> node) {
+        T* res = node.get();
+        nodes_.push_back(std::move(node));
+        return res;
+    }
+
+private:
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::vector<Node*> body_;
+
+    friend std::shared_ptr<Tree> BuildTree(const ObjectVector& body,
+                                           const std::shared_ptr<Scope>& scope);
+};
+
+// Builds the tree of `body` run in `scope` or, for a lambda body resolved by ResolveBody,
+// in its frames
+std::shared_ptr<Tree> BuildTree(const ObjectVector& body, const std::shared_ptr<Scope>& scope);
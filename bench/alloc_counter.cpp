@@ -0,0 +1,29 @@
+#include "alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constinit thread_local uint64_t allocations = 0;
+
+}  // namespace
+
+uint64_t GetAllocations() {
+    return allocations;
+}
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* res = std::malloc(size ? size : 1)) {
+        return res;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
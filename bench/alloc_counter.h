@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Allocations made with operator new by the calling thread so far. The replacements of the
+// global operator new and delete that count them live in alloc_counter.cpp, apart from their
+// callers, so the compiler doesn't pair the allocations up with malloc and free.
+uint64_t GetAllocations();
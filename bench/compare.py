@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Compares two result files of scheme_bench, written with --benchmark_out=FILE.json.
+
+Prints the change of the time and of the allocations per iteration of every benchmark found
+in both files, and exits with 1 if any of them got slower, or allocates more, by more than
+the threshold. With --benchmark_repetitions the median of the repetitions is compared.
+
+    compare.py BASELINE.json CURRENT.json [--threshold 0.1] [--metric cpu_time]
+"""
+
+import argparse
+import json
+import sys
+
+NANOSECONDS = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path, metric):
+    """Name of every benchmark -> (time in nanoseconds, allocations per iteration or None)"""
+    with open(path) as f:
+        benchmarks = json.load(f)["benchmarks"]
+    medians = {}
+    best = {}
+    for bench in benchmarks:
+        value = (bench[metric] * NANOSECONDS[bench["time_unit"]], bench.get("allocs/op"))
+        name = bench.get("run_name", bench["name"])
+        if bench.get("run_type") == "aggregate":
+            if bench.get("aggregate_name") == "median":
+                medians[name] = value
+        elif name not in best or value[0] < best[name][0]:
+            best[name] = value
+    best.update(medians)
+    return best
+
+
+def format_time(ns):
+    for unit in ("s", "ms", "us"):
+        if ns >= NANOSECONDS[unit]:
+            return "%.3f %s" % (ns / NANOSECONDS[unit], unit)
+    return "%.1f ns" % ns
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0 if new == 0 else float("inf")
+    return new / old - 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="largest allowed relative growth, 0.1 by default")
+    parser.add_argument("--metric", choices=("real_time", "cpu_time"), default="cpu_time")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline, args.metric)
+    current = load(args.current, args.metric)
+    regressions = []
+    width = max((len(name) for name in current), default=0)
+    print("%-*s %12s %12s %8s %10s" % (width, "benchmark", "baseline", "current", "time",
+                                      "allocs"))
+    for name, (time, allocs) in current.items():
+        if name not in baseline:
+            print("%-*s %12s %12s   (new)" % (width, name, "", format_time(time)))
+            continue
+        old_time, old_allocs = baseline[name]
+        time_change = change(old_time, time)
+        line = "%-*s %12s %12s %+7.1f%%" % (width, name, format_time(old_time),
+                                           format_time(time), 100 * time_change)
+        regressed = time_change > args.threshold
+        if allocs is not None and old_allocs is not None:
+            allocs_change = change(old_allocs, allocs)
+            line += " %+9.1f%%" % (100 * allocs_change)
+            regressed = regressed or allocs_change > args.threshold
+        if regressed:
+            regressions.append(name)
+            line += "  REGRESSION"
+        print(line)
+    for name in baseline:
+        if name not in current:
+            print("%-*s   (missing)" % (width, name))
+
+    if regressions:
+        print("\n%d of %d benchmarks regressed by more than %.0f%%" %
+              (len(regressions), len(current), 100 * args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,720 @@
+#include <benchmark/benchmark.h>
+#include "alloc_counter.h"
+#include <scheme.h>
+#include <gc.h>
+#include <object.h>
+#include <parser.h>
+#include <pool.h>
+#include <printer.h>
+#include <tokenizer.h>
+#include <ucontext.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the parts of the library and programs run through Interpreter::Run on
+// every engine. Besides the time, each benchmark reports the allocations it makes per
+// iteration, counted on its own thread. Run with --benchmark_out=FILE.json to keep the
+// results and compare two runs with bench/compare.py.
+
+namespace {
+
+// Allocations of the calling thread so far: with operator new, and the objects of the
+// interpreter from the pool (Make<T>), which goes to operator new only for a whole chunk or a
+// block too big for it
+uint64_t CountAllocations() {
+    return GetAllocations() + PoolAllocations();
+}
+
+// Reports the allocations made since `start` as the "allocs/op" counter
+void ReportAllocations(benchmark::State& state, uint64_t start) {
+    state.counters["allocs/op"] =
+        benchmark::Counter(CountAllocations() - start, benchmark::Counter::kAvgIterations);
+}
+
+struct EngineInfo {
+    const char* name;
+    Engine engine;
+};
+
+constexpr EngineInfo kEngines[] = {
+    {"tree", Engine::kTreeWalker},
+    {"bytecode", Engine::kBytecode},
+    {"ast", Engine::kAst},
+};
+
+// A program run with Interpreter::Run: the definitions once, then the call every iteration
+struct Program {
+    const char* name;
+    const char* definitions;
+    const char* call;
+};
+
+const Program kPrograms[] = {
+    {"fib", "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))", "(fib 20)"},
+    {"tak",
+     "(define (tak x y z) (if (< y x)"
+     " (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z))",
+     "(tak 18 12 6)"},
+    {"ackermann",
+     "(define (ack m n) (if (= m 0) (+ n 1)"
+     " (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))",
+     "(ack 2 100)"},
+    {"nqueens",
+     "(define (attacks? a b dist) (or (= a b) (= (- a b) dist) (= (- b a) dist)))\n"
+     "(define (safe? q placed dist) (if (null? placed) #t"
+     " (if (attacks? q (car placed) dist) #f (safe? q (cdr placed) (+ dist 1)))))\n"
+     "(define (place n row placed) (if (= row 0) 1 (try n 1 row placed)))\n"
+     "(define (try n q row placed) (if (> q n) 0"
+     " (+ (if (safe? q placed 1) (place n (- row 1) (cons q placed)) 0)"
+     " (try n (+ q 1) row placed))))",
+     "(place 8 8 '())"},
+    {"sort",
+     "(define (next x) (- (+ (* x 7919) 13) (* 10007 (/ (+ (* x 7919) 13) 10007))))\n"
+     "(define (random-list n x acc) (if (= n 0) acc (random-list (- n 1) (next x) (cons x acc))))\n"
+     "(define (split xs a b) (if (null? xs) (cons a b) (split (cdr xs) b (cons (car xs) a))))\n"
+     "(define (merge a b) (if (null? a) b (if (null? b) a (if (< (car a) (car b))"
+     " (cons (car a) (merge (cdr a) b)) (cons (car b) (merge a (cdr b)))))))\n"
+     "(define (sort xs) (if (or (null? xs) (null? (cdr xs))) xs"
+     " (sort-halves (split xs '() '()))))\n"
+     "(define (sort-halves halves) (merge (sort (car halves)) (sort (cdr halves))))\n"
+     "(define data (random-list 1000 1 '()))",
+     "(car (sort data))"},
+    {"deep-recursion", "(define (sum n) (if (= n 0) 0 (+ n (sum (- n 1)))))", "(sum 5000)"},
+    {"bigint", "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))", "(fact 200)"},
+    {"vectors",
+     "(define v (make-vector 1000 0))\n"
+     "(define (fill i) (if (= i 1000) v (begin-fill i)))\n"
+     "(define (begin-fill i) (vector-set! v i i) (fill (+ i 1)))\n"
+     "(define (sum i acc) (if (= i 1000) acc (sum (+ i 1) (+ acc (vector-ref v i)))))",
+     "(sum 0 (vector-length (fill 0)))"},
+    {"strings",
+     "(define (build n s) (if (= n 0) s (build (- n 1) (string-append s (number->string n)))))",
+     "(string-length (build 200 \"\"))"},
+    {"hash-tables",
+     "(define (fill h i) (if (= i 0) h (fill-next h i)))\n"
+     "(define (fill-next h i) (hash-table-set! h i (* i i)) (fill h (- i 1)))\n"
+     "(define (sum h i acc) (if (= i 0) acc (sum h (- i 1) (+ acc (hash-table-ref h i)))))",
+     "(sum (fill (make-hash-table) 1000) 1000 0)"},
+};
+
+void RunProgram(benchmark::State& state, const Program& program, Engine engine) {
+    Interpreter interpreter;
+    interpreter.SetEngine(engine);
+    interpreter.RunAll(program.definitions);
+    std::string call = program.call;
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    ReportAllocations(state, start);
+}
+
+// A builtin or special form called 1000 times by a loop in the program, "nop" is the loop
+// alone. The variables of kBuiltinDefinitions and the counter `n` can be used.
+struct BuiltinCall {
+    const char* name;
+    const char* expression;
+};
+
+constexpr int kBuiltinCalls = 1000;
+
+const char* const kBuiltinDefinitions =
+    "(define xs (list 1 2 3))\n"
+    "(define v (make-vector 8 0))\n"
+    "(define p (cons 1 2))\n"
+    "(define s \"hello, world\")\n"
+    "(define s2 \"hello, there\")\n"
+    "(define counter 0)\n"
+    "(define (first k v) k)\n"
+    "(define (fill h i) (hash-table-set! h i i) (if (= i 0) h (fill h (- i 1))))\n"
+    "(define h (fill (make-hash-table) 100))\n"
+    "(define h2 (fill (make-hash-table) 3))";
+
+const BuiltinCall kBuiltinCallList[] = {
+    {"nop", "0"},
+    {"+", "(+ n 1)"},
+    {"-", "(- n 1)"},
+    {"*", "(* n 3)"},
+    {"/", "(/ n 3)"},
+    {"abs", "(abs -5)"},
+    {"max", "(max n 3)"},
+    {"min", "(min n 3)"},
+    {"<", "(< n 3)"},
+    {">", "(> n 3)"},
+    {"=", "(= n 3)"},
+    {"<=", "(<= n 3)"},
+    {">=", "(>= n 3)"},
+    {"number?", "(number? n)"},
+    {"quote", "'(1 2)"},
+    {"and", "(and #t n)"},
+    {"or", "(or #f n)"},
+    {"not", "(not n)"},
+    {"boolean?", "(boolean? n)"},
+    {"pair?", "(pair? xs)"},
+    {"null?", "(null? xs)"},
+    {"car", "(car xs)"},
+    {"cdr", "(cdr xs)"},
+    {"cons", "(cons n xs)"},
+    {"list?", "(list? xs)"},
+    {"list", "(list 1 2 3)"},
+    {"list-tail", "(list-tail xs 2)"},
+    {"list-ref", "(list-ref xs 2)"},
+    {"vector?", "(vector? v)"},
+    {"make-vector", "(make-vector 8 0)"},
+    {"vector", "(vector 1 2 3)"},
+    {"vector-length", "(vector-length v)"},
+    {"vector-ref", "(vector-ref v 2)"},
+    {"vector-set!", "(vector-set! v 2 n)"},
+    {"vector-fill!", "(vector-fill! v 0)"},
+    {"list->vector", "(list->vector xs)"},
+    {"vector->list", "(vector->list v)"},
+    {"hash-table?", "(hash-table? h)"},
+    {"make-hash-table", "(make-hash-table)"},
+    {"hash-table-ref", "(hash-table-ref h 7)"},
+    {"hash-table-ref/default", "(hash-table-ref/default h 1000 0)"},
+    {"hash-table-set!", "(hash-table-set! h 7 n)"},
+    {"hash-table-delete!", "(hash-table-delete! h 1000)"},
+    {"hash-table-exists?", "(hash-table-exists? h 7)"},
+    {"hash-table-count", "(hash-table-count h)"},
+    {"hash-table-walk", "(hash-table-walk h2 first)"},
+    {"hash-table-keys", "(hash-table-keys h2)"},
+    {"hash-table-values", "(hash-table-values h2)"},
+    {"string?", "(string? s)"},
+    {"string-length", "(string-length s)"},
+    {"string-ref", "(string-ref s 3)"},
+    {"substring", "(substring s 2 6)"},
+    {"string-append", "(string-append s s2)"},
+    {"string=?", "(string=? s s2)"},
+    {"string<?", "(string<? s s2)"},
+    {"string->symbol", "(string->symbol s)"},
+    {"symbol->string", "(symbol->string 'abc)"},
+    {"number->string", "(number->string n)"},
+    {"char?", "(char? #\\a)"},
+    {"char->integer", "(char->integer #\\a)"},
+    {"integer->char", "(integer->char 65)"},
+    {"symbol?", "(symbol? 'a)"},
+    {"if", "(if #t 1 2)"},
+    {"define", "(define local n)"},
+    {"set!", "(set! counter n)"},
+    {"set-car!", "(set-car! p n)"},
+    {"set-cdr!", "(set-cdr! p n)"},
+    {"lambda", "(lambda (x) x)"},
+};
+
+void RunBuiltin(benchmark::State& state, const BuiltinCall& builtin) {
+    Interpreter interpreter;
+    interpreter.RunAll(kBuiltinDefinitions);
+    interpreter.Run(std::string("(define (loop n) ") + builtin.expression +
+                    " (if (= n 0) 0 (loop (- n 1))))");
+    std::string call = "(loop " + std::to_string(kBuiltinCalls - 1) + ")";
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    ReportAllocations(state, start);
+    state.counters["time/call"] =
+        benchmark::Counter(static_cast<double>(state.iterations()) * kBuiltinCalls,
+                           benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// All the programs, as one source of some 10 KB
+const std::string& GetSource() {
+    static const std::string kSource = [] {
+        std::string res;
+        for (int i = 0; i < 4; i++) {
+            for (const Program& program : kPrograms) {
+                res += program.definitions;
+                res += "\n";
+                res += program.call;
+                res += "\n";
+            }
+        }
+        return res;
+    }();
+    return kSource;
+}
+
+std::string MakeDeepList(int depth) {
+    return std::string(depth, '(') + std::string(depth, ')');
+}
+
+std::string MakeWideList(int width) {
+    std::string res = "(";
+    for (int i = 0; i < width; i++) {
+        res += std::to_string(i) + " ";
+    }
+    return res + ")";
+}
+
+std::shared_ptr<Object> ReadOne(const std::string& source,
+                                size_t max_nesting = kDefaultMaxNesting) {
+    Tokenizer tokenizer{std::string_view(source)};
+    return Read(&tokenizer, max_nesting);
+}
+
+void BM_Tokenize(benchmark::State& state) {
+    const std::string& source = GetSource();
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        Tokenizer tokenizer{std::string_view(source)};
+        size_t tokens = 0;
+        for (; !tokenizer.IsEnd(); tokenizer.Next()) {
+            tokens++;
+        }
+        benchmark::DoNotOptimize(tokens);
+    }
+    ReportAllocations(state, start);
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_Tokenize);
+
+void BM_Read(benchmark::State& state) {
+    const std::string& source = GetSource();
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        Tokenizer tokenizer{std::string_view(source)};
+        while (!tokenizer.IsEnd()) {
+            benchmark::DoNotOptimize(Read(&tokenizer));
+        }
+    }
+    ReportAllocations(state, start);
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_Read);
+
+void BM_ReadDeep(benchmark::State& state) {
+    std::string source = MakeDeepList(state.range(0));
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ReadOne(source, state.range(0)));
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_ReadDeep)->Arg(5000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+void BM_ReadWide(benchmark::State& state) {
+    std::string source = MakeWideList(state.range(0));
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ReadOne(source));
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_ReadWide)->Arg(100000);
+
+// Forms of 100 tokens each, `range(0)` tokens in all, read one after the other
+void BM_ReadBroad(benchmark::State& state) {
+    std::string form = MakeWideList(98);
+    std::string source;
+    for (int64_t i = 0; i < state.range(0); i += 100) {
+        source += form;
+    }
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        Tokenizer tokenizer{std::string_view(source)};
+        while (!tokenizer.IsEnd()) {
+            benchmark::DoNotOptimize(Read(&tokenizer));
+        }
+    }
+    ReportAllocations(state, start);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReadBroad)->Arg(10000000)->Unit(benchmark::kMillisecond);
+
+void BM_Serialize(benchmark::State& state) {
+    std::shared_ptr<Object> list = ReadOne(MakeWideList(state.range(0)));
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(list->Serialize());
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_Serialize)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+void BM_SerializeDeep(benchmark::State& state) {
+    std::shared_ptr<Object> list = ReadOne(MakeDeepList(state.range(0)), state.range(0));
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        std::string res;
+        Print(list.get(), &res);
+        benchmark::DoNotOptimize(res);
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_SerializeDeep)->Arg(5000)->Arg(100000);
+
+// A name of the global scope looked up from a scope `range(0)` levels under it
+void BM_ScopeGet(benchmark::State& state) {
+    std::shared_ptr<Scope> scope(new Scope(nullptr));
+    for (int i = 0; i < 64; i++) {
+        scope->Define("name" + std::to_string(i), Number::FromValue(i));
+    }
+    for (int64_t i = 0; i < state.range(0); i++) {
+        scope = std::shared_ptr<Scope>(new Scope(scope));
+    }
+    std::shared_ptr<Symbol> name = Symbol::Intern("name63");
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(scope->Get(*name));
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_ScopeGet)->Arg(0)->Arg(8)->Arg(64);
+
+constexpr int kRandomAccesses = 100;
+
+const char* const kRandomAccessDefinitions =
+    "(define v (make-vector 1000000 1))\n"
+    "(define xs (vector->list v))\n"
+    "(define (next i) (- (+ (* i 7919) 13) (* 1000000 (/ (+ (* i 7919) 13) 1000000))))\n"
+    "(define (walk-vector i n acc)"
+    " (if (= n 0) acc (walk-vector (next i) (- n 1) (+ acc (vector-ref v i)))))\n"
+    "(define (walk-list i n acc)"
+    " (if (= n 0) acc (walk-list (next i) (- n 1) (+ acc (list-ref xs i)))))";
+
+// kRandomAccesses lookups at pseudo-random indices of a vector (range(0) = 0) or a list (1)
+// of 10^6 elements
+void BM_RandomAccess(benchmark::State& state) {
+    Interpreter interpreter;
+    interpreter.RunAll(kRandomAccessDefinitions);
+    std::string call = std::string(state.range(0) ? "(walk-list" : "(walk-vector") + " 1 " +
+                       std::to_string(kRandomAccesses) + " 0)";
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    ReportAllocations(state, start);
+    state.SetItemsProcessed(state.iterations() * kRandomAccesses);
+}
+BENCHMARK(BM_RandomAccess)->ArgName("list")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// A string of 10 MB built by string-append of 16 characters at a time
+void BM_StringBuild(benchmark::State& state) {
+    constexpr int kAppends = (10 << 20) / 16;
+    Interpreter interpreter;
+    interpreter.Run(
+        "(define (build n s)"
+        " (if (= n 0) s (build (- n 1) (string-append s \"0123456789abcdef\"))))");
+    std::string call = "(string-length (build " + std::to_string(kAppends) + " \"\"))";
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    ReportAllocations(state, start);
+    state.SetItemsProcessed(state.iterations() * kAppends);
+}
+BENCHMARK(BM_StringBuild)->Unit(benchmark::kMillisecond);
+
+const char* const kHashTableDefinitions =
+    "(define (fill h i) (if (= i 0) h (fill-next h i)))\n"
+    "(define (fill-next h i) (hash-table-set! h i i) (fill h (- i 1)))\n"
+    "(define (sum h i acc) (if (= i 0) acc (sum h (- i 1) (+ acc (hash-table-ref h i)))))\n"
+    "(define table (fill (make-hash-table) 1000000))";
+
+// 10^6 keys put into a new hash table (range(0) = 0) or looked up in one (1)
+void BM_HashTable(benchmark::State& state) {
+    Interpreter interpreter;
+    interpreter.RunAll(kHashTableDefinitions);
+    std::string call = state.range(0) ? "(sum table 1000000 0)"
+                                      : "(hash-table-count (fill (make-hash-table) 1000000))";
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    ReportAllocations(state, start);
+    state.SetItemsProcessed(state.iterations() * 1000000);
+}
+BENCHMARK(BM_HashTable)->ArgName("lookup")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// RunFile of all the programs, in a new interpreter every time
+void BM_RunFile(benchmark::State& state) {
+    std::string path = "scheme_bench_run_file.scm";
+    std::ofstream(path) << GetSource();
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        Interpreter interpreter;
+        benchmark::DoNotOptimize(interpreter.RunFile(path));
+    }
+    ReportAllocations(state, start);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_RunFile)->Unit(benchmark::kMillisecond);
+
+// A new interpreter with the definitions of all the programs, evaluated from the source or
+// loaded from an image
+void BM_ColdStart(benchmark::State& state) {
+    std::string prelude;
+    for (const Program& program : kPrograms) {
+        prelude += program.definitions;
+        prelude += "\n";
+    }
+    std::string path = "scheme_bench_cold_start.img";
+    {
+        Interpreter interpreter;
+        interpreter.RunAll(prelude);
+        interpreter.SaveImage(path);
+    }
+    bool image = state.range(0);
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        Interpreter interpreter;
+        if (image) {
+            interpreter.LoadImage(path);
+        } else {
+            interpreter.RunAll(prelude);
+        }
+    }
+    ReportAllocations(state, start);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_ColdStart)->ArgName("image")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+const std::function<void()>* stack_task = nullptr;
+std::exception_ptr stack_error;
+
+void RunStackTask() {
+    try {
+        (*stack_task)();
+    } catch (...) {
+        stack_error = std::current_exception();
+    }
+}
+
+// Runs `task` on a stack of its own and returns the most bytes of it the task used
+size_t MeasureStack(const std::function<void()>& task) {
+    constexpr unsigned char kPaint = 0xa5;
+    // the stack grows down, from the end of the buffer
+    std::vector<unsigned char> stack(8 << 20, kPaint);
+    ucontext_t caller;
+    ucontext_t callee;
+    getcontext(&callee);
+    callee.uc_stack.ss_sp = stack.data();
+    callee.uc_stack.ss_size = stack.size();
+    callee.uc_link = &caller;
+    makecontext(&callee, RunStackTask, 0);
+    stack_task = &task;
+    stack_error = nullptr;
+    swapcontext(&caller, &callee);
+    if (stack_error) {
+        std::rethrow_exception(stack_error);
+    }
+    auto used = std::ranges::find_if(stack, [](unsigned char c) { return c != kPaint; });
+    return stack.end() - used;
+}
+
+// slow-add of repl/main.cpp counting 10^7 down on engine `range(0)`. The loop is a tail
+// call, so it runs in constant native stack: "stack" is the most bytes of it the runs used.
+void BM_SlowAdd(benchmark::State& state) {
+    constexpr int kSteps = 10000000;
+    Interpreter interpreter;
+    interpreter.SetEngine(kEngines[state.range(0)].engine);
+    interpreter.Run(
+        "(define slow-add (lambda (x y) (if (= x 0) y (slow-add (- x 1) (+ y 1)))))");
+    std::string call = "(slow-add " + std::to_string(kSteps) + " 0)";
+    uint64_t start = CountAllocations();
+    size_t stack = MeasureStack([&state, &interpreter, &call] {
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(interpreter.Run(call));
+        }
+    });
+    ReportAllocations(state, start);
+    state.counters["stack"] = stack;
+    state.SetItemsProcessed(state.iterations() * kSteps);
+}
+BENCHMARK(BM_SlowAdd)->ArgName("engine")->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+
+// 1000 steps of a loop counting down on engine `range(0)`, from 1000 (range(1) = 0) or from
+// 10^6 + 1000 (1). Numbers up to 1024 are shared instances (see Number::FromValue), so only
+// the counter past them allocates a number per step; every step allocates a frame either way.
+void BM_CountLoop(benchmark::State& state) {
+    constexpr int kSteps = 1000;
+    Interpreter interpreter;
+    interpreter.SetEngine(kEngines[state.range(0)].engine);
+    interpreter.Run("(define (count-down n stop) (if (= n stop) n (count-down (- n 1) stop)))");
+    int64_t stop = state.range(1) ? 1000000 : 0;
+    std::string call =
+        "(count-down " + std::to_string(stop + kSteps) + " " + std::to_string(stop) + ")";
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(call));
+    }
+    double allocations = CountAllocations() - start;
+    state.counters["allocs/step"] =
+        benchmark::Counter(allocations / kSteps, benchmark::Counter::kAvgIterations);
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_CountLoop)
+    ->ArgNames({"engine", "big"})
+    ->ArgsProduct({{0, 1, 2}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+// fib on the bytecode engine without the profiler, and with it in the exact and the
+// sampling mode
+void BM_Profiler(benchmark::State& state) {
+    Interpreter interpreter;
+    interpreter.RunAll(kPrograms[0].definitions);
+    if (state.range(0) > 0) {
+        interpreter.StartProfiler(state.range(0) == 1 ? ProfileMode::kExact
+                                                      : ProfileMode::kSampling);
+    }
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(kPrograms[0].call));
+    }
+    ReportAllocations(state, start);
+    interpreter.StopProfiler();
+}
+BENCHMARK(BM_Profiler)->ArgName("mode")->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+// A loop calling + and the other builtins from `range(1)` nested lambdas, on the bytecode
+// (range(0) = 1) or the AST engine (2). The global bindings are cached where they are
+// referenced, so the depth shouldn't matter.
+void BM_NestedGlobals(benchmark::State& state) {
+    int depth = state.range(1);
+    std::string source = "(define (run n) ";
+    for (int i = 0; i < depth; i++) {
+        source += "((lambda (x" + std::to_string(i) + ") ";
+    }
+    source += "(define (loop i acc) (if (= i 0) acc (loop (- i 1) (+ acc 1)))) (loop n 0)";
+    for (int i = 0; i < depth; i++) {
+        source += ") " + std::to_string(i) + ")";
+    }
+    source += ")";
+    Interpreter interpreter;
+    interpreter.SetEngine(static_cast<Engine>(state.range(0)));
+    interpreter.Run(source);
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run("(run 1000)"));
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_NestedGlobals)
+    ->ArgNames({"engine", "depth"})
+    ->ArgsProduct({{1, 2}, {0, 10}})
+    ->Unit(benchmark::kMicrosecond);
+
+// Run of the same 16 sources over and over, with the parse cache off and on. A hit still
+// copies the cells of the form, it only saves reading the source.
+void BM_RunRepeated(benchmark::State& state) {
+    std::vector<std::string> sources;
+    for (int i = 0; i < 16; i++) {
+        std::string numbers;
+        for (int j = 0; j < 100; j++) {
+            numbers += " " + std::to_string(i * j);
+        }
+        sources.push_back(i % 2 ? "(car '(" + numbers + "))" : "(+" + numbers + ")");
+    }
+    Interpreter interpreter;
+    if (state.range(0)) {
+        interpreter.SetParseCacheBudget(1 << 20);
+    }
+    size_t next = 0;
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(sources[next++ % sources.size()]));
+    }
+    ReportAllocations(state, start);
+    state.counters["hits"] = interpreter.GetParseCacheStats().hits;
+}
+BENCHMARK(BM_RunRepeated)->ArgName("cache")->Arg(0)->Arg(1);
+
+// fib on the bytecode engine without limits and with fuel and a timeout, neither of them
+// reached. Every call is charged either way, the limits are only looked at now and then.
+void BM_Budget(benchmark::State& state) {
+    Interpreter interpreter;
+    interpreter.RunAll(kPrograms[0].definitions);
+    if (state.range(0)) {
+        interpreter.SetFuel(uint64_t{1} << 40);
+        interpreter.SetTimeout(std::chrono::hours(1));
+    }
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run(kPrograms[0].call));
+    }
+    ReportAllocations(state, start);
+}
+BENCHMARK(BM_Budget)->ArgName("limits")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// A loop full of constant arithmetic, branches on constants and calls of small helpers, on
+// engine `range(0)` with the optimizer off and on (range(1))
+void BM_Optimizer(benchmark::State& state) {
+    Interpreter interpreter;
+    interpreter.SetEngine(static_cast<Engine>(state.range(0)));
+    if (state.range(1)) {
+        interpreter.EnableOptimizer();
+    }
+    interpreter.RunAll(
+        "(define (sq x) (* x x))"
+        "(define (lerp a b) (+ a (* (- b a) 2)))"
+        "(define (work n acc)"
+        "  (if (= n 0) acc"
+        "      (work (- n 1) (+ acc (sq 3) (* 2 (+ 1 2)) (lerp n 4) (if (< 1 2) n 0)))))");
+    uint64_t start = CountAllocations();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(interpreter.Run("(work 1000 0)"));
+    }
+    ReportAllocations(state, start);
+    OptimizerStats stats = interpreter.GetOptimizerStats();
+    state.counters["folded"] = stats.folded;
+    state.counters["pruned"] = stats.pruned;
+    state.counters["inlined"] = stats.inlined;
+}
+BENCHMARK(BM_Optimizer)
+    ->ArgNames({"engine", "optimizer"})
+    ->ArgsProduct({{0, 1, 2}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+// 64 runs of fib spread over a pool of `range(0)` threads
+void BM_RunMany(benchmark::State& state) {
+    std::vector<std::string> programs(64, std::string(kPrograms[0].definitions) + "(fib 18)");
+    ThreadPool pool(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(RunMany(programs, &pool));
+    }
+    state.SetItemsProcessed(state.iterations() * programs.size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (const Program& program : kPrograms) {
+        for (const EngineInfo& engine : kEngines) {
+            benchmark::RegisterBenchmark(
+                (std::string("BM_Program/") + program.name + "/" + engine.name).c_str(),
+                [&program, &engine](benchmark::State& state) {
+                    RunProgram(state, program, engine.engine);
+                })
+                ->Unit(benchmark::kMicrosecond);
+        }
+    }
+    for (const BuiltinCall& builtin : kBuiltinCallList) {
+        benchmark::RegisterBenchmark((std::string("BM_Builtin/") + builtin.name).c_str(),
+                                     [&builtin](benchmark::State& state) {
+                                         RunBuiltin(state, builtin);
+                                     })
+            ->Unit(benchmark::kMicrosecond);
+    }
+    // last: once a process has started a thread, libstdc++ counts all the references
+    // atomically, which would slow down the benchmarks after it
+    benchmark::RegisterBenchmark("BM_RunMany", BM_RunMany)
+        ->ArgName("threads")
+        ->RangeMultiplier(2)
+        ->Range(1, 8)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,326 @@
+#include "bigint.h"
+#include <algorithm>
+#include <bit>
+#include <span>
+
+namespace {
+
+using Limbs = std::vector<uint32_t>;
+using LimbSpan = std::span<const uint32_t>;
+
+constexpr uint64_t kBase = uint64_t(1) << 32;
+constexpr size_t kKaratsubaThreshold = 32;  // limbs
+constexpr uint32_t kDecimalChunk = 1000000000;
+constexpr size_t kDecimalChunkDigits = 9;
+
+void Trim(Limbs* a) {
+    while (!a->empty() && a->back() == 0) {
+        a->pop_back();
+    }
+}
+
+// Expects trimmed magnitudes
+int CompareMagnitudes(LimbSpan a, LimbSpan b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+Limbs AddMagnitudes(LimbSpan a, LimbSpan b) {
+    if (a.size() < b.size()) {
+        std::swap(a, b);
+    }
+    Limbs res(a.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        carry += uint64_t(a[i]) + (i < b.size() ? b[i] : 0);
+        res[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    res[a.size()] = static_cast<uint32_t>(carry);
+    Trim(&res);
+    return res;
+}
+
+// `a` must be at least `b`, and not shorter
+Limbs SubtractMagnitudes(LimbSpan a, LimbSpan b) {
+    Limbs res(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t diff = int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = diff < 0;
+        res[i] = static_cast<uint32_t>(diff);  // modulo 2^32
+    }
+    Trim(&res);
+    return res;
+}
+
+// res += a * base^shift, `res` must have room for the sum
+void AddShifted(Limbs* res, LimbSpan a, size_t shift) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < a.size(); i++) {
+        carry += uint64_t((*res)[i + shift]) + a[i];
+        (*res)[i + shift] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    for (i += shift; carry; i++) {
+        carry += (*res)[i];
+        (*res)[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+}
+
+Limbs MultiplySchoolbook(LimbSpan a, LimbSpan b) {
+    if (a.size() > b.size()) {
+        std::swap(a, b);  // long inner loops
+    }
+    Limbs res(a.size() + b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            uint64_t cur = uint64_t(a[i]) * b[j] + res[i + j] + carry;  // fits into 64 bits
+            res[i + j] = static_cast<uint32_t>(cur);
+            carry = cur >> 32;
+        }
+        res[i + b.size()] = static_cast<uint32_t>(carry);
+    }
+    Trim(&res);
+    return res;
+}
+
+Limbs MultiplyMagnitudes(LimbSpan a, LimbSpan b) {
+    if (a.size() < kKaratsubaThreshold || b.size() < kKaratsubaThreshold) {
+        return MultiplySchoolbook(a, b);
+    }
+    // a = a1 * base^half + a0, b likewise:
+    // a * b = z2 * base^(2 * half) + z1 * base^half + z0, where
+    // z1 = (a0 + a1) * (b0 + b1) - z0 - z2
+    size_t half = std::min(a.size(), b.size()) / 2;
+    LimbSpan a0 = a.first(half), a1 = a.subspan(half);
+    LimbSpan b0 = b.first(half), b1 = b.subspan(half);
+    Limbs z0 = MultiplyMagnitudes(a0, b0);
+    Limbs z2 = MultiplyMagnitudes(a1, b1);
+    Limbs z1 = MultiplyMagnitudes(AddMagnitudes(a0, a1), AddMagnitudes(b0, b1));
+    z1 = SubtractMagnitudes(SubtractMagnitudes(z1, z0), z2);
+    Limbs res(a.size() + b.size());
+    AddShifted(&res, z0, 0);
+    AddShifted(&res, z1, half);
+    AddShifted(&res, z2, 2 * half);
+    Trim(&res);
+    return res;
+}
+
+// a * mul + add, in place
+void MultiplyAddLimb(Limbs* a, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (auto& limb : *a) {
+        carry += uint64_t(limb) * mul;
+        limb = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    if (carry) {
+        a->push_back(static_cast<uint32_t>(carry));
+    }
+}
+
+Limbs DivideByLimb(LimbSpan a, uint32_t b, uint32_t* remainder) {
+    Limbs res(a.size());
+    uint64_t rest = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        uint64_t cur = (rest << 32) | a[i];
+        res[i] = static_cast<uint32_t>(cur / b);
+        rest = cur % b;
+    }
+    Trim(&res);
+    if (remainder) {
+        *remainder = static_cast<uint32_t>(rest);
+    }
+    return res;
+}
+
+// a * 2^shift in `size` limbs, shift < 32
+Limbs ShiftLeft(LimbSpan a, int shift, size_t size) {
+    Limbs res(size);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t cur = uint64_t(a[i]) << shift;
+        res[i] |= static_cast<uint32_t>(cur);
+        if (i + 1 < size) {
+            res[i + 1] |= static_cast<uint32_t>(cur >> 32);
+        }
+    }
+    return res;
+}
+
+// Quotient of trimmed magnitudes, Knuth's algorithm D (TAOCP 4.3.1)
+Limbs DivideMagnitudes(LimbSpan a, LimbSpan b) {
+    if (CompareMagnitudes(a, b) < 0) {
+        return {};
+    }
+    if (b.size() == 1) {
+        return DivideByLimb(a, b[0], nullptr);
+    }
+    // scale so that the top limb of the divisor has its high bit set, then the quotient
+    // digit estimated from the top limbs is at most 2 too big
+    int shift = std::countl_zero(b.back());
+    Limbs u = ShiftLeft(a, shift, a.size() + 1);
+    Limbs v = ShiftLeft(b, shift, b.size());
+    size_t n = v.size();
+    size_t m = a.size() - n;
+    Limbs q(m + 1);
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t top = (uint64_t(u[j + n]) << 32) | u[j + n - 1];
+        uint64_t qhat = top / v[n - 1];
+        uint64_t rhat = top % v[n - 1];
+        while (qhat >= kBase || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])) {
+            qhat--;
+            rhat += v[n - 1];
+            if (rhat >= kBase) {
+                break;
+            }
+        }
+        // u -= qhat * v, shifted by j
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = qhat * v[i] + carry;
+            carry = product >> 32;
+            int64_t diff = int64_t(u[i + j]) - borrow - int64_t(product & (kBase - 1));
+            u[i + j] = static_cast<uint32_t>(diff);
+            borrow = diff < 0;
+        }
+        int64_t diff = int64_t(u[j + n]) - borrow - int64_t(carry);
+        u[j + n] = static_cast<uint32_t>(diff);
+        if (diff < 0) {
+            // qhat was one too big, add v back
+            qhat--;
+            carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                carry += uint64_t(u[i + j]) + v[i];
+                u[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            u[j + n] += static_cast<uint32_t>(carry);
+        }
+        q[j] = static_cast<uint32_t>(qhat);
+    }
+    Trim(&q);
+    return q;
+}
+
+}  // namespace
+
+BigInt::BigInt(Limbs limbs, bool negative) : limbs_(std::move(limbs)) {
+    Trim(&limbs_);
+    negative_ = negative && !limbs_.empty();
+}
+
+BigInt::BigInt(int64_t value) {
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+    limbs_ = {static_cast<uint32_t>(magnitude), static_cast<uint32_t>(magnitude >> 32)};
+    Trim(&limbs_);
+    negative_ = value < 0;
+}
+
+BigInt BigInt::FromString(std::string_view text) {
+    bool negative = false;
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    Limbs limbs;
+    // 9 digits at a time: the first chunk is the shorter one
+    size_t chunk = text.size() % kDecimalChunkDigits;
+    if (chunk == 0) {
+        chunk = kDecimalChunkDigits;
+    }
+    for (size_t pos = 0; pos < text.size(); pos += chunk, chunk = kDecimalChunkDigits) {
+        uint32_t value = 0;
+        uint32_t scale = 1;
+        for (char c : text.substr(pos, chunk)) {
+            value = value * 10 + (c - '0');
+            scale *= 10;
+        }
+        MultiplyAddLimb(&limbs, scale, value);
+    }
+    return BigInt(std::move(limbs), negative);
+}
+
+std::string BigInt::ToString() const {
+    if (limbs_.empty()) {
+        return "0";
+    }
+    std::vector<uint32_t> chunks;  // least significant first
+    Limbs rest = limbs_;
+    while (!rest.empty()) {
+        uint32_t chunk;
+        rest = DivideByLimb(rest, kDecimalChunk, &chunk);
+        chunks.push_back(chunk);
+    }
+    std::string res = negative_ ? "-" : "";
+    res += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        std::string digits = std::to_string(chunks[i]);
+        res.append(kDecimalChunkDigits - digits.size(), '0');
+        res += digits;
+    }
+    return res;
+}
+
+std::optional<int64_t> BigInt::ToInt64() const {
+    if (limbs_.size() > 2) {
+        return std::nullopt;
+    }
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    uint64_t limit = uint64_t(INT64_MAX) + negative_;
+    if (magnitude > limit) {
+        return std::nullopt;
+    }
+    return negative_ ? static_cast<int64_t>(0 - magnitude) : static_cast<int64_t>(magnitude);
+}
+
+BigInt BigInt::operator-() const {
+    return BigInt(limbs_, !negative_);
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+    if (a.negative_ == b.negative_) {
+        return BigInt(AddMagnitudes(a.limbs_, b.limbs_), a.negative_);
+    }
+    if (CompareMagnitudes(a.limbs_, b.limbs_) >= 0) {
+        return BigInt(SubtractMagnitudes(a.limbs_, b.limbs_), a.negative_);
+    }
+    return BigInt(SubtractMagnitudes(b.limbs_, a.limbs_), b.negative_);
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + -b;
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    return BigInt(MultiplyMagnitudes(a.limbs_, b.limbs_), a.negative_ != b.negative_);
+}
+
+BigInt operator/(const BigInt& a, const BigInt& b) {
+    return BigInt(DivideMagnitudes(a.limbs_, b.limbs_), a.negative_ != b.negative_);
+}
+
+std::strong_ordering operator<=>(const BigInt& a, const BigInt& b) {
+    if (a.negative_ != b.negative_) {
+        return a.negative_ ? std::strong_ordering::less : std::strong_ordering::greater;
+    }
+    int res = CompareMagnitudes(a.limbs_, b.limbs_);
+    if (a.negative_) {
+        res = -res;
+    }
+    return res <=> 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <compare>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary precision integer: a sign and a magnitude in base 2^32
+class BigInt {
+public:
+    BigInt() = default;
+
+    explicit BigInt(int64_t value);
+
+    // `text` is decimal digits with an optional sign
+    static BigInt FromString(std::string_view text);
+
+    std::string ToString() const;
+
+    // The value if it fits into int64_t
+    std::optional<int64_t> ToInt64() const;
+
+    bool IsZero() const {
+        return limbs_.empty();
+    }
+
+    bool IsNegative() const {
+        return negative_;
+    }
+
+    BigInt operator-() const;
+
+    friend BigInt operator+(const BigInt& a, const BigInt& b);
+
+    friend BigInt operator-(const BigInt& a, const BigInt& b);
+
+    // Karatsuba for long operands, schoolbook for the rest
+    friend BigInt operator*(const BigInt& a, const BigInt& b);
+
+    // Quotient rounded toward zero, `b` must not be zero
+    friend BigInt operator/(const BigInt& a, const BigInt& b);
+
+    friend std::strong_ordering operator<=>(const BigInt& a, const BigInt& b);
+
+    friend bool operator==(const BigInt& a, const BigInt& b) = default;
+
+private:
+    using Limbs = std::vector<uint32_t>;
+
+    Limbs limbs_;            // least significant first, without leading zeros
+    bool negative_ = false;  // never set for zero
+
+    BigInt(Limbs limbs, bool negative);
+};
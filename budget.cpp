@@ -0,0 +1,58 @@
+#include "budget.h"
+#include "error.h"
+#include <algorithm>
+#include <limits>
+
+constinit thread_local Budget* Budget::current = nullptr;
+constinit thread_local int64_t Budget::countdown = 0;
+
+void Budget::SetFuel(uint64_t steps) {
+    fuel_ = steps;
+}
+
+void Budget::SetTimeout(std::chrono::nanoseconds timeout) {
+    timeout_ = timeout;
+}
+
+void Budget::Interrupt() {
+    interrupted_.store(true, std::memory_order_relaxed);
+}
+
+void Budget::Check() {
+    Budget* budget = current;
+    if (!budget) {
+        countdown = kCheckInterval - 1;
+        return;
+    }
+    if (budget->interrupted_.load(std::memory_order_relaxed)) {
+        throw InterruptedError("Interrupted");
+    }
+    if (budget->fuel_left_ == 0) {
+        throw InterruptedError("Out of fuel");
+    }
+    if (budget->timeout_.count() && std::chrono::steady_clock::now() >= budget->deadline_) {
+        throw InterruptedError("Deadline exceeded");
+    }
+    // this step is taken from the steps handed out
+    uint64_t steps = std::min<uint64_t>(kCheckInterval, budget->fuel_left_);
+    budget->fuel_left_ -= steps;
+    countdown = steps - 1;
+}
+
+BudgetGuard::BudgetGuard(Budget* budget)
+    : previous_(Budget::current), previous_countdown_(Budget::countdown) {
+    Budget::current = budget;
+    Budget::countdown = 0;
+    if (budget) {
+        budget->fuel_left_ = budget->fuel_ ? budget->fuel_ : std::numeric_limits<uint64_t>::max();
+        if (budget->timeout_.count()) {
+            budget->deadline_ = std::chrono::steady_clock::now() + budget->timeout_;
+        }
+        budget->interrupted_.store(false, std::memory_order_relaxed);
+    }
+}
+
+BudgetGuard::~BudgetGuard() {
+    Budget::current = previous_;
+    Budget::countdown = previous_countdown_;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Limits of the runs of an interpreter: the fuel, the deadline and the interruption from
+// another thread, see Interpreter::SetFuel, SetTimeout and Interrupt.
+//
+// A program loops only by calling lambdas, so the engines charge a step for every call of a
+// lambda (Step, in LambdaFunctor::TailCalc and MakeFrame). A step only counts down a counter
+// of the thread. The fuel, the clock and the interruption are looked at when the counter runs
+// out, every kCheckInterval steps at most, so a run stops exactly when it is out of fuel and
+// within so many calls of its deadline or interruption. The run fails with an
+// InterruptedError, unwinding like any other error.
+
+class Budget {
+public:
+    // Steps between two looks at the clock and the interruption
+    static constexpr int64_t kCheckInterval = 1024;
+
+    Budget() = default;
+
+    Budget(const Budget&) = delete;
+    Budget& operator=(const Budget&) = delete;
+
+    // Steps of every run, 0 for no limit
+    void SetFuel(uint64_t steps);
+
+    // Time of every run, 0 for no limit
+    void SetTimeout(std::chrono::nanoseconds timeout);
+
+    // Stops the run in progress, can be called from any thread
+    void Interrupt();
+
+    // Charges a call to the budget of the calling thread (see BudgetGuard)
+    static void Step() {
+        if (--countdown < 0) {
+            Check();
+        }
+    }
+
+private:
+    uint64_t fuel_ = 0;
+    std::chrono::nanoseconds timeout_{0};
+    std::atomic<bool> interrupted_ = false;
+
+    // of the run in progress
+    uint64_t fuel_left_ = 0;  // not handed to the countdown yet
+    std::chrono::steady_clock::time_point deadline_;
+
+    static constinit thread_local Budget* current;
+    static constinit thread_local int64_t countdown;  // steps left until the next Check
+
+    // Throws an InterruptedError if the run has to stop, refills the countdown if not
+    static void Check();
+
+    friend class BudgetGuard;
+};
+
+// Makes `budget` (may be nullptr) the budget of the calling thread during its lifetime. A run
+// starts with the full fuel and timeout of the budget and isn't interrupted.
+class BudgetGuard {
+public:
+    explicit BudgetGuard(Budget* budget);
+
+    BudgetGuard(const BudgetGuard&) = delete;
+    BudgetGuard& operator=(const BudgetGuard&) = delete;
+
+    ~BudgetGuard();
+
+private:
+    Budget* previous_;
+    int64_t previous_countdown_;
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "functors.h"
+#include "object.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Bytecode engine. Lambda bodies and top-level forms are compiled into instructions of a
+// stack machine, run by Execute.
+//
+// Special forms (quote, if, and, or, define, set!, lambda) are recognized by the functor
+// their head symbol is bound to when the code is compiled. Any other form is a call: the
+// operator is evaluated first, and if it is a procedure (IProcedure or a lambda) the
+// arguments are evaluated on the VM stack. Otherwise the functor gets the source arguments,
+// just like in the tree walker. Calls of compiled lambdas don't use the native stack.
+
+enum class Op : uint8_t {
+    kConst,        // push constants[a]
+    kLocal,        // push slot b of the frame a levels up
+    kGlobal,       // push the binding of symbol constants[a], found through globals[b]
+    kSetLocal,     // store the top into slot b of the frame a levels up, keep it on the stack
+    kSetGlobal,    // store the top into the binding of symbol constants[a] found through
+                   // globals[b], keep it
+    kDefine,       // pop, define symbol constants[a] in the current scope and push the symbol
+    kPop,          // drop the top
+    kJump,         // go to a
+    kBranch,       // pop a boolean, go to a if it is #f
+    kAnd,          // if the top is #f go to a, else pop
+    kOr,           // if the top is not #f go to a, else pop
+    kPrepareCall,  // if the top isn't a procedure, replace it with the result of its Calc on
+                   // arguments[a] and go to b
+    kCall,         // call the procedure under the a values on the top with them
+    kTailCall,     // same, but a lambda replaces the current frame
+    kReturn,       // return the top to the caller
+    kLambda,       // push a closure of lambdas[a]
+    kEval,         // push constants[a] evaluated by the tree walker
+    kGuard,        // go to b unless the bindings of guards[a] hold
+};
+
+struct Instruction {
+    Op op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+// Lambda expression met in compiled code. All the closures it creates have frames of
+// the same shape as parents, so it is resolved and compiled once, when first evaluated.
+struct LambdaSite {
+    SlotNames args;
+    ObjectVector body;
+    LambdaOrigin origin;
+    mutable std::shared_ptr<const LambdaPrototype> prototype;
+};
+
+// Bindings checked by a kGuard instruction, made of an optimizer's guard (see GuardFunctor)
+struct GuardSite {
+    std::vector<SymbolId> names;
+    ObjectVector values;  // as from GetGuardBindings
+    uint32_t globals;  // cache of the first name in Code::globals, the others follow it
+};
+
+struct Code {
+    std::vector<Instruction> instructions;
+    ObjectVector constants;
+    std::vector<ObjectVector> arguments;
+    std::vector<LambdaSite> lambdas;
+    std::vector<GuardSite> guards;
+    mutable std::vector<GlobalCache> globals;  // a cache per instruction referencing a global
+
+    // Visits the objects the code references (see Object::Trace)
+    void Trace(const std::function<void(Object*)>& visit) const;
+};
+
+// Compiles `body` run in `scope` or, for a lambda body resolved by ResolveBody, in its
+// frames. The value of the last expression is returned.
+std::shared_ptr<const Code> Compile(const ObjectVector& body, const std::shared_ptr<Scope>& scope);
+
+std::shared_ptr<Object> Execute(std::shared_ptr<const Code> code, std::shared_ptr<Scope> scope);
@@ -0,0 +1,97 @@
+#include "cache.h"
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Memory of a cell, with the control block of its shared_ptr
+constexpr size_t kCellBytes = sizeof(Cell) + 2 * sizeof(void*);
+
+// Overhead of an entry in the list and the index, besides the entry itself
+constexpr size_t kEntryBytes = 8 * sizeof(void*);
+
+size_t CountCells(const std::shared_ptr<Object>& form) {
+    size_t res = 0;
+    std::vector<const Cell*> todo;
+    if (Is<Cell>(form)) {
+        todo.push_back(AsPtr<Cell>(form));
+    }
+    while (!todo.empty()) {
+        const Cell* cell = todo.back();
+        todo.pop_back();
+        res++;
+        for (auto* child : {&cell->GetFirst(), &cell->GetSecond()}) {
+            if (Is<Cell>(*child)) {
+                todo.push_back(AsPtr<Cell>(*child));
+            }
+        }
+    }
+    return res;
+}
+
+// Copies the cells of `form` into the current heap, sharing the atoms
+std::shared_ptr<Object> CopyCells(const std::shared_ptr<Object>& form) {
+    std::vector<std::pair<const Cell*, Cell*>> todo;  // source, copy to fill in
+    auto copy = [&todo](const std::shared_ptr<Object>& obj) -> std::shared_ptr<Object> {
+        if (!Is<Cell>(obj)) {
+            return obj;
+        }
+        std::shared_ptr<Object> res = Make<Cell>();
+        AsPtr<Cell>(res)->SetLocation(AsPtr<Cell>(obj)->GetLocation());
+        todo.emplace_back(AsPtr<Cell>(obj), AsPtr<Cell>(res));
+        return res;
+    };
+    std::shared_ptr<Object> res = copy(form);
+    while (!todo.empty()) {
+        auto [src, dst] = todo.back();
+        todo.pop_back();
+        dst->SetFirst(copy(src->GetFirst()));
+        dst->SetSecond(copy(src->GetSecond()));
+    }
+    return res;
+}
+
+}  // namespace
+
+ParseCache::ParseCache(size_t budget) : budget_(budget) {
+}
+
+std::shared_ptr<Object> ParseCache::Find(std::string_view source) {
+    auto it = index_.find(source);
+    if (it == index_.end()) {
+        stats_.misses++;
+        return nullptr;
+    }
+    stats_.hits++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return CopyCells(it->second->form);
+}
+
+std::shared_ptr<Object> ParseCache::Add(std::string_view source, std::shared_ptr<Object> form) {
+    size_t cells = CountCells(form);
+    Entry& entry = entries_.emplace_front();
+    entry.source = source;
+    entry.form = std::move(form);
+    entry.bytes = sizeof(Entry) + kEntryBytes + entry.source.size() + cells * kCellBytes;
+    index_[entry.source] = entries_.begin();
+    stats_.entries++;
+    stats_.bytes += entry.bytes;
+    // the new entry is dropped too if it takes more than the budget alone
+    std::shared_ptr<Object> res = CopyCells(entry.form);
+    while (stats_.bytes > budget_) {
+        Entry& last = entries_.back();
+        index_.erase(last.source);
+        stats_.entries--;
+        stats_.bytes -= last.bytes;
+        entries_.pop_back();
+    }
+    return res;
+}
+
+const ParseCacheStats& ParseCache::GetStats() const {
+    return stats_;
+}
+
+size_t ParseCache::GetBudget() const {
+    return budget_;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "object.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Forms read by Interpreter::Run, by their source text, so a source run again isn't read
+// again (see Interpreter::SetParseCacheBudget).
+//
+// The forms are read outside of any heap, so the collector never clears them. The program
+// can get hold of the cells of a form it runs (quote, or a builtin like list that takes its
+// arguments as they are written) and change them with set-car! and set-cdr!, or store objects
+// of the heap in them. So the cells are copied into the current heap whenever a form is used,
+// which still saves tokenizing and reading it; the atoms can't be changed and are shared. The
+// forms used least recently are dropped once the cache takes more memory than its budget.
+
+struct ParseCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;  // estimated memory taken by the entries
+};
+
+class ParseCache {
+public:
+    explicit ParseCache(size_t budget);
+
+    ParseCache(const ParseCache&) = delete;
+    ParseCache& operator=(const ParseCache&) = delete;
+
+    // The form to run for `source`, nullptr if it isn't cached
+    std::shared_ptr<Object> Find(std::string_view source);
+
+    // Keeps `form`, read from `source` outside of any heap, and returns the form to run
+    std::shared_ptr<Object> Add(std::string_view source, std::shared_ptr<Object> form);
+
+    const ParseCacheStats& GetStats() const;
+
+    size_t GetBudget() const;
+
+private:
+    struct Entry {
+        std::string source;
+        std::shared_ptr<Object> form;
+        size_t bytes;
+    };
+
+    size_t budget_;
+    std::list<Entry> entries_;  // the most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;  // by source
+    ParseCacheStats stats_;
+};
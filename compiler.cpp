@@ -0,0 +1,336 @@
+#include "bytecode.h"
+#include "functors.h"
+#include <optional>
+
+namespace {
+
+class Compiler {
+public:
+    explicit Compiler(const std::shared_ptr<Scope>& scope)
+        : scope_(scope), code_(std::make_shared<Code>()) {
+    }
+
+    std::shared_ptr<const Code> CompileBody(const ObjectVector& body) {
+        for (size_t i = 0; i < body.size(); i++) {
+            bool last = i + 1 == body.size();
+            Compile(body[i], last);
+            if (!last) {
+                Emit(Op::kPop);
+            }
+        }
+        if (body.empty()) {
+            EmitConst(nullptr);
+        }
+        Emit(Op::kReturn);
+        return code_;
+    }
+
+private:
+    const std::shared_ptr<Scope>& scope_;
+    std::shared_ptr<Code> code_;
+
+    uint32_t Here() const {
+        return code_->instructions.size();
+    }
+
+    uint32_t Emit(Op op, uint32_t a = 0, uint32_t b = 0) {
+        code_->instructions.push_back({op, a, b});
+        return Here() - 1;
+    }
+
+    void PatchTarget(uint32_t instruction) {
+        code_->instructions[instruction].a = Here();
+    }
+
+    uint32_t AddConst(std::shared_ptr<Object> obj) {
+        code_->constants.push_back(std::move(obj));
+        return code_->constants.size() - 1;
+    }
+
+    void EmitConst(std::shared_ptr<Object> obj) {
+        Emit(Op::kConst, AddConst(std::move(obj)));
+    }
+
+    // Canonical symbol for a Symbol or a LocalSymbol
+    static std::shared_ptr<Symbol> Canonical(const std::shared_ptr<Object>& symbol) {
+        return Symbol::FromId(AsPtr<Symbol>(symbol)->GetId());
+    }
+
+    uint32_t AddSymbol(const std::shared_ptr<Object>& symbol) {
+        return AddConst(Canonical(symbol));
+    }
+
+    uint32_t AddGlobalCache() {
+        code_->globals.emplace_back();
+        return code_->globals.size() - 1;
+    }
+
+    void Compile(const std::shared_ptr<Object>& expr, bool tail) {
+        if (!expr) {
+            EmitConst(nullptr);
+            return;
+        }
+        switch (expr->GetType()) {
+            case ObjectType::kNumber:
+            case ObjectType::kBigNumber:
+            case ObjectType::kBoolean:
+            case ObjectType::kString:
+            case ObjectType::kCharacter:
+                EmitConst(expr);
+                break;
+            case ObjectType::kLocalSymbol: {
+                const LocalSymbol* local = AsPtr<LocalSymbol>(expr);
+                Emit(Op::kLocal, local->GetDepth(), local->GetSlot());
+                break;
+            }
+            case ObjectType::kSymbol:
+                Emit(Op::kGlobal, AddSymbol(expr), AddGlobalCache());
+                break;
+            case ObjectType::kCell:
+                CompileForm(expr, tail);
+                break;
+            default:
+                Emit(Op::kEval, AddConst(expr));
+        }
+    }
+
+    void CompileForm(const std::shared_ptr<Object>& form, bool tail) {
+        std::optional<ObjectVector> items = ProperList2Vector(form);
+        if (!items || !items->front()) {
+            // left for the tree walker to report
+            Emit(Op::kEval, AddConst(form));
+            return;
+        }
+        std::shared_ptr<Object> head = items->front();
+        ObjectVector args(items->begin() + 1, items->end());
+        if (head->GetType() == ObjectType::kSymbol &&
+            CompileSpecialForm(AsPtr<Symbol>(head)->GetId(), args, tail)) {
+            return;
+        }
+        if (GetSpecialForm(head) == SpecialForm::kGuard && CompileGuard(args, tail)) {
+            return;
+        }
+        Compile(head, false);
+        code_->arguments.push_back(args);
+        uint32_t prepare = Emit(Op::kPrepareCall, code_->arguments.size() - 1);
+        for (auto& i : args) {
+            Compile(i, false);
+        }
+        Emit(tail ? Op::kTailCall : Op::kCall, args.size());
+        code_->instructions[prepare].b = Here();
+    }
+
+    // Returns false if `name` isn't bound to a special form or the form is malformed, in
+    // which case it is compiled as a call and the functor reports the error
+    bool CompileSpecialForm(SymbolId name, const ObjectVector& args, bool tail) {
+        std::shared_ptr<Object>* binding = scope_->Find(name);
+        if (!binding) {
+            return false;
+        }
+        switch (GetSpecialForm(*binding)) {
+            case SpecialForm::kQuote:
+                return CompileQuote(args);
+            case SpecialForm::kIf:
+                return CompileIf(args, tail);
+            case SpecialForm::kAnd:
+                return CompileBoolean(args, tail, Op::kAnd, true);
+            case SpecialForm::kOr:
+                return CompileBoolean(args, tail, Op::kOr, false);
+            case SpecialForm::kDefine:
+                return CompileDefine(args);
+            case SpecialForm::kSet:
+                return CompileSet(args);
+            case SpecialForm::kLambda:
+                return CompileLambda(args);
+            case SpecialForm::kGuard:
+            case SpecialForm::kNone:
+                return false;
+        }
+        return false;
+    }
+
+    bool CompileQuote(const ObjectVector& args) {
+        if (args.size() != 1) {
+            return false;
+        }
+        EmitConst(args[0]);
+        return true;
+    }
+
+    bool CompileIf(const ObjectVector& args, bool tail) {
+        if (args.size() != 2 && args.size() != 3) {
+            return false;
+        }
+        Compile(args[0], false);
+        uint32_t branch = Emit(Op::kBranch);
+        Compile(args[1], tail);
+        uint32_t jump = Emit(Op::kJump);
+        PatchTarget(branch);
+        if (args.size() == 3) {
+            Compile(args[2], tail);
+        } else {
+            EmitConst(nullptr);
+        }
+        PatchTarget(jump);
+        return true;
+    }
+
+    bool CompileBoolean(const ObjectVector& args, bool tail, Op op, bool empty_value) {
+        if (!CheckForNoNulls(args)) {
+            return false;
+        }
+        if (args.empty()) {
+            EmitConst(Boolean::FromValue(empty_value));
+            return true;
+        }
+        std::vector<uint32_t> exits;
+        for (size_t i = 0; i + 1 < args.size(); i++) {
+            Compile(args[i], false);
+            exits.push_back(Emit(op));
+        }
+        Compile(args.back(), tail);
+        for (uint32_t i : exits) {
+            PatchTarget(i);
+        }
+        return true;
+    }
+
+    bool CompileGuard(const ObjectVector& args, bool tail) {
+        GuardSite guard;
+        if (args.size() != 3 || !GetGuardBindings(args[0], &guard.names, &guard.values)) {
+            return false;
+        }
+        if (!BindGuardSpecialForms(scope_, &guard.names, &guard.values)) {
+            Compile(args[2], tail);
+            return true;
+        }
+        if (guard.names.empty()) {
+            Compile(args[1], tail);
+            return true;
+        }
+        guard.globals = code_->globals.size();
+        code_->globals.resize(code_->globals.size() + guard.names.size());
+        code_->guards.push_back(std::move(guard));
+        uint32_t check = Emit(Op::kGuard, code_->guards.size() - 1);
+        Compile(args[1], tail);
+        uint32_t jump = Emit(Op::kJump);
+        code_->instructions[check].b = Here();
+        Compile(args[2], tail);
+        PatchTarget(jump);
+        return true;
+    }
+
+    bool CompileDefine(const ObjectVector& args) {
+        if (args.size() < 2 || !args[0]) {
+            return false;
+        }
+        if (Is<Symbol>(args[0])) {
+            if (args.size() != 2) {
+                return false;
+            }
+            std::optional<ObjectVector> lambda = GetLambdaArgs(args[1]);
+            if (!lambda || !CompileLambda(*lambda, Canonical(args[0]))) {
+                Compile(args[1], false);
+            }
+            Emit(Op::kDefine, AddSymbol(args[0]));
+            return true;
+        }
+        std::optional<ObjectVector> signature = ProperList2Vector(args[0]);
+        if (!signature || signature->empty() || !Is<Symbol>(signature->front())) {
+            return false;
+        }
+        std::optional<SlotNames> params =
+            Symbols2SlotNames(ObjectVector(signature->begin() + 1, signature->end()));
+        if (!params) {
+            return false;
+        }
+        ObjectVector body(args.begin() + 1, args.end());
+        LambdaOrigin origin = GetLambdaOrigin(args[0], body, Canonical(signature->front()));
+        EmitLambda(*params, std::move(body), std::move(origin));
+        Emit(Op::kDefine, AddSymbol(signature->front()));
+        return true;
+    }
+
+    bool CompileSet(const ObjectVector& args) {
+        if (args.size() != 2 || !Is<Symbol>(args[0])) {
+            return false;
+        }
+        Compile(args[1], false);
+        if (Is<LocalSymbol>(args[0])) {
+            const LocalSymbol* local = AsPtr<LocalSymbol>(args[0]);
+            Emit(Op::kSetLocal, local->GetDepth(), local->GetSlot());
+        } else {
+            Emit(Op::kSetGlobal, AddSymbol(args[0]), AddGlobalCache());
+        }
+        return true;
+    }
+
+    // The arguments of `expr` if it's a lambda expression
+    std::optional<ObjectVector> GetLambdaArgs(const std::shared_ptr<Object>& expr) const {
+        std::optional<ObjectVector> items = ProperList2Vector(expr);
+        if (!items || items->empty() || !items->front() ||
+            items->front()->GetType() != ObjectType::kSymbol) {
+            return std::nullopt;
+        }
+        std::shared_ptr<Object>* binding = scope_->Find(AsPtr<Symbol>(items->front())->GetId());
+        if (!binding || GetSpecialForm(*binding) != SpecialForm::kLambda) {
+            return std::nullopt;
+        }
+        return ObjectVector(items->begin() + 1, items->end());
+    }
+
+    // `name` is the variable the lambda is defined as, if any
+    bool CompileLambda(const ObjectVector& args, std::shared_ptr<Symbol> name = nullptr) {
+        if (args.size() < 2 || (args[0] && !Is<Cell>(args[0]))) {
+            return false;
+        }
+        std::optional<ObjectVector> names = ProperList2Vector(args[0]);
+        if (!names) {
+            return false;
+        }
+        std::optional<SlotNames> params = Symbols2SlotNames(*names);
+        if (!params) {
+            return false;
+        }
+        ObjectVector body(args.begin() + 1, args.end());
+        LambdaOrigin origin = GetLambdaOrigin(args[0], body, std::move(name));
+        EmitLambda(*params, std::move(body), std::move(origin));
+        return true;
+    }
+
+    void EmitLambda(SlotNames params, ObjectVector body, LambdaOrigin origin) {
+        code_->lambdas.push_back(
+            {std::move(params), std::move(body), std::move(origin), nullptr});
+        Emit(Op::kLambda, code_->lambdas.size() - 1);
+    }
+};
+
+}  // namespace
+
+void Code::Trace(const std::function<void(Object*)>& visit) const {
+    for (auto& i : constants) {
+        visit(i.get());
+    }
+    for (auto& args : arguments) {
+        for (auto& i : args) {
+            visit(i.get());
+        }
+    }
+    for (auto& guard : guards) {
+        for (auto& i : guard.values) {
+            visit(i.get());
+        }
+    }
+    for (auto& site : lambdas) {
+        for (auto& i : site.body) {
+            visit(i.get());
+        }
+        if (site.prototype) {
+            site.prototype->Trace(visit);
+        }
+    }
+}
+
+std::shared_ptr<const Code> Compile(const ObjectVector& body, const std::shared_ptr<Scope>& scope) {
+    return Compiler(scope).CompileBody(body);
+}
@@ -0,0 +1,19 @@
+#include "engine.h"
+
+namespace {
+
+thread_local Engine current_engine = Engine::kTreeWalker;
+
+}  // namespace
+
+Engine CurrentEngine() {
+    return current_engine;
+}
+
+EngineGuard::EngineGuard(Engine engine) : previous_(current_engine) {
+    current_engine = engine;
+}
+
+EngineGuard::~EngineGuard() {
+    current_engine = previous_;
+}
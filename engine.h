@@ -0,0 +1,25 @@
+#pragma once
+
+// How lambda bodies and top-level forms are evaluated
+enum class Engine {
+    kTreeWalker,  // Object::Eval on the source
+    kBytecode,    // compiled for the stack machine of bytecode.h
+    kAst,         // rewritten into self-specializing nodes of ast.h
+};
+
+// Engine the code prepared by the calling thread is meant for
+Engine CurrentEngine();
+
+// Makes `engine` current for the calling thread during its lifetime
+class EngineGuard {
+public:
+    explicit EngineGuard(Engine engine);
+
+    EngineGuard(const EngineGuard&) = delete;
+    EngineGuard& operator=(const EngineGuard&) = delete;
+
+    ~EngineGuard();
+
+private:
+    Engine previous_;
+};
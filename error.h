@@ -13,3 +13,8 @@ struct RuntimeError : public std::runtime_error {
 struct NameError : public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
+
+// A run stopped by the limits of Interpreter::SetFuel, SetTimeout or by Interrupt
+struct InterruptedError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
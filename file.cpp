@@ -0,0 +1,84 @@
+#include "file.h"
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+#if __has_include(<sys/mman.h>)
+#define SCHEME_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t kReleaseStep = 1 << 20;
+
+[[noreturn]] void ThrowFileError(const std::string& path) {
+    throw std::system_error(errno, std::generic_category(), "Can't read " + path);
+}
+
+}  // namespace
+
+MappedFile::MappedFile(const std::string& path) {
+#ifdef SCHEME_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ThrowFileError(path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        ThrowFileError(path);
+    }
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // the source is read once, front to back
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+            size_ = info.st_size;
+            mapped_ = true;
+        }
+    }
+    close(fd);
+    if (mapped_ || (S_ISREG(info.st_mode) && info.st_size == 0)) {
+        return;
+    }
+    // pipes and the like can't be mapped
+#endif
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        ThrowFileError(path);
+    }
+    contents_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data_ = contents_.data();
+    size_ = contents_.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef SCHEME_MMAP
+    if (mapped_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+void MappedFile::Release(size_t offset) {
+    if (offset < released_ + kReleaseStep) {
+        return;
+    }
+#ifdef SCHEME_MMAP
+    if (mapped_) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t end = offset / page_size * page_size;
+        // the pages are clean, the system rereads them from the file if they are touched
+        madvise(const_cast<char*>(data_) + released_, end - released_, MADV_DONTNEED);
+        released_ = end;
+    }
+#endif
+}
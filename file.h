@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only contents of a whole file. The file is mapped into memory where mmap is
+// available, so its pages are read on demand and the system can drop them once used.
+class MappedFile {
+public:
+    // Throws std::system_error if the file can't be read
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    std::string_view Get() const {
+        return {data_, size_};
+    }
+
+    // Tells that the contents before `offset` won't be read again, so that the memory
+    // they take can be given back. It is done in steps, to keep the calls cheap.
+    void Release(size_t offset);
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    size_t released_ = 0;  // the pages before it are dropped
+    std::string contents_;  // the file read as is, if it isn't mapped
+};
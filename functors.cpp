@@ -1,140 +1,527 @@
 #include "functors.h"
+#include "args.h"
+#include "ast.h"
+#include "budget.h"
+#include "bytecode.h"
+#include "engine.h"
+#include "hashtable.h"
 #include "helpers.h"
+#include "profiler.h"
+#include "resolver.h"
 #include <optional>
 
-std::shared_ptr<Object> AbsFunctor::Calc(const ObjectVector& values,
+std::shared_ptr<Object> ITailFunctor::Calc(ObjectSpan values,
+                                           std::shared_ptr<Scope> scope) {
+    TailCall tail;
+    std::shared_ptr<Object> res = TailCalc(values, scope, &tail);
+    if (!tail.expr) {
+        return res;
+    }
+    return tail.expr->Eval(tail.scope);
+}
+
+std::shared_ptr<Object> IProcedure::Calc(ObjectSpan values,
+                                         std::shared_ptr<Scope> scope) {
+    ArgFrame args(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!values[i]) {
+            throw RuntimeError("Trying to Eval nullptr");
+        }
+        args[i] = Evaluate(values[i], scope);
+    }
+    return Apply(args.Get());
+}
+
+std::shared_ptr<Object> AbsFunctor::Calc(ObjectSpan values,
                                          [[maybe_unused]] std::shared_ptr<Scope> scope) {
     CheckSize<RuntimeError>(values, 1, "AbsFunctor");
     std::shared_ptr<Object> obj = values[0];
-    if (!Is<Number>(obj)) {
+    if (!Is<Numeric>(obj)) {
         throw RuntimeError("Abs got not Number");
     }
-    return std::shared_ptr<Object>(new Number{std::abs(As<Number>(obj)->GetValue())});
+    return AbsNumber(obj);
 }
 
-std::shared_ptr<Object> QuoteFunctor::Calc(const ObjectVector& values,
+std::shared_ptr<Object> QuoteFunctor::Calc(ObjectSpan values,
                                            [[maybe_unused]] std::shared_ptr<Scope> scope) {
     CheckSize<RuntimeError>(values, 1, "QuoteFunctor");
     return values[0];
 }
 
-std::shared_ptr<Object> NotFunctor::Calc(const ObjectVector& values,
+std::shared_ptr<Object> NotFunctor::Calc(ObjectSpan values,
                                          [[maybe_unused]] std::shared_ptr<Scope> scope) {
     CheckSize<RuntimeError>(values, 1, "NotFunctor");
-    return std::shared_ptr<Object>(new Boolean{!values[0]->ToBool()});
+    return Boolean::FromValue(!values[0]->ToBool());
 }
 
-std::shared_ptr<Object> CheckNullFunctor::Calc(const ObjectVector& values,
-                                          [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    return std::shared_ptr<Object>(new Boolean{!values[0]->Eval(scope)});
+std::shared_ptr<Object> CheckNullFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "CheckNullFunctor");
+    return Boolean::FromValue(!args[0]);
 }
 
-std::shared_ptr<Object> CarFunctor::Calc(const ObjectVector& values,
-                                         [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    CheckSize<RuntimeError>(values, 1, "CarFunctor");
-    std::shared_ptr<Object> res = values[0]->Eval(scope);
+std::shared_ptr<Object> CarFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "CarFunctor");
+    const std::shared_ptr<Object>& res = args[0];
     if (!Is<Cell>(res)) {
         throw RuntimeError("Got not Cell in CarFunctor");
     }
-    return As<Cell>(res)->GetFirst();
+    return AsPtr<Cell>(res)->GetFirst();
 }
 
-std::shared_ptr<Object> CdrFunctor::Calc(const ObjectVector& values,
-                                         [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    CheckSize<RuntimeError>(values, 1, "CdrFunctor");
-    std::shared_ptr<Object> res = values[0]->Eval(scope);
+std::shared_ptr<Object> CdrFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "CdrFunctor");
+    const std::shared_ptr<Object>& res = args[0];
     if (!Is<Cell>(res)) {
         throw RuntimeError("Got not Cell in CarFunctor");
     }
-    return As<Cell>(res)->GetSecond();
+    return AsPtr<Cell>(res)->GetSecond();
 }
 
-std::shared_ptr<Object> ConsFunctor::Calc(const ObjectVector& values,
-                                          [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    CheckSize<RuntimeError>(values, 2, "ConsFunctor");
-    std::shared_ptr<Object> left = values[0]->Eval(scope);
-    std::shared_ptr<Object> right = values[1]->Eval(scope);
-    std::shared_ptr<Object> res(new Cell);
-    As<Cell>(res)->SetFirst(left), As<Cell>(res)->SetSecond(right);
+std::shared_ptr<Object> ConsFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "ConsFunctor");
+    std::shared_ptr<Object> res = Make<Cell>();
+    AsPtr<Cell>(res)->SetFirst(args[0]), AsPtr<Cell>(res)->SetSecond(args[1]);
     return res;
 }
 
-std::shared_ptr<Object> CheckListFunctor::Calc(const ObjectVector& values,
-                                               [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    CheckSize<RuntimeError>(values, 1, "CheckListFunctor");
-    std::shared_ptr<Object> cur = values[0]->Eval(scope);
+std::shared_ptr<Object> CheckListFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "CheckListFunctor");
+    std::shared_ptr<Object> cur = args[0];
     while (cur) {
         if (!Is<Cell>(cur)) {
             break;
         }
-        cur = As<Cell>(cur)->GetSecond();
+        cur = AsPtr<Cell>(cur)->GetSecond();
     }
-    return std::shared_ptr<Object>(new Boolean{!cur.operator bool()});  // bruh that's funny
+    return Boolean::FromValue(!cur.operator bool());  // bruh that's funny
 }
 
-std::shared_ptr<Object> ListFunctor::Calc(const ObjectVector& values,
+std::shared_ptr<Object> ListFunctor::Calc(ObjectSpan values,
                                           [[maybe_unused]] std::shared_ptr<Scope> scope) {
     return Vector2Object(values);
 }
 
-std::pair<ObjectVector, long long> ParseListFunctorArguments(
-    const ObjectVector& values, [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    CheckSize<RuntimeError>(values, 2, "ParseListFunctorArguments");
-    std::shared_ptr<Object> list = values[0]->Eval(scope);
-    std::shared_ptr<Object> ind = values[1]->Eval(scope);
+std::pair<std::shared_ptr<Object>, int64_t> ParseListFunctorArguments(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "ParseListFunctorArguments");
+    const std::shared_ptr<Object>& list = args[0];
+    const std::shared_ptr<Object>& ind = args[1];
     if (!Is<Cell>(list)) {
         throw RuntimeError("ParseListFunctorArguments got not Cell in 1st element");
     }
     if (!Is<Number>(ind)) {
         throw RuntimeError("ParseListFunctorArguments got not Number in 2nd element");
     }
-    long long res = As<Number>(ind)->GetValue();
-    return {Object2Vector(list), res};
+    return {list, AsPtr<Number>(ind)->GetValue()};
 }
 
-std::shared_ptr<Object> ListRefFunctor::Calc(const ObjectVector& values,
-                                             [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    auto [list, ind] = ParseListFunctorArguments(values, scope);
-    if (ind < 0 || static_cast<size_t>(ind) >= list.size()) {
+std::shared_ptr<Object> ListRefFunctor::Apply(ObjectSpan args) {
+    auto [list, ind] = ParseListFunctorArguments(args);
+    if (ind < 0) {
         throw RuntimeError("IndexError in ListRefFunctor");
     }
-    return list[ind];
+    const Cell* cell = AsPtr<Cell>(list);
+    for (; ind > 0; ind--) {
+        const std::shared_ptr<Object>& next = cell->GetSecond();
+        if (!Is<Cell>(next)) {
+            // an improper tail counts as the last element
+            if (ind == 1 && next) {
+                return next;
+            }
+            throw RuntimeError("IndexError in ListRefFunctor");
+        }
+        cell = AsPtr<Cell>(next);
+    }
+    return cell->GetFirst();
 }
 
-std::shared_ptr<Object> ListTailFunctor::Calc(const ObjectVector& values,
-                                              [[maybe_unused]] std::shared_ptr<Scope> scope) {
-    auto [list, ind] = ParseListFunctorArguments(values, scope);
-    if (ind < 0 || static_cast<size_t>(ind) > list.size()) {
+std::shared_ptr<Object> ListTailFunctor::Apply(ObjectSpan args) {
+    auto [list, ind] = ParseListFunctorArguments(args);
+    if (ind < 0) {
         throw RuntimeError("IndexError in ListTailFunctor");
     }
-    ObjectVector res;
-    res.reserve(list.size() - ind);
-    for (size_t i = ind; i < list.size(); i++) {
-        res.push_back(list[i]);
+    const std::shared_ptr<Object>* cur = &list;
+    for (; ind > 0; ind--) {
+        if (!Is<Cell>(*cur)) {
+            throw RuntimeError("IndexError in ListTailFunctor");
+        }
+        cur = &AsPtr<Cell>(*cur)->GetSecond();
+    }
+    return *cur;
+}
+
+namespace {
+
+Vector* GetVector(const std::shared_ptr<Object>& obj, const std::string& func) {
+    if (!Is<Vector>(obj)) {
+        throw RuntimeError(func + " got not Vector");
+    }
+    return AsPtr<Vector>(obj);
+}
+
+size_t GetLength(const std::shared_ptr<Object>& obj, const std::string& func) {
+    if (!Is<Number>(obj) || AsPtr<Number>(obj)->GetValue() < 0) {
+        throw RuntimeError(func + " needs a non-negative length");
+    }
+    return AsPtr<Number>(obj)->GetValue();
+}
+
+// Element `index` of `vector`
+std::shared_ptr<Object>& GetElement(Vector* vector, const std::shared_ptr<Object>& index,
+                                    const std::string& func) {
+    ObjectVector& elements = vector->GetElements();
+    if (!Is<Number>(index) || AsPtr<Number>(index)->GetValue() < 0 ||
+        static_cast<uint64_t>(AsPtr<Number>(index)->GetValue()) >= elements.size()) {
+        throw RuntimeError("IndexError in " + func);
+    }
+    return elements[AsPtr<Number>(index)->GetValue()];
+}
+
+}  // namespace
+
+std::shared_ptr<Object> MakeVectorFunctor::Apply(ObjectSpan args) {
+    if (args.size() != 1 && args.size() != 2) {
+        throw RuntimeError("MakeVectorFunctor needs 1 or 2 values");
+    }
+    size_t size = GetLength(args[0], "MakeVectorFunctor");
+    std::shared_ptr<Object> fill = args.size() == 2 ? args[1] : Number::FromValue(0);
+    return Make<Vector>(ObjectVector(size, fill));
+}
+
+std::shared_ptr<Object> VectorFunctor::Apply(ObjectSpan args) {
+    return Make<Vector>(ObjectVector(args.begin(), args.end()));
+}
+
+std::shared_ptr<Object> VectorLengthFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "VectorLengthFunctor");
+    return Number::FromValue(GetVector(args[0], "VectorLengthFunctor")->GetElements().size());
+}
+
+std::shared_ptr<Object> VectorRefFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "VectorRefFunctor");
+    return GetElement(GetVector(args[0], "VectorRefFunctor"), args[1], "VectorRefFunctor");
+}
+
+std::shared_ptr<Object> VectorSetFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 3, "VectorSetFunctor");
+    GetElement(GetVector(args[0], "VectorSetFunctor"), args[1], "VectorSetFunctor") = args[2];
+    return nullptr;
+}
+
+std::shared_ptr<Object> VectorFillFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "VectorFillFunctor");
+    ObjectVector& elements = GetVector(args[0], "VectorFillFunctor")->GetElements();
+    std::fill(elements.begin(), elements.end(), args[1]);
+    return nullptr;
+}
+
+std::shared_ptr<Object> ListToVectorFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "ListToVectorFunctor");
+    std::optional<ObjectVector> elements = ProperList2Vector(args[0]);
+    if (!elements) {
+        throw RuntimeError("ListToVectorFunctor got not list");
+    }
+    return Make<Vector>(std::move(*elements));
+}
+
+std::shared_ptr<Object> VectorToListFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "VectorToListFunctor");
+    return Vector2Object(GetVector(args[0], "VectorToListFunctor")->GetElements());
+}
+
+namespace {
+
+const Rope& GetString(const std::shared_ptr<Object>& obj, const std::string& func) {
+    if (!Is<String>(obj)) {
+        throw RuntimeError(func + " got not String");
+    }
+    return AsPtr<String>(obj)->GetValue();
+}
+
+// `obj` as an index into a string of `size` characters, `size` itself is allowed if
+// `inclusive` is set
+size_t GetStringIndex(const std::shared_ptr<Object>& obj, size_t size, bool inclusive,
+                      const std::string& func) {
+    if (!Is<Number>(obj) || AsPtr<Number>(obj)->GetValue() < 0 ||
+        static_cast<uint64_t>(AsPtr<Number>(obj)->GetValue()) >= size + inclusive) {
+        throw RuntimeError("IndexError in " + func);
     }
-    return Vector2Object(res);
+    return AsPtr<Number>(obj)->GetValue();
 }
 
-std::shared_ptr<Object> IfFunctor::Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) {
+}  // namespace
+
+std::shared_ptr<Object> StringLengthFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "StringLengthFunctor");
+    return Number::FromValue(GetString(args[0], "StringLengthFunctor").Size());
+}
+
+std::shared_ptr<Object> StringRefFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "StringRefFunctor");
+    const Rope& str = GetString(args[0], "StringRefFunctor");
+    return Character::FromValue(
+        str.At(GetStringIndex(args[1], str.Size(), false, "StringRefFunctor")));
+}
+
+std::shared_ptr<Object> SubstringFunctor::Apply(ObjectSpan args) {
+    if (args.size() != 2 && args.size() != 3) {
+        throw RuntimeError("SubstringFunctor needs 2 or 3 values");
+    }
+    const Rope& str = GetString(args[0], "SubstringFunctor");
+    size_t start = GetStringIndex(args[1], str.Size(), true, "SubstringFunctor");
+    size_t end = args.size() == 3 ? GetStringIndex(args[2], str.Size(), true, "SubstringFunctor")
+                                  : str.Size();
+    if (start > end) {
+        throw RuntimeError("IndexError in SubstringFunctor");
+    }
+    return Make<String>(str.Substring(start, end));
+}
+
+std::shared_ptr<Object> StringAppendFunctor::Apply(ObjectSpan args) {
+    Rope res;
+    for (const auto& arg : args) {
+        res = res + GetString(arg, "StringAppendFunctor");
+    }
+    return Make<String>(std::move(res));
+}
+
+std::shared_ptr<Object> StringToSymbolFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "StringToSymbolFunctor");
+    return Symbol::Intern(GetString(args[0], "StringToSymbolFunctor").ToString());
+}
+
+std::shared_ptr<Object> SymbolToStringFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "SymbolToStringFunctor");
+    if (!Is<Symbol>(args[0])) {
+        throw RuntimeError("SymbolToStringFunctor got not Symbol");
+    }
+    return Make<String>(Rope(AsPtr<Symbol>(args[0])->GetName()));
+}
+
+std::shared_ptr<Object> NumberToStringFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "NumberToStringFunctor");
+    if (!Is<Numeric>(args[0])) {
+        throw RuntimeError("NumberToStringFunctor got not number");
+    }
+    return Make<String>(Rope(args[0]->Serialize()));
+}
+
+std::shared_ptr<Object> CharToIntegerFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "CharToIntegerFunctor");
+    if (!Is<Character>(args[0])) {
+        throw RuntimeError("CharToIntegerFunctor got not Character");
+    }
+    return Number::FromValue(static_cast<unsigned char>(AsPtr<Character>(args[0])->GetValue()));
+}
+
+std::shared_ptr<Object> IntegerToCharFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "IntegerToCharFunctor");
+    if (!Is<Number>(args[0]) || AsPtr<Number>(args[0])->GetValue() < 0 ||
+        AsPtr<Number>(args[0])->GetValue() > 255) {
+        throw RuntimeError("IntegerToCharFunctor needs a number in [0, 255]");
+    }
+    return Character::FromValue(static_cast<char>(AsPtr<Number>(args[0])->GetValue()));
+}
+
+namespace {
+
+HashTable* GetHashTable(const std::shared_ptr<Object>& obj, const std::string& func) {
+    if (!Is<HashTable>(obj)) {
+        throw RuntimeError(func + " got not HashTable");
+    }
+    return AsPtr<HashTable>(obj);
+}
+
+// Calls a procedure or a lambda with evaluated arguments
+std::shared_ptr<Object> CallWithValues(const std::shared_ptr<Object>& callee, ObjectSpan args,
+                                       const std::string& func) {
+    if (Is<IProcedure>(callee)) {
+        ProfileScope profile;
+        profile.Call(callee.get());
+        return AsPtr<IProcedure>(callee)->Apply(args);
+    }
+    if (Is<LambdaFunctor>(callee)) {
+        const LambdaFunctor* lambda = AsPtr<LambdaFunctor>(callee);
+        return lambda->Run(lambda->MakeFrame(args));
+    }
+    throw RuntimeError(func + " got not a procedure");
+}
+
+}  // namespace
+
+std::shared_ptr<Object> MakeHashTableFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 0, "MakeHashTableFunctor");
+    return Make<HashTable>();
+}
+
+std::shared_ptr<Object> HashTableRefFunctor::Apply(ObjectSpan args) {
+    if (args.size() != 2 && args.size() != 3) {
+        throw RuntimeError("HashTableRefFunctor needs 2 or 3 values");
+    }
+    if (std::shared_ptr<Object>* value =
+            GetHashTable(args[0], "HashTableRefFunctor")->Find(args[1])) {
+        return *value;
+    }
+    if (args.size() == 2) {
+        throw RuntimeError("KeyError in HashTableRefFunctor");
+    }
+    return CallWithValues(args[2], {}, "HashTableRefFunctor");
+}
+
+std::shared_ptr<Object> HashTableRefDefaultFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 3, "HashTableRefDefaultFunctor");
+    std::shared_ptr<Object>* value =
+        GetHashTable(args[0], "HashTableRefDefaultFunctor")->Find(args[1]);
+    return value ? *value : args[2];
+}
+
+std::shared_ptr<Object> HashTableSetFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 3, "HashTableSetFunctor");
+    GetHashTable(args[0], "HashTableSetFunctor")->Set(args[1], args[2]);
+    return nullptr;
+}
+
+std::shared_ptr<Object> HashTableDeleteFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "HashTableDeleteFunctor");
+    GetHashTable(args[0], "HashTableDeleteFunctor")->Erase(args[1]);
+    return nullptr;
+}
+
+std::shared_ptr<Object> HashTableExistsFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "HashTableExistsFunctor");
+    return Boolean::FromValue(GetHashTable(args[0], "HashTableExistsFunctor")->Find(args[1]));
+}
+
+std::shared_ptr<Object> HashTableCountFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "HashTableCountFunctor");
+    return Number::FromValue(GetHashTable(args[0], "HashTableCountFunctor")->Size());
+}
+
+std::shared_ptr<Object> HashTableWalkFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 2, "HashTableWalkFunctor");
+    // a copy, the procedure may change the table
+    auto entries = GetHashTable(args[0], "HashTableWalkFunctor")->GetEntries();
+    for (auto& [key, value] : entries) {
+        std::shared_ptr<Object> pair[] = {key, value};
+        CallWithValues(args[1], pair, "HashTableWalkFunctor");
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object> HashTableKeysFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "HashTableKeysFunctor");
+    ObjectVector keys;
+    for (auto& [key, value] : GetHashTable(args[0], "HashTableKeysFunctor")->GetEntries()) {
+        keys.push_back(key);
+    }
+    return Vector2Object(keys);
+}
+
+std::shared_ptr<Object> HashTableValuesFunctor::Apply(ObjectSpan args) {
+    CheckSize<RuntimeError>(args, 1, "HashTableValuesFunctor");
+    ObjectVector values;
+    for (auto& [key, value] : GetHashTable(args[0], "HashTableValuesFunctor")->GetEntries()) {
+        values.push_back(value);
+    }
+    return Vector2Object(values);
+}
+
+std::shared_ptr<Object> IfFunctor::TailCalc(ObjectSpan values,
+                                            std::shared_ptr<Scope> scope, TailCall* tail) {
     if (values.size() != 2 && values.size() != 3) {
         throw SyntaxError("Wrong if syntax (got " + std::to_string(values.size()) + " values)");
     }
-    std::shared_ptr<Object> if_res = values[0]->Eval(scope);
+    std::shared_ptr<Object> if_res = Evaluate(values[0], scope);
     if (!Is<Boolean>(if_res)) {
         throw RuntimeError("If statement returned not boolean");
     }
-    if (if_res->ToBool()) {
-        return values[1]->Eval(scope);
-    } else {
-        if (values.size() == 2) {
-            return nullptr;
-        } else {
-            return values[2]->Eval(scope);
+    if (IsTrue(if_res)) {
+        *tail = {values[1], scope};
+    } else if (values.size() == 3) {
+        *tail = {values[2], scope};
+    }
+    return nullptr;
+}
+
+bool BindGuardSpecialForms(const std::shared_ptr<Scope>& scope, std::vector<SymbolId>* names,
+                           ObjectVector* values) {
+    size_t kept = 0;
+    for (size_t i = 0; i < names->size(); i++) {
+        if (GetSpecialForm((*values)[i]) == SpecialForm::kNone) {
+            (*names)[kept] = (*names)[i];
+            (*values)[kept++] = std::move((*values)[i]);
+            continue;
+        }
+        std::shared_ptr<Object>* binding = scope->Find((*names)[i]);
+        if (!binding || *binding != (*values)[i]) {
+            return false;
         }
     }
+    names->resize(kept);
+    values->resize(kept);
+    return true;
 }
 
-std::shared_ptr<Object> DefineFunctor::Calc(const ObjectVector& values,
+std::shared_ptr<Object> GuardFunctor::TailCalc(ObjectSpan values, std::shared_ptr<Scope> scope,
+                                               TailCall* tail) {
+    if (values.size() != 3 || !Is<Vector>(values[0]) ||
+        AsPtr<Vector>(values[0])->GetElements().size() % 2) {
+        throw SyntaxError("Wrong guard syntax");
+    }
+    // checked in place: the tree walker runs the guard every time
+    const ObjectVector& bindings = AsPtr<Vector>(values[0])->GetElements();
+    bool holds = true;
+    for (size_t i = 0; i < bindings.size() && holds; i += 2) {
+        if (!Is<Symbol>(bindings[i])) {
+            throw SyntaxError("Wrong guard syntax");
+        }
+        std::shared_ptr<Object>* binding = scope->Find(AsPtr<Symbol>(bindings[i])->GetId());
+        holds = bindings[i + 1].get() == this ? HoldsGuard(binding, nullptr)
+                                               : HoldsGuard(binding, bindings[i + 1]);
+    }
+    *tail = {holds ? values[1] : values[2], scope};
+    return nullptr;
+}
+
+namespace {
+
+// Closure of (lambda . `values`) in `scope`
+std::shared_ptr<Object> MakeLambda(ObjectSpan values, const std::shared_ptr<Scope>& scope,
+                                   std::shared_ptr<Symbol> name) {
+    if (values.empty()) {
+        throw SyntaxError("LambdaCreatorFunctor needs at least 1 argument");
+    }
+    if (values.size() == 1) {
+        throw SyntaxError("LambdaCreatureFunctor got empty body");
+    }
+    SlotNames args;
+    for (auto& i : Object2Vector(values[0])) {
+        if (!Is<Symbol>(i)) {
+            throw SyntaxError("LambdaCreatorFunctor needs only Symbol as args");
+        }
+        args.push_back(AsPtr<Symbol>(i)->GetId());
+    }
+    ObjectVector body(values.begin() + 1, values.end());
+    return Make<LambdaFunctor>(args, body, scope,
+                               GetLambdaOrigin(values[0], body, std::move(name)));
+}
+
+// Value of `expr` defined as `name`: a lambda expression is given the name
+std::shared_ptr<Object> EvaluateDefinition(const std::shared_ptr<Object>& expr,
+                                           const std::shared_ptr<Scope>& scope,
+                                           std::shared_ptr<Symbol> name) {
+    if (Is<Cell>(expr) && Is<Symbol>(AsPtr<Cell>(expr)->GetFirst())) {
+        std::optional<ObjectVector> rest = ProperList2Vector(AsPtr<Cell>(expr)->GetSecond());
+        if (rest && GetSpecialForm(Evaluate(AsPtr<Cell>(expr)->GetFirst(), scope)) ==
+                        SpecialForm::kLambda) {
+            return MakeLambda(*rest, scope, std::move(name));
+        }
+    }
+    return Evaluate(expr, scope);
+}
+
+}  // namespace
+
+std::shared_ptr<Object> DefineFunctor::Calc(ObjectSpan values,
                                             std::shared_ptr<Scope> scope) {
     if (values.empty()) {
         throw SyntaxError("Empty define operation");
@@ -144,9 +531,9 @@ std::shared_ptr<Object> DefineFunctor::Calc(const ObjectVector& values,
         if (values.size() != 2) {
             throw RuntimeError("Attempt to define a variable with not 2 items");
         }
-        std::string varname = As<Symbol>(values[0])->GetName();
-        scope->Define(varname, values[1]->Eval(scope));
-        return std::shared_ptr<Object>(new Symbol(varname));
+        std::shared_ptr<Symbol> varname = Symbol::FromId(AsPtr<Symbol>(values[0])->GetId());
+        scope->Define(*varname, EvaluateDefinition(values[1], scope, varname));
+        return varname;
     }
     if (!Is<Cell>(values[0])) {
         throw SyntaxError("Define got not variable or list/cell");
@@ -154,9 +541,9 @@ std::shared_ptr<Object> DefineFunctor::Calc(const ObjectVector& values,
     if (values.size() < 2) {
         throw RuntimeError("Lambda sugar got < 2 arguments");
     }
-    ObjectVector body = values;
-    std::string func_name;
-    std::vector<std::string> args;
+    ObjectVector body(values.begin(), values.end());
+    std::shared_ptr<Symbol> func_name;
+    SlotNames args;
     {
         ObjectVector tmp = Object2Vector(body[0]);
         body.erase(body.begin());
@@ -166,7 +553,7 @@ std::shared_ptr<Object> DefineFunctor::Calc(const ObjectVector& values,
         if (!Is<Symbol>(tmp[0])) {
             throw SyntaxError("Lambda sugar first argument first argument must be a Symbol");
         }
-        func_name = As<Symbol>(tmp[0])->GetName();
+        func_name = Symbol::FromId(AsPtr<Symbol>(tmp[0])->GetId());
         tmp.erase(tmp.begin());
         for (auto& i : tmp) {
             if (!Is<Symbol>(i)) {
@@ -174,75 +561,226 @@ std::shared_ptr<Object> DefineFunctor::Calc(const ObjectVector& values,
             }
         }
         for (auto& i : tmp) {
-            args.push_back(As<Symbol>(i)->GetName());
+            args.push_back(AsPtr<Symbol>(i)->GetId());
         }
-        args.reserve(tmp.size());
     }
-    scope->Define(func_name, std::shared_ptr<Object>(new LambdaFunctor(args, body, scope)));
-    return std::shared_ptr<Object>(new Symbol(func_name));
+    scope->Define(*func_name, Make<LambdaFunctor>(args, body, scope,
+                                                  GetLambdaOrigin(values[0], body, func_name)));
+    return func_name;
 }
 
-std::shared_ptr<Object> SetFunctor::Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) {
+std::shared_ptr<Object> SetFunctor::Calc(ObjectSpan values, std::shared_ptr<Scope> scope) {
     CheckSize<SyntaxError>(values, 2, "SetFunctor");
     if (!Is<Symbol>(values[0])) {
         throw RuntimeError("First element in SetFunctor is not Symbol");
     }
-    std::string varname = As<Symbol>(values[0])->GetName();
-    scope->Set(varname, values[1]->Eval(scope));
-    return values[0]->Eval(scope);
+    if (Is<LocalSymbol>(values[0])) {
+        const LocalSymbol* local = AsPtr<LocalSymbol>(values[0]);
+        scope->AssignSlot(local->GetDepth(), local->GetSlot(), Evaluate(values[1], scope));
+    } else {
+        scope->Set(*AsPtr<Symbol>(values[0]), Evaluate(values[1], scope));
+    }
+    return Evaluate(values[0], scope);
 }
 
-std::shared_ptr<Object> SetCarFunctor::Calc(const ObjectVector& values,
-                                            std::shared_ptr<Scope> scope) {
-    auto [obj, val] = PrepareForCarCdr(values, scope);
+std::shared_ptr<Object> SetCarFunctor::Apply(ObjectSpan args) {
+    auto [obj, val] = PrepareForCarCdr(args);
     obj->SetFirst(val);
     return nullptr;
 }
 
-std::shared_ptr<Object> SetCdrFunctor::Calc(const ObjectVector& values,
-                                            std::shared_ptr<Scope> scope) {
-    auto [obj, val] = PrepareForCarCdr(values, scope);
+std::shared_ptr<Object> SetCdrFunctor::Apply(ObjectSpan args) {
+    auto [obj, val] = PrepareForCarCdr(args);
     obj->SetSecond(val);
     return nullptr;
 }
 
-std::shared_ptr<Object> LambdaFunctor::Calc(const ObjectVector& values,
-                                            std::shared_ptr<Scope> scope) {
-    if (values.size() != args_.size()) {
-        throw RuntimeError("Expected " + std::to_string(args_.size()) +
+LambdaOrigin GetLambdaOrigin(const std::shared_ptr<Object>& params, ObjectSpan body,
+                             std::shared_ptr<Symbol> name) {
+    LambdaOrigin res{std::move(name), {}};
+    if (Is<Cell>(params)) {
+        res.location = AsPtr<Cell>(params)->GetLocation();
+    } else if (!body.empty() && Is<Cell>(body[0])) {
+        res.location = AsPtr<Cell>(body[0])->GetLocation();
+    }
+    return res;
+}
+
+LambdaPrototype::LambdaPrototype(const SlotNames& args, const ObjectVector& body,
+                                 const std::shared_ptr<Scope>& parent_scope, LambdaOrigin origin)
+    : args(args),
+      frame(std::make_shared<const SlotNames>(CollectFrameNames(args, body))),
+      body(ResolveBody(body, *frame, parent_scope)),
+      origin(std::move(origin)) {
+    Prepare(parent_scope);
+}
+
+LambdaPrototype::LambdaPrototype(SlotNames args, std::shared_ptr<const SlotNames> frame,
+                                 LambdaOrigin origin)
+    : args(std::move(args)), frame(std::move(frame)), origin(std::move(origin)) {
+}
+
+void LambdaPrototype::Prepare(const std::shared_ptr<Scope>& parent_scope) {
+    if (CurrentEngine() == Engine::kBytecode) {
+        code = Compile(body, parent_scope);
+    } else if (CurrentEngine() == Engine::kAst) {
+        tree = BuildTree(body, parent_scope);
+    }
+}
+
+void LambdaPrototype::Trace(const std::function<void(Object*)>& visit) const {
+    for (auto& i : body) {
+        visit(i.get());
+    }
+    if (code) {
+        code->Trace(visit);
+    }
+    if (tree) {
+        tree->Trace(visit);
+    }
+}
+
+std::shared_ptr<Object> LambdaFunctor::TailCalc(ObjectSpan values,
+                                                std::shared_ptr<Scope> scope, TailCall* tail) {
+    const LambdaPrototype& prototype = *prototype_;
+    if (values.size() != prototype.args.size()) {
+        throw RuntimeError("Expected " + std::to_string(prototype.args.size()) +
                            " arguments in lambda, but got " + std::to_string(values.size()));
     }
-    std::shared_ptr<Scope> cur(new Scope(parent_scope_));
+    Budget::Step();
+    std::shared_ptr<Scope> cur =
+        Make<Scope>(parent_scope_, prototype.frame, prototype.args.size());
     for (size_t i = 0; i < values.size(); i++) {
-        cur->Define(args_[i], values[i]->Eval(scope));
+        cur->SetSlot(0, i, Evaluate(values[i], scope));
+    }
+    return TailRun(std::move(cur), tail);
+}
+
+std::shared_ptr<Object> LambdaFunctor::TailRun(std::shared_ptr<Scope> cur, TailCall* tail) const {
+    const LambdaPrototype& prototype = *prototype_;
+    if (prototype.code) {
+        return Execute(prototype.code, std::move(cur));
     }
-    for (size_t i = 0; i + 1 < body_.size(); i++) {
-        body_[i]->Eval(cur);
+    if (prototype.tree) {
+        return prototype.tree->Execute(std::move(cur));
     }
-    return body_.back()->Eval(cur);
+    for (size_t i = 0; i + 1 < prototype.body.size(); i++) {
+        Evaluate(prototype.body[i], cur);
+    }
+    *tail = {prototype.body.back(), cur};
+    return nullptr;
 }
 
-LambdaFunctor::LambdaFunctor(const std::vector<std::string>& args, const ObjectVector& body,
+std::shared_ptr<Scope> LambdaFunctor::MakeFrame(ObjectSpan args) const {
+    const LambdaPrototype& prototype = *prototype_;
+    if (args.size() != prototype.args.size()) {
+        throw RuntimeError("Expected " + std::to_string(prototype.args.size()) +
+                           " arguments in lambda, but got " + std::to_string(args.size()));
+    }
+    Budget::Step();
+    std::shared_ptr<Scope> frame =
+        Make<Scope>(parent_scope_, prototype.frame, prototype.args.size());
+    for (size_t i = 0; i < args.size(); i++) {
+        frame->SetSlot(0, i, args[i]);
+    }
+    return frame;
+}
+
+std::shared_ptr<Object> LambdaFunctor::Run(const std::shared_ptr<Scope>& frame) const {
+    ProfileScope profile;
+    profile.Call(this);
+    if (prototype_->code) {
+        return Execute(prototype_->code, frame);
+    }
+    if (prototype_->tree) {
+        return prototype_->tree->Execute(frame);
+    }
+    std::shared_ptr<Object> res;
+    for (auto& i : prototype_->body) {
+        res = Evaluate(i, frame);
+    }
+    return res;
+}
+
+LambdaFunctor::LambdaFunctor(const SlotNames& args, const ObjectVector& body,
+                             const std::shared_ptr<Scope>& parent_scope, LambdaOrigin origin)
+    : LambdaFunctor(
+          std::make_shared<const LambdaPrototype>(args, body, parent_scope, std::move(origin)),
+          parent_scope) {
+}
+
+LambdaFunctor::LambdaFunctor(std::shared_ptr<const LambdaPrototype> prototype,
                              const std::shared_ptr<Scope>& parent_scope)
-    : args_(args), body_(body), parent_scope_(parent_scope) {
+    : ITailFunctor(ObjectType::kLambda),
+      prototype_(std::move(prototype)),
+      parent_scope_(parent_scope) {
+    Track();
+}
+
+void LambdaFunctor::Trace(const std::function<void(Object*)>& visit) const {
+    if (prototype_) {
+        prototype_->Trace(visit);
+    }
+    visit(parent_scope_.get());
 }
 
-std::shared_ptr<Object> LambdaCreatorFunctor::Calc(const ObjectVector& values,
+void LambdaFunctor::ClearReferences() {
+    prototype_ = nullptr;
+    parent_scope_ = nullptr;
+}
+
+std::shared_ptr<Object> LambdaCreatorFunctor::Calc(ObjectSpan values,
                                                    std::shared_ptr<Scope> scope) {
-    if (values.empty()) {
-        throw SyntaxError("LambdaCreatorFunctor needs at least 1 argument");
+    return MakeLambda(values, scope, nullptr);
+}
+
+SpecialForm GetSpecialForm(const std::shared_ptr<Object>& obj) {
+    if (!Is<IFunctor>(obj) || obj->GetType() != ObjectType::kFunctor) {
+        return SpecialForm::kNone;
     }
-    if (values.size() == 1) {
-        throw SyntaxError("LambdaCreatureFunctor got empty body");
+    IFunctor* functor = AsPtr<IFunctor>(obj);
+    if (dynamic_cast<QuoteFunctor*>(functor)) {
+        return SpecialForm::kQuote;
     }
-    std::vector<std::string> args;
-    for (auto& i : Object2Vector(values[0])) {
-        if (!Is<Symbol>(i)) {
-            throw SyntaxError("LambdaCreatorFunctor needs only Symbol as args");
+    if (dynamic_cast<IfFunctor*>(functor)) {
+        return SpecialForm::kIf;
+    }
+    if (dynamic_cast<BooleanFunctor<std::logical_and<bool>>*>(functor)) {
+        return SpecialForm::kAnd;
+    }
+    if (dynamic_cast<BooleanFunctor<std::logical_or<bool>>*>(functor)) {
+        return SpecialForm::kOr;
+    }
+    if (dynamic_cast<DefineFunctor*>(functor)) {
+        return SpecialForm::kDefine;
+    }
+    if (dynamic_cast<SetFunctor*>(functor)) {
+        return SpecialForm::kSet;
+    }
+    if (dynamic_cast<LambdaCreatorFunctor*>(functor)) {
+        return SpecialForm::kLambda;
+    }
+    if (dynamic_cast<GuardFunctor*>(functor)) {
+        return SpecialForm::kGuard;
+    }
+    return SpecialForm::kNone;
+}
+
+bool GetGuardBindings(const std::shared_ptr<Object>& bindings, std::vector<SymbolId>* names,
+                      ObjectVector* values) {
+    if (!Is<Vector>(bindings)) {
+        return false;
+    }
+    const ObjectVector& elements = AsPtr<Vector>(bindings)->GetElements();
+    if (elements.size() % 2) {
+        return false;
+    }
+    for (size_t i = 0; i < elements.size(); i += 2) {
+        if (!Is<Symbol>(elements[i])) {
+            return false;
         }
-        args.push_back(As<Symbol>(i)->GetName());
+        names->push_back(AsPtr<Symbol>(elements[i])->GetId());
+        values->push_back(Is<GuardFunctor>(elements[i + 1]) ? nullptr : elements[i + 1]);
     }
-    ObjectVector body = values;
-    body.erase(body.begin());
-    return std::shared_ptr<Object>(new LambdaFunctor(args, body, scope));
+    return true;
 }
@@ -3,17 +3,45 @@
 #include "error.h"
 #include "object.h"
 #include "helpers.h"
+#include "numeric.h"
 #include <vector>
 #include <memory>
 #include <optional>
 
+struct Code;
+class Tree;
+
+// Expression left unevaluated by a functor because it is in tail position.
+// Whoever gets it back (see Cell::Eval) evaluates it in its own loop, so tail calls
+// don't grow the native stack.
+struct TailCall {
+    std::shared_ptr<Object> expr;
+    std::shared_ptr<Scope> scope;
+};
+
 class IFunctor : public Object {
 public:
-    virtual std::shared_ptr<Object> Calc([[maybe_unused]] const ObjectVector& values,
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kFunctor || type == ObjectType::kProcedure ||
+               type == ObjectType::kLambda;
+    }
+
+    explicit IFunctor(ObjectType type = ObjectType::kFunctor) : Object(type) {
+    }
+
+    virtual std::shared_ptr<Object> Calc([[maybe_unused]] ObjectSpan values,
                                          [[maybe_unused]] std::shared_ptr<Scope> scope) {
         throw std::runtime_error("Calc is not implemented for IFunctor");
     }
 
+    // Same as Calc, but the functor may store its tail expression into `tail` instead of
+    // evaluating it. If tail->expr is set, the returned value is meaningless.
+    virtual std::shared_ptr<Object> TailCalc(ObjectSpan values,
+                                             std::shared_ptr<Scope> scope,
+                                             [[maybe_unused]] TailCall* tail) {
+        return Calc(values, scope);
+    }
+
     std::string Serialize() const override {
         throw std::runtime_error("Can't Serialize IFunctor");
     }
@@ -23,36 +51,67 @@ public:
     }
 };
 
+// Base for functors with a tail position (if, and, or, lambda). They implement only TailCalc,
+// Calc just finishes the tail call.
+class ITailFunctor : public IFunctor {
+public:
+    using IFunctor::IFunctor;
+
+    std::shared_ptr<Object> Calc(ObjectSpan values,
+                                 std::shared_ptr<Scope> scope) final;
+};
+
+// Base for functors that evaluate all their arguments, in order, before anything else.
+// They implement only Apply, which gets the values; the bytecode VM evaluates the
+// arguments itself and calls Apply directly.
+class IProcedure : public IFunctor {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kProcedure;
+    }
+
+    IProcedure() : IFunctor(ObjectType::kProcedure) {
+    }
+
+    std::shared_ptr<Object> Calc(ObjectSpan values,
+                                 std::shared_ptr<Scope> scope) final;
+
+    virtual std::shared_ptr<Object> Apply(ObjectSpan args) = 0;
+};
+
 template <class T>
-class NumberFunctor : public IFunctor {
+class NumberFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override {
-        if (!CheckForNoNulls(values)) {
-            throw RuntimeError("null in vector during Object2Vector");
+    // Folds the arguments with `functor` (see AddOp): on fixnums while it can, then on
+    // any numbers
+    std::shared_ptr<Object> Apply(ObjectSpan args) override {
+        size_t i = 0;
+        int64_t res;
+        if (init_.has_value()) {
+            res = init_.value();
+        } else if (args.empty()) {
+            throw RuntimeError("can't calc value without init");
+        } else if (Is<Number>(args[0])) {
+            res = AsPtr<Number>(args[0])->GetValue();
+            i = 1;
+        } else {
+            return ApplyGeneric(args[0], args.subspan(1));
         }
-        std::optional<long long> res = init_;
-        for (auto& i : values) {
-            std::shared_ptr<Object> cur = i->Eval(scope);
-            if (!Is<Number>(cur)) {
-                throw RuntimeError("Functor in NumberFunctor got non-Number argument");
-            }
-            if (res.has_value()) {
-                res = functor_(res.value(), As<Number>(cur)->GetValue());
-            } else {
-                res = As<Number>(cur)->GetValue();
+        for (; i < args.size(); i++) {
+            int64_t next;
+            if (!Is<Number>(args[i]) ||
+                !functor_.Fixnum(res, AsPtr<Number>(args[i])->GetValue(), &next)) {
+                return ApplyGeneric(Number::FromValue(res), args.subspan(i));
             }
+            res = next;
         }
-        if (!res.has_value()) {
-            throw RuntimeError("can't calc value without init");
-        }
-        return std::shared_ptr<Object>(new Number{static_cast<int>(res.value())});
+        return Number::FromValue(res);
     }
 
     explicit NumberFunctor(T functor) : functor_(functor) {
     }
 
-    NumberFunctor(T functor, long long int init) : functor_(functor), init_(init) {
+    NumberFunctor(T functor, int64_t init) : functor_(functor), init_(init) {
     }
 
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
@@ -61,41 +120,52 @@ public:
 
 private:
     T functor_;
-    std::optional<long long> init_;
+    std::optional<int64_t> init_;
+
+    std::shared_ptr<Object> ApplyGeneric(std::shared_ptr<Object> res, ObjectSpan args) const {
+        if (!Is<Numeric>(res)) {
+            throw RuntimeError("Functor in NumberFunctor got non-Number argument");
+        }
+        for (auto& cur : args) {
+            if (!Is<Numeric>(cur)) {
+                throw RuntimeError("Functor in NumberFunctor got non-Number argument");
+            }
+            res = functor_.Generic(res, cur);
+        }
+        return res;
+    }
 };
 
 class AbsFunctor : public IFunctor {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
+    std::shared_ptr<Object> Calc(ObjectSpan values,
                                  [[maybe_unused]] std::shared_ptr<Scope> scope) override;
 };
 
 template <class T>
-class ComparisonFunctor : public IFunctor {
+class ComparisonFunctor : public IProcedure {
 public:
     explicit ComparisonFunctor(T functor) : functor_(functor) {
     }
 
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override {
-        bool res = true;
-        std::optional<int> cock;
-        for (auto& i : values) {
-            std::shared_ptr<Object> huy = i->Eval(scope);
-            if (!Is<Number>(huy)) {
+    // Compares each argument with the next one
+    std::shared_ptr<Object> Apply(ObjectSpan args) override {
+        for (size_t i = 0; i < args.size(); i++) {
+            if (!Is<Numeric>(args[i])) {
                 throw RuntimeError("ComparisonFunctor needs only numbers");
             }
-            int val = As<Number>(huy)->GetValue();
-            if (cock.has_value()) {
-                res &= functor_(cock.value(), val);
-            } else {
-                cock = val;
-            }
-            if (!res) {
-                break;
+            if (i > 0 && !Compare(args[i - 1], args[i])) {
+                return Boolean::FromValue(false);
             }
         }
-        return std::shared_ptr<Object>(new Boolean{res});
+        return Boolean::FromValue(true);
+    }
+
+    bool Compare(const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) const {
+        if (Is<Number>(a) && Is<Number>(b)) {
+            return functor_(AsPtr<Number>(a)->GetValue(), AsPtr<Number>(b)->GetValue());
+        }
+        return functor_(CompareNumbers(a, b), 0);
     }
 
 private:
@@ -103,51 +173,47 @@ private:
 };
 
 template <class T>
-class CheckTypeFunctor : public IFunctor {
+class CheckTypeFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override {
-        if (values.size() != 1) {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override {
+        if (args.size() != 1) {
             throw RuntimeError("CheckTypeFunctor needs only one element");
         }
-        return std::shared_ptr<Object>(new Boolean{Is<T>(values[0]->Eval(scope))});
+        return Boolean::FromValue(Is<T>(args[0]));
     }
 };
 
 class QuoteFunctor : public IFunctor {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
+    std::shared_ptr<Object> Calc(ObjectSpan values,
                                  [[maybe_unused]] std::shared_ptr<Scope> scope) override;
 };
 
 template <class T>
-class BooleanFunctor : public IFunctor {
+class BooleanFunctor : public ITailFunctor {
 public:
     BooleanFunctor(T functor, bool stop_value) : functor_(functor), stop_value_(stop_value) {
     }
 
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override {
+    std::shared_ptr<Object> TailCalc(ObjectSpan values, std::shared_ptr<Scope> scope,
+                                     TailCall* tail) override {
         if (!CheckForNoNulls(values)) {
             throw RuntimeError("null in vector during Object2Vector");
         }
+        if (values.empty()) {
+            return Boolean::FromValue(!stop_value_);
+        }
         bool res = !stop_value_;
-        std::shared_ptr<Object> last_eval;
-        for (auto& i : values) {
-            last_eval = i->Eval(scope);
-            res = functor_(res, last_eval->ToBool());
+        for (size_t i = 0; i + 1 < values.size(); i++) {
+            std::shared_ptr<Object> last_eval = Evaluate(values[i], scope);
+            res = functor_(res, IsTrue(last_eval));
             if (res == stop_value_) {
                 return last_eval;
             }
         }
-        if (res) {
-            if (values.empty()) {
-                return std::shared_ptr<Object>(new Boolean{true});
-            } else {
-                return last_eval;
-            }
-        }
-        return std::shared_ptr<Object>(new Boolean{res});
+        // the last value is the result whatever it is
+        *tail = {values.back(), scope};
+        return nullptr;
     }
 
 private:
@@ -157,87 +223,338 @@ private:
 
 class NotFunctor : public IFunctor {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
+    std::shared_ptr<Object> Calc(ObjectSpan values,
                                  [[maybe_unused]] std::shared_ptr<Scope> scope) override;
 };
 
-class CheckNullFunctor : public IFunctor {
+class CheckNullFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class CarFunctor : public IFunctor {
+class CarFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class CdrFunctor : public IFunctor {
+class CdrFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class ConsFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+class ConsFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class CheckListFunctor : public IFunctor {
+class CheckListFunctor : public IProcedure {
 public:
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
 class ListFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
+    std::shared_ptr<Object> Calc(ObjectSpan values,
                                  [[maybe_unused]] std::shared_ptr<Scope> scope) override;
 };
 
-class ListRefFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+class ListRefFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class ListTailFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values,
-                                 [[maybe_unused]] std::shared_ptr<Scope> scope) override;
+class ListTailFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class MakeVectorFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorLengthFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorRefFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorSetFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorFillFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class ListToVectorFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class VectorToListFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class StringLengthFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class StringRefFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+// Shares the text with the string, O(log n)
+class SubstringFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+// Concatenates ropes, O(log n) per argument
+class StringAppendFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+template <class T>
+class StringComparisonFunctor : public IProcedure {
+public:
+    explicit StringComparisonFunctor(T functor) : functor_(functor) {
+    }
+
+    // Compares each argument with the next one
+    std::shared_ptr<Object> Apply(ObjectSpan args) override {
+        for (size_t i = 0; i < args.size(); i++) {
+            if (!Is<String>(args[i])) {
+                throw RuntimeError("StringComparisonFunctor needs only strings");
+            }
+            if (i > 0 && !functor_(AsPtr<String>(args[i - 1])->GetValue(),
+                                   AsPtr<String>(args[i])->GetValue())) {
+                return Boolean::FromValue(false);
+            }
+        }
+        return Boolean::FromValue(true);
+    }
+
+private:
+    T functor_;
+};
+
+class StringToSymbolFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class SymbolToStringFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class NumberToStringFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class CharToIntegerFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class IntegerToCharFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class MakeHashTableFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+// (hash-table-ref table key [thunk]): calls the thunk if there is no key
+class HashTableRefFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableRefDefaultFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableSetFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableDeleteFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableExistsFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableCountFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+// Calls a procedure with each key and value
+class HashTableWalkFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableKeysFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
+};
+
+class HashTableValuesFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class IfFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+class IfFunctor : public ITailFunctor {
+    std::shared_ptr<Object> TailCalc(ObjectSpan values, std::shared_ptr<Scope> scope,
+                                     TailCall* tail) override;
 };
 
 class DefineFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Calc(ObjectSpan values, std::shared_ptr<Scope> scope) override;
 };
 
 class SetFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Calc(ObjectSpan values, std::shared_ptr<Scope> scope) override;
 };
 
-class SetCarFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+class SetCarFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class SetCdrFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+class SetCdrFunctor : public IProcedure {
+    std::shared_ptr<Object> Apply(ObjectSpan args) override;
 };
 
-class LambdaFunctor : public IFunctor {
+// Where a lambda comes from, for the reports of the profiler (see profiler.h)
+struct LambdaOrigin {
+    std::shared_ptr<Symbol> name;  // bound to the lambda by define, nullptr if none
+    SourceLocation location;       // of the list of parameters, or of the body if it's empty
+};
+
+// Origin of the lambda expression with the parameters `params` (the signature for a
+// function define) and `body`
+LambdaOrigin GetLambdaOrigin(const std::shared_ptr<Object>& params, ObjectSpan body,
+                             std::shared_ptr<Symbol> name = nullptr);
+
+// A lambda expression prepared for calls: the body is resolved (see resolver.h) and, with
+// the bytecode or ast engine, compiled. Closures created by the same expression share it.
+struct LambdaPrototype {
+    SlotNames args;
+    std::shared_ptr<const SlotNames> frame;
+    ObjectVector body;
+    std::shared_ptr<const Code> code;  // set for the bytecode engine
+    std::shared_ptr<Tree> tree;        // set for the ast engine
+    LambdaOrigin origin;
+
+    LambdaPrototype(const SlotNames& args, const ObjectVector& body,
+                    const std::shared_ptr<Scope>& parent_scope, LambdaOrigin origin = {});
+
+    // Already resolved prototype restored from an image (see snapshot.h): the body is set
+    // afterwards, then Prepare is called
+    LambdaPrototype(SlotNames args, std::shared_ptr<const SlotNames> frame, LambdaOrigin origin);
+
+    // Compiles the resolved body for the current engine
+    void Prepare(const std::shared_ptr<Scope>& parent_scope);
+
+    void Trace(const std::function<void(Object*)>& visit) const;
+};
+
+class LambdaFunctor : public ITailFunctor {
 public:
-    LambdaFunctor(const std::vector<std::string>& args, const ObjectVector& body,
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kLambda;
+    }
+
+    LambdaFunctor(const SlotNames& args, const ObjectVector& body,
+                  const std::shared_ptr<Scope>& parent_scope, LambdaOrigin origin = {});
+
+    LambdaFunctor(std::shared_ptr<const LambdaPrototype> prototype,
                   const std::shared_ptr<Scope>& parent_scope);
 
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> TailCalc(ObjectSpan values, std::shared_ptr<Scope> scope,
+                                     TailCall* tail) override;
+
+    // Frame of a call with already evaluated arguments
+    std::shared_ptr<Scope> MakeFrame(ObjectSpan args) const;
+
+    // Evaluates the body in a frame made by MakeFrame, as a call for the profiler
+    std::shared_ptr<Object> Run(const std::shared_ptr<Scope>& frame) const;
+
+    // Evaluates the body in a frame made by MakeFrame like TailCalc does: the tree walker's
+    // last form is left to `tail`
+    std::shared_ptr<Object> TailRun(std::shared_ptr<Scope> frame, TailCall* tail) const;
+
+    const std::shared_ptr<const LambdaPrototype>& GetPrototype() const {
+        return prototype_;
+    }
+
+    const std::shared_ptr<Scope>& GetParentScope() const {
+        return parent_scope_;
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override;
+
+    void ClearReferences() override;
 
 private:
-    std::vector<std::string> args_;
-    ObjectVector body_;
+    std::shared_ptr<const LambdaPrototype> prototype_;
     std::shared_ptr<Scope> parent_scope_;
 };
 
 class LambdaCreatorFunctor : public IFunctor {
-    std::shared_ptr<Object> Calc(const ObjectVector& values, std::shared_ptr<Scope> scope) override;
+    std::shared_ptr<Object> Calc(ObjectSpan values, std::shared_ptr<Scope> scope) override;
+};
+
+// Head of the guards the optimizer wraps its rewrites in (see optimizer.h):
+// (guard #(name value ...) rewritten original) evaluates `rewritten` if every name is bound
+// to its value and `original` if not, both in tail position. The guard itself for a value
+// stands for any function evaluating its arguments, or no binding at all. The guard is put
+// into the forms as an object, not a name, so it evaluates to itself.
+class GuardFunctor : public ITailFunctor {
+public:
+    std::shared_ptr<Object> TailCalc(ObjectSpan values, std::shared_ptr<Scope> scope,
+                                     TailCall* tail) override;
+
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
 };
+
+// Builtin special forms, which compiled code (bytecode.h, ast.h) handles by itself
+enum class SpecialForm {
+    kNone,
+    kQuote,
+    kIf,
+    kAnd,
+    kOr,
+    kDefine,
+    kSet,
+    kLambda,
+    kGuard,
+};
+
+// Special form `obj` is the functor of, kNone if it is anything else
+SpecialForm GetSpecialForm(const std::shared_ptr<Object>& obj);
+
+// The names and values of a guard, from the first argument of its form: a vector of
+// symbols, each followed by the value it is expected to be bound to, nullptr for a function
+// evaluating its arguments (see GuardFunctor). False if the vector is malformed.
+bool GetGuardBindings(const std::shared_ptr<Object>& bindings, std::vector<SymbolId>* names,
+                      ObjectVector* values);
+
+// Whether a call of `obj` evaluates the arguments: builtins like list and the special forms
+// get them as they are written
+inline bool EvaluatesArgs(const std::shared_ptr<Object>& obj) {
+    return Is<IProcedure>(obj) || Is<LambdaFunctor>(obj);
+}
+
+// Whether `binding` (nullptr if the name is unbound) is what a guard expects, `value` from
+// GetGuardBindings
+inline bool HoldsGuard(const std::shared_ptr<Object>* binding,
+                       const std::shared_ptr<Object>& value) {
+    if (!value) {
+        return !binding || EvaluatesArgs(*binding);
+    }
+    return binding && *binding == value;
+}
+
+// Checks the bindings of a guard to special forms in `scope` and drops them: compiled code
+// binds special forms when it is compiled. False if one of them is bound to anything else.
+bool BindGuardSpecialForms(const std::shared_ptr<Scope>& scope, std::vector<SymbolId>* names,
+                           ObjectVector* values);
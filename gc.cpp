@@ -0,0 +1,151 @@
+#include "gc.h"
+#include "object.h"
+
+namespace {
+
+thread_local Heap* current_heap = nullptr;
+
+constexpr size_t kGranularity = 16;
+constexpr size_t kMaxPooledSize = 256;
+constexpr size_t kChunkSize = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Pool {
+    FreeBlock* free_lists[kMaxPooledSize / kGranularity] = {};
+    char* chunk_pos = nullptr;
+    char* chunk_end = nullptr;
+    size_t allocations = 0;
+};
+
+thread_local Pool pool;
+
+size_t SizeClass(size_t size) {
+    return (size + kGranularity - 1) / kGranularity - 1;
+}
+
+}  // namespace
+
+Heap* Heap::Current() {
+    return current_heap;
+}
+
+void Heap::Register(Object* obj) {
+    obj->heap_ = this;
+    obj->gc_prev_ = nullptr;
+    obj->gc_next_ = head_;
+    if (head_) {
+        head_->gc_prev_ = obj;
+    }
+    head_ = obj;
+    size_++;
+}
+
+void Heap::Unregister(Object* obj) {
+    if (obj->gc_prev_) {
+        obj->gc_prev_->gc_next_ = obj->gc_next_;
+    } else {
+        head_ = obj->gc_next_;
+    }
+    if (obj->gc_next_) {
+        obj->gc_next_->gc_prev_ = obj->gc_prev_;
+    }
+    obj->heap_ = nullptr;
+    size_--;
+}
+
+size_t Heap::Collect(const std::vector<Object*>& roots) {
+    // mark, with an explicit stack: lists may be millions of cells long
+    std::vector<Object*> stack;
+    auto visit = [&](Object* obj) {
+        if (obj && obj->heap_ == this && !obj->gc_marked_) {
+            obj->gc_marked_ = true;
+            stack.push_back(obj);
+        }
+    };
+    for (Object* root : roots) {
+        visit(root);
+    }
+    while (!stack.empty()) {
+        Object* obj = stack.back();
+        stack.pop_back();
+        obj->Trace(visit);
+    }
+
+    // sweep: keep the garbage alive while its references are cleared, so that nothing
+    // gets freed under our feet
+    std::vector<std::shared_ptr<Object>> garbage;
+    for (Object* obj = head_; obj; obj = obj->gc_next_) {
+        if (obj->gc_marked_) {
+            obj->gc_marked_ = false;
+        } else if (std::shared_ptr<Object> locked = obj->weak_from_this().lock()) {
+            garbage.push_back(std::move(locked));
+        }
+    }
+    for (auto& obj : garbage) {
+        obj->ClearReferences();
+    }
+    size_t res = garbage.size();
+    // freeing one by one never recurses deep, all the references are gone already
+    while (!garbage.empty()) {
+        garbage.pop_back();
+    }
+    return res;
+}
+
+size_t Heap::Size() const {
+    return size_;
+}
+
+Heap::~Heap() {
+    Collect({});
+    // objects still owned from outside outlive the heap
+    while (head_) {
+        Unregister(head_);
+    }
+}
+
+HeapGuard::HeapGuard(Heap* heap) : previous_(current_heap) {
+    current_heap = heap;
+}
+
+HeapGuard::~HeapGuard() {
+    current_heap = previous_;
+}
+
+void* PoolAllocate(size_t size) {
+    pool.allocations++;
+    if (size > kMaxPooledSize) {
+        return ::operator new(size);
+    }
+    size_t size_class = SizeClass(size);
+    if (FreeBlock* block = pool.free_lists[size_class]) {
+        pool.free_lists[size_class] = block->next;
+        return block;
+    }
+    size = (size_class + 1) * kGranularity;
+    if (static_cast<size_t>(pool.chunk_end - pool.chunk_pos) < size) {
+        pool.chunk_pos = static_cast<char*>(::operator new(kChunkSize));
+        pool.chunk_end = pool.chunk_pos + kChunkSize;
+    }
+    void* res = pool.chunk_pos;
+    pool.chunk_pos += size;
+    return res;
+}
+
+void PoolFree(void* ptr, size_t size) {
+    if (size > kMaxPooledSize) {
+        ::operator delete(ptr);
+        return;
+    }
+    size_t size_class = SizeClass(size);
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = pool.free_lists[size_class];
+    pool.free_lists[size_class] = block;
+}
+
+size_t PoolAllocations() {
+    return pool.allocations;
+}
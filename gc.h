@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class Object;
+
+// Tracing collector for what shared_ptr can't free: reference cycles like a function
+// defined in the scope it closes over, or a list made cyclic with set-cdr!.
+//
+// Every object that can reference others (Cell, Scope, lambdas, ...) is registered in
+// the Heap that is current when it is created (see HeapGuard).
+// Collect() marks everything reachable from the roots and clears the references of all
+// the other objects (Object::ClearReferences), after which their shared_ptrs free them.
+// The native stack isn't scanned, so Collect() may only run when no evaluation is in
+// progress; Interpreter does it between Run calls.
+class Heap {
+public:
+    Heap() = default;
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Breaks every cycle that is still alive
+    ~Heap();
+
+    // Heap new objects are registered in, nullptr if none
+    static Heap* Current();
+
+    // Returns the number of objects found unreachable
+    size_t Collect(const std::vector<Object*>& roots);
+
+    // Number of objects registered in this heap
+    size_t Size() const;
+
+private:
+    Object* head_ = nullptr;
+    size_t size_ = 0;
+
+    void Register(Object* obj);
+
+    void Unregister(Object* obj);
+
+    friend class Object;
+    friend class HeapGuard;
+};
+
+// Makes `heap` current for the calling thread during its lifetime
+class HeapGuard {
+public:
+    explicit HeapGuard(Heap* heap);
+
+    HeapGuard(const HeapGuard&) = delete;
+    HeapGuard& operator=(const HeapGuard&) = delete;
+
+    ~HeapGuard();
+
+private:
+    Heap* previous_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Allocation of objects with their shared_ptr control blocks: small blocks are bumped
+// out of big chunks and recycled through per-size free lists. Lists are per thread;
+// a block freed by another thread just joins the lists of that thread. Chunks are
+// never given back to the system.
+
+void* PoolAllocate(size_t size);
+
+void PoolFree(void* ptr, size_t size);
+
+// Number of pool allocations made by the calling thread so far
+size_t PoolAllocations();
+
+template <class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(PoolAllocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        PoolFree(ptr, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+};
+
+// Creates an object in the pool, together with its control block
+template <class T, class... Args>
+std::shared_ptr<T> Make(Args&&... args) {
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
@@ -0,0 +1,252 @@
+#include "hashtable.h"
+#include <algorithm>
+
+namespace {
+
+constexpr size_t kMinCapacity = 8;
+constexpr size_t kMaxHashedElements = 16;  // of a list or a vector
+constexpr int kMaxHashedDepth = 4;         // of nested lists and vectors
+
+// Finalizer of splitmix64: every bit of `x` affects the low bits used as the slot
+uint64_t Mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+uint64_t Combine(uint64_t seed, uint64_t hash) {
+    return Mix(seed + 0x9e3779b97f4a7c15 + hash);
+}
+
+// FNV-1a, fed piece by piece so it doesn't depend on the shape of the rope
+uint64_t HashBytes(const Rope& text) {
+    uint64_t hash = 0xcbf29ce484222325;
+    text.ForEachPiece([&hash](std::string_view piece) {
+        for (unsigned char c : piece) {
+            hash = (hash ^ c) * 0x100000001b3;
+        }
+    });
+    return Mix(hash);
+}
+
+uint64_t Hash(const std::shared_ptr<Object>& obj, int depth) {
+    if (!obj) {
+        return Mix(1);
+    }
+    uint64_t type = static_cast<uint64_t>(obj->GetType());
+    switch (obj->GetType()) {
+        case ObjectType::kNumber:
+            return Mix(AsPtr<Number>(obj)->GetValue());
+        case ObjectType::kBigNumber:
+            return HashBytes(Rope(obj->Serialize()));
+        case ObjectType::kSymbol:
+        case ObjectType::kLocalSymbol:
+            return Combine(static_cast<uint64_t>(ObjectType::kSymbol),
+                           AsPtr<Symbol>(obj)->GetId());
+        case ObjectType::kBoolean:
+            return Combine(type, AsPtr<Boolean>(obj)->GetValue());
+        case ObjectType::kCharacter:
+            return Combine(type, static_cast<unsigned char>(AsPtr<Character>(obj)->GetValue()));
+        case ObjectType::kString:
+            return HashBytes(AsPtr<String>(obj)->GetValue());
+        case ObjectType::kCell: {
+            uint64_t res = type;
+            if (depth == kMaxHashedDepth) {
+                return res;
+            }
+            const Cell* cell = AsPtr<Cell>(obj);
+            for (size_t i = 0; i < kMaxHashedElements; i++) {
+                res = Combine(res, Hash(cell->GetFirst(), depth + 1));
+                const std::shared_ptr<Object>& next = cell->GetSecond();
+                if (!Is<Cell>(next)) {
+                    return Combine(res, Hash(next, depth + 1));
+                }
+                cell = AsPtr<Cell>(next);
+            }
+            return res;
+        }
+        case ObjectType::kVector: {
+            const ObjectVector& elements = AsPtr<Vector>(obj)->GetElements();
+            uint64_t res = Combine(type, elements.size());
+            if (depth == kMaxHashedDepth) {
+                return res;
+            }
+            for (size_t i = 0; i < std::min(elements.size(), kMaxHashedElements); i++) {
+                res = Combine(res, Hash(elements[i], depth + 1));
+            }
+            return res;
+        }
+        default:
+            return Mix(reinterpret_cast<uintptr_t>(obj.get()));
+    }
+}
+
+// HashObject(key) as stored in a table, where 0 marks an empty slot
+uint64_t StoredHash(const std::shared_ptr<Object>& key) {
+    uint64_t hash = HashObject(key);
+    return hash ? hash : 1;
+}
+
+}  // namespace
+
+uint64_t HashObject(const std::shared_ptr<Object>& obj) {
+    return Hash(obj, 0);
+}
+
+bool EqualObjects(const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) {
+    if (a == b) {
+        return true;
+    }
+    if (!a || !b) {
+        return false;
+    }
+    if (Is<Symbol>(a) && Is<Symbol>(b)) {
+        return AsPtr<Symbol>(a)->GetId() == AsPtr<Symbol>(b)->GetId();
+    }
+    if (a->GetType() != b->GetType()) {
+        return false;
+    }
+    switch (a->GetType()) {
+        case ObjectType::kNumber:
+            return AsPtr<Number>(a)->GetValue() == AsPtr<Number>(b)->GetValue();
+        case ObjectType::kBigNumber:
+            return AsPtr<BigNumber>(a)->GetValue() == AsPtr<BigNumber>(b)->GetValue();
+        case ObjectType::kBoolean:
+            return AsPtr<Boolean>(a)->GetValue() == AsPtr<Boolean>(b)->GetValue();
+        case ObjectType::kCharacter:
+            return AsPtr<Character>(a)->GetValue() == AsPtr<Character>(b)->GetValue();
+        case ObjectType::kString:
+            return AsPtr<String>(a)->GetValue() == AsPtr<String>(b)->GetValue();
+        case ObjectType::kCell: {
+            // along the list in a loop, into the elements recursively
+            const Cell* x = AsPtr<Cell>(a);
+            const Cell* y = AsPtr<Cell>(b);
+            while (true) {
+                if (!EqualObjects(x->GetFirst(), y->GetFirst())) {
+                    return false;
+                }
+                const std::shared_ptr<Object>& x_next = x->GetSecond();
+                const std::shared_ptr<Object>& y_next = y->GetSecond();
+                if (!Is<Cell>(x_next) || !Is<Cell>(y_next)) {
+                    return EqualObjects(x_next, y_next);
+                }
+                x = AsPtr<Cell>(x_next);
+                y = AsPtr<Cell>(y_next);
+            }
+        }
+        case ObjectType::kVector: {
+            const ObjectVector& x = AsPtr<Vector>(a)->GetElements();
+            const ObjectVector& y = AsPtr<Vector>(b)->GetElements();
+            if (x.size() != y.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < x.size(); i++) {
+                if (!EqualObjects(x[i], y[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+HashTable::HashTable() : Object(ObjectType::kHashTable), slots_(kMinCapacity) {
+    Track();
+}
+
+size_t HashTable::FindSlot(const std::shared_ptr<Object>& key, uint64_t hash) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots_[i];
+        if (slot.hash == 0 || (slot.hash == hash && EqualObjects(slot.key, key))) {
+            return i;
+        }
+    }
+}
+
+std::shared_ptr<Object>* HashTable::Find(const std::shared_ptr<Object>& key) {
+    Slot& slot = slots_[FindSlot(key, StoredHash(key))];
+    return slot.hash ? &slot.value : nullptr;
+}
+
+void HashTable::Set(const std::shared_ptr<Object>& key, std::shared_ptr<Object> value) {
+    uint64_t hash = StoredHash(key);
+    size_t i = FindSlot(key, hash);
+    if (slots_[i].hash) {
+        slots_[i].value = std::move(value);
+        return;
+    }
+    // at most 3/4 full, so the probes stay short
+    if (4 * (size_ + 1) > 3 * slots_.size()) {
+        Grow();
+        i = FindSlot(key, hash);
+    }
+    slots_[i] = {hash, key, std::move(value)};
+    size_++;
+}
+
+bool HashTable::Erase(const std::shared_ptr<Object>& key) {
+    size_t hole = FindSlot(key, StoredHash(key));
+    if (!slots_[hole].hash) {
+        return false;
+    }
+    // shift the following entries back instead of leaving a tombstone: an entry moves
+    // into the hole if the hole is between its home slot and its current one
+    size_t mask = slots_.size() - 1;
+    for (size_t i = (hole + 1) & mask; slots_[i].hash; i = (i + 1) & mask) {
+        size_t home = slots_[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            slots_[hole] = std::move(slots_[i]);
+            hole = i;
+        }
+    }
+    slots_[hole] = {};
+    size_--;
+    return true;
+}
+
+void HashTable::Grow() {
+    std::vector<Slot> slots(2 * slots_.size());
+    size_t mask = slots.size() - 1;
+    for (Slot& slot : slots_) {
+        if (!slot.hash) {
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (slots[i].hash) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = std::move(slot);
+    }
+    slots_ = std::move(slots);
+}
+
+std::vector<std::pair<std::shared_ptr<Object>, std::shared_ptr<Object>>> HashTable::GetEntries()
+    const {
+    std::vector<std::pair<std::shared_ptr<Object>, std::shared_ptr<Object>>> res;
+    res.reserve(size_);
+    for (const Slot& slot : slots_) {
+        if (slot.hash) {
+            res.emplace_back(slot.key, slot.value);
+        }
+    }
+    return res;
+}
+
+void HashTable::Trace(const std::function<void(Object*)>& visit) const {
+    for (const Slot& slot : slots_) {
+        if (slot.hash) {
+            visit(slot.key.get());
+            visit(slot.value.get());
+        }
+    }
+}
+
+void HashTable::ClearReferences() {
+    slots_.assign(kMinCapacity, {});
+    size_ = 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "object.h"
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Hash of `obj` consistent with EqualObjects. Lists and vectors are hashed by their
+// first elements only, so the cost is bounded.
+uint64_t HashObject(const std::shared_ptr<Object>& obj);
+
+// Structural equality, like equal?: numbers, characters and strings by value, symbols by
+// name, lists and vectors element by element, anything else by identity
+bool EqualObjects(const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b);
+
+// SRFI-69 hash table with equal? keys. Open addressing with linear probing in one flat
+// array: a slot keeps the hash next to the key and the value, so a lookup usually reads
+// a single cache line and compares keys only when the hashes match.
+class HashTable : public Object {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kHashTable;
+    }
+
+    HashTable();
+
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
+
+    std::string Serialize() const override {
+        return "#<hash-table>";
+    }
+
+    bool ToBool() const override {
+        return true;
+    }
+
+    // Value stored for `key`, nullptr if there is none
+    std::shared_ptr<Object>* Find(const std::shared_ptr<Object>& key);
+
+    void Set(const std::shared_ptr<Object>& key, std::shared_ptr<Object> value);
+
+    // False if there was no `key`
+    bool Erase(const std::shared_ptr<Object>& key);
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Copies of the pairs, in no particular order
+    std::vector<std::pair<std::shared_ptr<Object>, std::shared_ptr<Object>>> GetEntries() const;
+
+    void Trace(const std::function<void(Object*)>& visit) const override;
+
+    void ClearReferences() override;
+
+private:
+    struct Slot {
+        uint64_t hash = 0;  // 0 marks an empty slot
+        std::shared_ptr<Object> key;
+        std::shared_ptr<Object> value;
+    };
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+
+    // Slot holding `key` or the empty slot where it would go
+    size_t FindSlot(const std::shared_ptr<Object>& key, uint64_t hash) const;
+
+    void Grow();
+};
@@ -2,28 +2,37 @@
 #include "error.h"
 
 ObjectVector Object2Vector(std::shared_ptr<Object> obj) {
-    if (!obj) {
-        return {};
-    }
-    if (!Is<Cell>(obj)) {
-        return {obj};
-    }
     ObjectVector res;
-    while (obj != nullptr) {
-        std::shared_ptr<Cell> cur = As<Cell>(obj);
-        res.push_back(cur->GetFirst());
-        if (!Is<Cell>(cur->GetSecond())) {
-            if (cur->GetSecond()) {
-                res.push_back(cur->GetSecond());
-            }
-            break;
+    ForEachElement(obj, [&res](const std::shared_ptr<Object> &i) { res.push_back(i); });
+    return res;
+}
+
+std::optional<ObjectVector> ProperList2Vector(const std::shared_ptr<Object> &list) {
+    ObjectVector res;
+    const Object *cur = list.get();
+    while (cur) {
+        if (cur->GetType() != ObjectType::kCell) {
+            return std::nullopt;
+        }
+        const Cell *cell = static_cast<const Cell *>(cur);
+        res.push_back(cell->GetFirst());
+        cur = cell->GetSecond().get();
+    }
+    return res;
+}
+
+std::optional<SlotNames> Symbols2SlotNames(const ObjectVector &names) {
+    SlotNames res;
+    for (auto &i : names) {
+        if (!i || i->GetType() != ObjectType::kSymbol) {
+            return std::nullopt;
         }
-        obj = cur->GetSecond();
+        res.push_back(AsPtr<Symbol>(i)->GetId());
     }
     return res;
 }
 
-bool CheckForNoNulls(const ObjectVector &obj) {
+bool CheckForNoNulls(ObjectSpan obj) {
     for (auto &i : obj) {
         if (i == nullptr) {
             return false;
@@ -32,37 +41,34 @@ bool CheckForNoNulls(const ObjectVector &obj) {
     return true;
 }
 
-std::shared_ptr<Object> Vector2Object(const ObjectVector &obj) {
+std::shared_ptr<Object> Vector2Object(ObjectSpan obj) {
     //    if (!CheckForNoNulls(obj)) {
     //        throw RuntimeError("Vector2Object's argument contains nullptr");
     //    }
     if (obj.empty()) {
         return {};
     }
-    std::shared_ptr<Object> res(new Cell);
+    std::shared_ptr<Object> res = Make<Cell>();
     std::shared_ptr<Object> cur(res);
     for (auto &i : obj) {
-        if (As<Cell>(cur)->GetFirst() == nullptr) {
-            As<Cell>(cur)->SetFirst(i);
+        if (AsPtr<Cell>(cur)->GetFirst() == nullptr) {
+            AsPtr<Cell>(cur)->SetFirst(i);
         } else {
-            std::shared_ptr<Object> next(new Cell);
-            As<Cell>(next)->SetFirst(i);
-            As<Cell>(cur)->SetSecond(next);
+            std::shared_ptr<Object> next = Make<Cell>();
+            AsPtr<Cell>(next)->SetFirst(i);
+            AsPtr<Cell>(cur)->SetSecond(next);
             cur = next;
         }
     }
     return res;
 }
 
-std::pair<std::shared_ptr<Cell>, std::shared_ptr<Object>> PrepareForCarCdr(
-    const ObjectVector &values, std::shared_ptr<Scope> scope) {
-    if (values.size() != 2) {
+std::pair<std::shared_ptr<Cell>, std::shared_ptr<Object>> PrepareForCarCdr(ObjectSpan args) {
+    if (args.size() != 2) {
         throw RuntimeError("SetCar and SetCdr functions needs exactly two arguments");
     }
-    std::shared_ptr<Object> first_arg = values[0]->Eval(scope);
-    if (!Is<Cell>(first_arg)) {
+    if (!Is<Cell>(args[0])) {
         throw RuntimeError("SetCar ot SetCdr got not cell in its first arguments");
     }
-    std::shared_ptr<Object> second_arg = values[1]->Eval(scope);
-    return {As<Cell>(first_arg), second_arg};
+    return {As<Cell>(args[0]), args[1]};
 }
@@ -3,19 +3,49 @@
 #include "error.h"
 #include "object.h"
 #include <memory>
+#include <optional>
 #include <vector>
 
 ObjectVector Object2Vector(std::shared_ptr<Object> obj);
 
-bool CheckForNoNulls(const ObjectVector &obj);
+// Calls `visit` for each of the elements Object2Vector returns, without collecting them
+template <class F>
+void ForEachElement(const std::shared_ptr<Object> &obj, F visit) {
+    if (!obj) {
+        return;
+    }
+    if (!Is<Cell>(obj)) {
+        visit(obj);
+        return;
+    }
+    const Cell *cur = AsPtr<Cell>(obj);
+    while (true) {
+        visit(cur->GetFirst());
+        const std::shared_ptr<Object> &next = cur->GetSecond();
+        if (!Is<Cell>(next)) {
+            if (next) {
+                visit(next);
+            }
+            return;
+        }
+        cur = AsPtr<Cell>(next);
+    }
+}
+
+// Elements of a proper list, nullopt for anything else
+std::optional<ObjectVector> ProperList2Vector(const std::shared_ptr<Object> &list);
+
+// Ids of the symbols in `names`, nullopt if there is anything else
+std::optional<SlotNames> Symbols2SlotNames(const ObjectVector &names);
+
+bool CheckForNoNulls(ObjectSpan obj);
 
-std::shared_ptr<Object> Vector2Object(const ObjectVector &obj);
+std::shared_ptr<Object> Vector2Object(ObjectSpan obj);
 
-std::pair<std::shared_ptr<Cell>, std::shared_ptr<Object>> PrepareForCarCdr(
-    const ObjectVector &values, std::shared_ptr<Scope> scope);
+std::pair<std::shared_ptr<Cell>, std::shared_ptr<Object>> PrepareForCarCdr(ObjectSpan args);
 
 template <class T>
-void CheckSize(const ObjectVector &values, size_t need, const std::string &func) {
+void CheckSize(ObjectSpan values, size_t need, const std::string &func) {
     if (values.size() != need) {
         throw T(func + std::string(" needs exactly ") + std::to_string(need) + " values");
     }
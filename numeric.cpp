@@ -0,0 +1,99 @@
+#include "numeric.h"
+#include "error.h"
+
+namespace {
+
+// The value of a number, a fixnum is converted into `storage`
+const BigInt& ToBigInt(const std::shared_ptr<Object>& obj, BigInt* storage) {
+    if (obj->GetType() == ObjectType::kNumber) {
+        *storage = BigInt(static_cast<const Number*>(obj.get())->GetValue());
+        return *storage;
+    }
+    return AsPtr<BigNumber>(obj)->GetValue();
+}
+
+// Both numbers are fixnums, their values go to `a` and `b`
+bool AreFixnums(const std::shared_ptr<Object>& lhs, const std::shared_ptr<Object>& rhs,
+                int64_t* a, int64_t* b) {
+    if (lhs->GetType() != ObjectType::kNumber || rhs->GetType() != ObjectType::kNumber) {
+        return false;
+    }
+    *a = static_cast<const Number*>(lhs.get())->GetValue();
+    *b = static_cast<const Number*>(rhs.get())->GetValue();
+    return true;
+}
+
+}  // namespace
+
+std::shared_ptr<Object> MakeNumber(BigInt value) {
+    if (std::optional<int64_t> fixnum = value.ToInt64()) {
+        return Number::FromValue(*fixnum);
+    }
+    return Make<BigNumber>(std::move(value));
+}
+
+std::shared_ptr<Object> AddNumbers(const std::shared_ptr<Object>& a,
+                                   const std::shared_ptr<Object>& b) {
+    int64_t x, y, res;
+    if (AreFixnums(a, b, &x, &y) && CheckedAdd(x, y, &res)) {
+        return Number::FromValue(res);
+    }
+    BigInt x_storage, y_storage;
+    return MakeNumber(ToBigInt(a, &x_storage) + ToBigInt(b, &y_storage));
+}
+
+std::shared_ptr<Object> SubtractNumbers(const std::shared_ptr<Object>& a,
+                                        const std::shared_ptr<Object>& b) {
+    int64_t x, y, res;
+    if (AreFixnums(a, b, &x, &y) && CheckedSubtract(x, y, &res)) {
+        return Number::FromValue(res);
+    }
+    BigInt x_storage, y_storage;
+    return MakeNumber(ToBigInt(a, &x_storage) - ToBigInt(b, &y_storage));
+}
+
+std::shared_ptr<Object> MultiplyNumbers(const std::shared_ptr<Object>& a,
+                                        const std::shared_ptr<Object>& b) {
+    int64_t x, y, res;
+    if (AreFixnums(a, b, &x, &y) && CheckedMultiply(x, y, &res)) {
+        return Number::FromValue(res);
+    }
+    BigInt x_storage, y_storage;
+    return MakeNumber(ToBigInt(a, &x_storage) * ToBigInt(b, &y_storage));
+}
+
+std::shared_ptr<Object> DivideNumbers(const std::shared_ptr<Object>& a,
+                                      const std::shared_ptr<Object>& b) {
+    int64_t x, y, res;
+    if (AreFixnums(a, b, &x, &y) && CheckedDivide(x, y, &res)) {
+        return Number::FromValue(res);
+    }
+    BigInt x_storage, y_storage;
+    const BigInt& divisor = ToBigInt(b, &y_storage);
+    if (divisor.IsZero()) {
+        throw RuntimeError("Division by zero");
+    }
+    return MakeNumber(ToBigInt(a, &x_storage) / divisor);
+}
+
+std::shared_ptr<Object> AbsNumber(const std::shared_ptr<Object>& a) {
+    if (a->GetType() == ObjectType::kNumber) {
+        int64_t value = static_cast<const Number*>(a.get())->GetValue();
+        if (value != INT64_MIN) {
+            return value < 0 ? Number::FromValue(-value) : a;
+        }
+    }
+    BigInt storage;
+    const BigInt& value = ToBigInt(a, &storage);
+    return value.IsNegative() ? MakeNumber(-value) : a;
+}
+
+int CompareNumbers(const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b) {
+    int64_t x, y;
+    if (!AreFixnums(a, b, &x, &y)) {
+        BigInt x_storage, y_storage;
+        auto order = ToBigInt(a, &x_storage) <=> ToBigInt(b, &y_storage);
+        return order < 0 ? -1 : order > 0;
+    }
+    return x < y ? -1 : x > y;
+}
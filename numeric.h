@@ -0,0 +1,157 @@
+#pragma once
+
+#include "object.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+// Integers are fixnums (Number) while they fit into int64_t and bignums (BigNumber)
+// otherwise. Every operation returns a fixnum if the result fits, so each value has one
+// representation. The arguments of the operations must be numbers (see Numeric).
+
+// Both representations, for Is<Numeric>
+struct Numeric {
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kNumber || type == ObjectType::kBigNumber;
+    }
+};
+
+std::shared_ptr<Object> MakeNumber(BigInt value);
+
+std::shared_ptr<Object> AddNumbers(const std::shared_ptr<Object>& a,
+                                   const std::shared_ptr<Object>& b);
+
+std::shared_ptr<Object> SubtractNumbers(const std::shared_ptr<Object>& a,
+                                        const std::shared_ptr<Object>& b);
+
+std::shared_ptr<Object> MultiplyNumbers(const std::shared_ptr<Object>& a,
+                                        const std::shared_ptr<Object>& b);
+
+// Rounds toward zero, throws RuntimeError if `b` is zero
+std::shared_ptr<Object> DivideNumbers(const std::shared_ptr<Object>& a,
+                                      const std::shared_ptr<Object>& b);
+
+std::shared_ptr<Object> AbsNumber(const std::shared_ptr<Object>& a);
+
+// Negative, zero or positive like a - b
+int CompareNumbers(const std::shared_ptr<Object>& a, const std::shared_ptr<Object>& b);
+
+// Fixnum arithmetic, false on overflow
+
+inline bool CheckedAdd(int64_t a, int64_t b, int64_t* res) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_add_overflow(a, b, res);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+        return false;
+    }
+    *res = a + b;
+    return true;
+#endif
+}
+
+inline bool CheckedSubtract(int64_t a, int64_t b, int64_t* res) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_sub_overflow(a, b, res);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) {
+        return false;
+    }
+    *res = a - b;
+    return true;
+#endif
+}
+
+inline bool CheckedMultiply(int64_t a, int64_t b, int64_t* res) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_mul_overflow(a, b, res);
+#else
+    if (a != 0 && b != 0) {
+        if (a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+                  : (b > 0 ? a < INT64_MIN / b : b < INT64_MAX / a)) {
+            return false;
+        }
+    }
+    *res = a * b;
+    return true;
+#endif
+}
+
+inline bool CheckedDivide(int64_t a, int64_t b, int64_t* res) {
+    if (b == 0 || (a == INT64_MIN && b == -1)) {
+        return false;
+    }
+    *res = a / b;
+    return true;
+}
+
+// Operations of NumberFunctor: Fixnum is the fast path, which fails on overflow (or
+// anything else it can't do), Generic takes any numbers
+
+struct AddOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        return CheckedAdd(a, b, res);
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return AddNumbers(a, b);
+    }
+};
+
+struct SubtractOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        return CheckedSubtract(a, b, res);
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return SubtractNumbers(a, b);
+    }
+};
+
+struct MultiplyOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        return CheckedMultiply(a, b, res);
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return MultiplyNumbers(a, b);
+    }
+};
+
+struct DivideOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        return CheckedDivide(a, b, res);
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return DivideNumbers(a, b);
+    }
+};
+
+struct MaxOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        *res = std::max(a, b);
+        return true;
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return CompareNumbers(a, b) >= 0 ? a : b;
+    }
+};
+
+struct MinOp {
+    bool Fixnum(int64_t a, int64_t b, int64_t* res) const {
+        *res = std::min(a, b);
+        return true;
+    }
+
+    std::shared_ptr<Object> Generic(const std::shared_ptr<Object>& a,
+                                    const std::shared_ptr<Object>& b) const {
+        return CompareNumbers(a, b) <= 0 ? a : b;
+    }
+};
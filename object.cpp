@@ -1,104 +1,440 @@
 #include "object.h"
+#include "args.h"
 #include "functors.h"
 #include "error.h"
 #include "helpers.h"
+#include "printer.h"
+#include "profiler.h"
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 
-int Number::GetValue() const {
-    return value_;
+namespace {
+
+constexpr int kMinCachedNumber = -128;
+constexpr int kMaxCachedNumber = 1024;
+
+}  // namespace
+
+std::shared_ptr<Number> Number::FromValue(int64_t value) {
+    static const std::vector<std::shared_ptr<Number>> kCache = [] {
+        std::vector<std::shared_ptr<Number>> res;
+        for (int i = kMinCachedNumber; i <= kMaxCachedNumber; i++) {
+            res.push_back(std::make_shared<Number>(i));
+        }
+        return res;
+    }();
+    if (kMinCachedNumber <= value && value <= kMaxCachedNumber) {
+        return kCache[value - kMinCachedNumber];
+    }
+    return Make<Number>(value);
+}
+
+Object::Object(const Object& other)
+    : std::enable_shared_from_this<Object>(), type_(other.type_) {
+}
+
+void Object::Track() {
+    if (Heap* heap = Heap::Current()) {
+        heap->Register(this);
+    }
+}
+
+Object::~Object() {
+    if (heap_) {
+        heap_->Unregister(this);
+    }
+}
+
+// Shared by all the interpreters and threads: lookups of known names, by far the most
+// common, take the lock in the shared mode only
+class SymbolTable {
+public:
+    static SymbolTable& Instance() {
+        static SymbolTable table;
+        return table;
+    }
+
+    std::shared_ptr<Symbol> Intern(std::string_view name) {
+        {
+            std::shared_lock lock(mutex_);
+            auto it = ids_.find(name);
+            if (it != ids_.end()) {
+                return symbols_[it->second];
+            }
+        }
+        std::unique_lock lock(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return symbols_[it->second];
+        }
+        SymbolId id = symbols_.size();
+        const std::string& stored = names_.emplace_back(name);
+        symbols_.push_back(std::shared_ptr<Symbol>(new Symbol(&stored, id)));
+        ids_.emplace(stored, id);
+        return symbols_.back();
+    }
+
+    std::shared_ptr<Symbol> FromId(SymbolId id) const {
+        std::shared_lock lock(mutex_);
+        return symbols_.at(id);
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::deque<std::string> names_;  // deque doesn't move its elements
+    std::vector<std::shared_ptr<Symbol>> symbols_;
+    std::unordered_map<std::string_view, SymbolId> ids_;
+};
+
+std::shared_ptr<Symbol> Symbol::Intern(std::string_view name) {
+    return SymbolTable::Instance().Intern(name);
+}
+
+std::shared_ptr<Symbol> Symbol::FromId(SymbolId id) {
+    return SymbolTable::Instance().FromId(id);
 }
 
 const std::string& Symbol::GetName() const {
-    return name_;
+    return *name_;
+}
+
+SymbolId Symbol::GetId() const {
+    return id_;
 }
 
 std::shared_ptr<Object> Symbol::Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const {
-    if (scope->Contains(name_)) {
-        return scope->Get(name_);
+    if (std::shared_ptr<Object>* binding = scope->Find(id_)) {
+        return *binding;
     } else {
-        throw NameError("Can't find name " + name_ +
+        throw NameError("Can't find name " + *name_ +
                         " in current scope (depth = " + std::to_string(scope->GetDepth()) + ")");
     }
 }
 
-std::shared_ptr<Object> Cell::GetFirst() const {
-    return first_;
+std::shared_ptr<Boolean> Boolean::FromValue(bool value) {
+    static const std::shared_ptr<Boolean> kTrue = std::make_shared<Boolean>(true);
+    static const std::shared_ptr<Boolean> kFalse = std::make_shared<Boolean>(false);
+    return value ? kTrue : kFalse;
+}
+
+std::string String::Serialize() const {
+    std::string res = "\"";
+    value_.ForEachPiece([&res](std::string_view piece) {
+        for (char c : piece) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if (c == '\n') {
+                res += "\\n";
+            } else if (c == '\t') {
+                res += "\\t";
+            } else {
+                res += c;
+            }
+        }
+    });
+    return res + "\"";
 }
 
-std::shared_ptr<Object> Cell::GetSecond() const {
-    return second_;
+std::shared_ptr<Character> Character::FromValue(char value) {
+    static const std::vector<std::shared_ptr<Character>> kCache = [] {
+        std::vector<std::shared_ptr<Character>> res;
+        for (int i = 0; i < 256; i++) {
+            res.push_back(std::make_shared<Character>(static_cast<char>(i)));
+        }
+        return res;
+    }();
+    return kCache[static_cast<unsigned char>(value)];
 }
 
-bool Boolean::GetValue() const {
-    return value_;
+std::string Character::Serialize() const {
+    if (value_ == ' ') {
+        return "#\\space";
+    }
+    if (value_ == '\n') {
+        return "#\\newline";
+    }
+    if (value_ == '\t') {
+        return "#\\tab";
+    }
+    return std::string("#\\") + value_;
 }
 
+namespace {
+
+// TailCalc of `functor` reported to the profiler. The arguments of a procedure or a lambda are
+// evaluated before the call is reported, by the caller, as the other engines do. A lambda
+// replaces the one whose body it ends, a builtin returns right away.
+std::shared_ptr<Object> ProfiledCall(IFunctor* functor, ObjectSpan values,
+                                     const std::shared_ptr<Scope>& scope, ProfileScope* profile,
+                                     TailCall* tail) {
+    ObjectType type = functor->GetType();
+    if (type != ObjectType::kLambda && type != ObjectType::kProcedure) {
+        profile->Call(functor);
+        return functor->TailCalc(values, scope, tail);
+    }
+    ArgFrame args(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!values[i]) {
+            throw RuntimeError("Trying to Eval nullptr");
+        }
+        args[i] = Evaluate(values[i], scope);
+    }
+    if (type == ObjectType::kLambda) {
+        const LambdaFunctor* lambda = static_cast<const LambdaFunctor*>(functor);
+        std::shared_ptr<Scope> frame = lambda->MakeFrame(args.Get());
+        profile->TailCall(functor);
+        return lambda->TailRun(std::move(frame), tail);
+    }
+    profile->Call(functor);
+    return static_cast<IProcedure*>(functor)->Apply(args.Get());
+}
+
+}  // namespace
+
 std::shared_ptr<Object> Cell::Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const {
-    if (!first_) {
-        throw RuntimeError("shit happened during eval (fucking eval_test)");
+    const Cell* cell = this;
+    std::shared_ptr<Object> holder;  // keeps `cell` alive after a tail call
+    ProfileScope profile;
+    while (true) {
+        if (!cell->first_) {
+            throw RuntimeError("shit happened during eval (fucking eval_test)");
+        }
+        std::shared_ptr<Object> func = Evaluate(cell->first_, scope);
+        IFunctor* ff = AsPtr<IFunctor>(func);
+        if (!ff) {
+            throw RuntimeError("Cell::first is not a functor");
+        }
+        TailCall tail;
+        {
+            size_t count = 0;
+            ForEachElement(cell->second_, [&count](const std::shared_ptr<Object>&) { count++; });
+            ArgFrame args(count);
+            size_t i = 0;
+            ForEachElement(cell->second_,
+                           [&args, &i](const std::shared_ptr<Object>& arg) { args[i++] = arg; });
+            std::shared_ptr<Object> res =
+                profile.IsActive() && GetSpecialForm(func) == SpecialForm::kNone
+                    ? ProfiledCall(ff, args.Get(), scope, &profile, &tail)
+                    : ff->TailCalc(args.Get(), scope, &tail);
+            if (!tail.expr) {
+                return res;
+            }
+        }
+        if (!Is<Cell>(tail.expr)) {
+            return tail.expr->Eval(tail.scope);
+        }
+        holder = std::move(tail.expr);
+        cell = AsPtr<Cell>(holder);
+        scope = std::move(tail.scope);
+    }
+}
+
+namespace {
+
+// A cell that dies once this reference is dropped
+bool IsLastCellReference(const std::shared_ptr<Object>& obj) {
+    return obj && obj.use_count() == 1 && obj->GetType() == ObjectType::kCell;
+}
+
+}  // namespace
+
+Cell::~Cell() {
+    if (!IsLastCellReference(first_) && !IsLastCellReference(second_)) {
+        return;
     }
-    std::shared_ptr<Object> func = first_->Eval(scope);
-    if (!Is<IFunctor>(func)) {
-        throw RuntimeError("Cell::first is not a functor");
+    // the cells dying with this one are released here, one at a time with their children
+    // detached, so long or deeply nested lists don't recurse through the destructors
+    std::vector<std::shared_ptr<Object>> dying;
+    auto detach = [&dying](std::shared_ptr<Object>* child) {
+        if (IsLastCellReference(*child)) {
+            dying.push_back(std::move(*child));
+        }
+    };
+    detach(&first_);
+    detach(&second_);
+    while (!dying.empty()) {
+        std::shared_ptr<Object> cell = std::move(dying.back());
+        dying.pop_back();
+        detach(&static_cast<Cell*>(cell.get())->first_);
+        detach(&static_cast<Cell*>(cell.get())->second_);
     }
-    ObjectVector data = Object2Vector(second_);
-    std::shared_ptr<IFunctor> ff = As<IFunctor>(func);
-    std::shared_ptr<Object> res = ff->Calc(data, scope);
-    return res;
+}
+
+void Cell::Trace(const std::function<void(Object*)>& visit) const {
+    visit(first_.get());
+    visit(second_.get());
+}
+
+void Cell::ClearReferences() {
+    first_ = nullptr;
+    second_ = nullptr;
 }
 
 std::string Cell::Serialize() const {
-    std::string inner;
-    std::shared_ptr<Cell> cur(new Cell);
-    cur->SetFirst(first_), cur->SetSecond(second_);
-    while (true) {
-        if (!cur->GetFirst()) {
-            inner += "()";
-        } else {
-            inner += cur->GetFirst()->Serialize();
+    std::string res;
+    Print(this, &res);
+    return res;
+}
+
+std::string Vector::Serialize() const {
+    std::string res;
+    Print(this, &res);
+    return res;
+}
+
+void Vector::Trace(const std::function<void(Object*)>& visit) const {
+    for (auto& i : elements_) {
+        visit(i.get());
+    }
+}
+
+void Vector::ClearReferences() {
+    elements_.clear();
+}
+
+Object Scope::unassigned;
+
+std::shared_ptr<Object> Scope::Unassigned() {
+    // owns nothing, copies don't count references
+    return std::shared_ptr<Object>(std::shared_ptr<Object>(), &unassigned);
+}
+
+std::shared_ptr<Object> Scope::Get(const Symbol& name) const {
+    std::shared_ptr<Object>* binding = const_cast<Scope*>(this)->Find(name.GetId());
+    return binding ? *binding : nullptr;
+}
+
+std::shared_ptr<Object>* Scope::Find(SymbolId name) {
+    for (Scope* cur = this; cur; cur = cur->parent_.get()) {
+        if (std::optional<size_t> slot = cur->FindSlot(name)) {
+            if (cur->slots_[*slot].get() == &unassigned) {
+                continue;
+            }
+            return &cur->slots_[*slot];
+        }
+        auto it = cur->objects_.find(name);
+        if (it != cur->objects_.end()) {
+            return &it->second;
         }
-        if (!cur->GetSecond()) {
-            break;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<Object>* Scope::FindGlobalUncached(SymbolId name, GlobalCache* cache) {
+    uint64_t current = epoch_->epoch;
+    for (Scope* cur = this; cur; cur = cur->parent_.get()) {
+        if (std::optional<size_t> slot = cur->FindSlot(name)) {
+            if (cur->slots_[*slot].get() == &unassigned) {
+                continue;
+            }
+            return &cur->slots_[*slot];  // in this frame only, not cached
         }
-        inner += " ";
-        if (!Is<Cell>(cur->GetSecond())) {
-            inner += ". " + cur->GetSecond()->Serialize();
-            break;
+        auto it = cur->objects_.find(name);
+        if (it != cur->objects_.end()) {
+            if (!cur->slot_names_ && epoch_->shadowing_frames == 0) {
+                *cache = {&it->second, current};
+            }
+            return &it->second;
         }
-        cur = As<Cell>(cur->GetSecond());
     }
-    return "(" + inner + ")";
+    return nullptr;
 }
 
-std::shared_ptr<Object> Scope::Get(const std::string& name) const {
-    if (objects_.contains(name)) {
-        return objects_.at(name);
-    } else if (parent_) {
-        return parent_->Get(name);
-    } else {
-        return nullptr;
+bool Scope::Contains(const Symbol& name) const {
+    return const_cast<Scope*>(this)->Find(name.GetId()) != nullptr;
+}
+
+void Scope::Define(const Symbol& name, std::shared_ptr<Object> object) {
+    if (slot_names_) {
+        if (std::optional<size_t> slot = FindSlot(name.GetId())) {
+            slots_[*slot] = std::move(object);
+            return;
+        }
+        // a define the resolver didn't see, the binding may shadow a global one
+        if (objects_.empty()) {
+            epoch_owner_ = epoch_->shared_from_this();
+            epoch_->shadowing_frames++;
+        }
+        if (objects_.insert_or_assign(name.GetId(), std::move(object)).second) {
+            epoch_->epoch++;
+        }
+        return;
     }
+    objects_[name.GetId()] = object;
+}
+
+void Scope::Define(std::string_view name, std::shared_ptr<Object> object) {
+    Define(*Symbol::Intern(name), std::move(object));
+}
+
+void Scope::Set(const Symbol& name, std::shared_ptr<Object> object) {
+    std::shared_ptr<Object>* binding = Find(name.GetId());
+    if (!binding) {
+        throw NameError("Undefined reference to variable " + name.GetName());
+    }
+    *binding = object;
+}
+
+Scope::Scope(const std::shared_ptr<Scope>& parent)
+    : Object(ObjectType::kScope),
+      parent_(parent),
+      epoch_owner_(parent ? parent->epoch_->shared_from_this() : std::make_shared<GlobalEpoch>()) {
+    epoch_ = epoch_owner_.get();
+    Track();
 }
 
-bool Scope::Contains(const std::string& name) const {
-    return Get(name) != nullptr;
+Scope::Scope(const std::shared_ptr<Scope>& parent, std::shared_ptr<const SlotNames> slot_names,
+             size_t args)
+    : Object(ObjectType::kScope),
+      parent_(parent),
+      slot_names_(std::move(slot_names)),
+      slots_(slot_names_->size()) {
+    if (parent) {
+        epoch_ = parent->epoch_;
+    } else {
+        epoch_owner_ = std::make_shared<GlobalEpoch>();
+        epoch_ = epoch_owner_.get();
+    }
+    std::fill(slots_.begin() + args, slots_.end(), Unassigned());
+    Track();
 }
 
-void Scope::Define(const std::string& name, std::shared_ptr<Object> object) {
-    objects_[name] = object;
+std::optional<size_t> Scope::FindSlot(SymbolId name) const {
+    if (!slot_names_) {
+        return std::nullopt;
+    }
+    const SlotNames& names = *slot_names_;
+    for (size_t i = names.size(); i > 0; i--) {
+        if (names[i - 1] == name) {
+            return i - 1;
+        }
+    }
+    return std::nullopt;
 }
 
-void Scope::Set(const std::string& name, std::shared_ptr<Object> object) {
-    if (!Contains(name)) {
-        throw NameError("Undefined reference to variable " + name);
+const std::shared_ptr<Object>& Scope::GetOutside(size_t slot) const {
+    std::shared_ptr<Symbol> name = Symbol::FromId((*slot_names_)[slot]);
+    std::shared_ptr<Object>* binding = parent_ ? parent_->Find(name->GetId()) : nullptr;
+    if (!binding) {
+        throw NameError("Can't find name " + name->GetName() + " in current scope (depth = " +
+                        std::to_string(GetDepth()) + ")");
     }
-    if (!objects_.contains(name)) {
-        return parent_->Set(name, object);
+    return *binding;
+}
+
+void Scope::SetOutside(size_t slot, std::shared_ptr<Object> object) {
+    std::shared_ptr<Symbol> name = Symbol::FromId((*slot_names_)[slot]);
+    if (!parent_) {
+        throw NameError("Undefined reference to variable " + name->GetName());
     }
-    Define(name, object);
+    parent_->Set(*name, std::move(object));
 }
 
-Scope::Scope(const std::shared_ptr<Scope>& parent) : parent_(parent) {
+const SlotNames* Scope::GetSlotNames() const {
+    return slot_names_.get();
 }
 
 size_t Scope::GetDepth() const {
@@ -109,15 +445,52 @@ size_t Scope::GetDepth() const {
     }
 }
 
-std::unordered_map<std::string, std::shared_ptr<Object>> Scope::GetObjects() const {
+std::unordered_map<SymbolId, std::shared_ptr<Object>> Scope::GetObjects() const {
     return objects_;
 }
 
+void Scope::Trace(const std::function<void(Object*)>& visit) const {
+    visit(parent_.get());
+    for (auto& i : slots_) {
+        visit(i.get());
+    }
+    for (auto& [name, obj] : objects_) {
+        visit(obj.get());
+    }
+}
+
+void Scope::ClearReferences() {
+    parent_ = nullptr;
+    slots_.clear();
+    ReleaseObjects();
+    objects_.clear();
+}
+
+Scope::~Scope() {
+    ReleaseObjects();
+}
+
+void Scope::ReleaseObjects() {
+    if (objects_.empty()) {
+        return;
+    }
+    if (slot_names_) {
+        epoch_->shadowing_frames--;
+    } else {
+        epoch_->epoch++;  // the bindings may be cached
+    }
+}
+
 std::shared_ptr<Scope> Scope::GetParent() const {
     return parent_;
 }
 
 Scope::Scope(const std::shared_ptr<Scope>& parent,
-             const std::unordered_map<std::string, std::shared_ptr<Object>>& objects)
-    : parent_(parent), objects_(objects) {
+             const std::unordered_map<SymbolId, std::shared_ptr<Object>>& objects)
+    : Object(ObjectType::kScope),
+      parent_(parent),
+      objects_(objects),
+      epoch_owner_(parent ? parent->epoch_->shared_from_this() : std::make_shared<GlobalEpoch>()) {
+    epoch_ = epoch_owner_.get();
+    Track();
 }
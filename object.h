@@ -1,15 +1,59 @@
 #pragma once
 
+#include "bigint.h"
+#include "gc.h"
+#include "rope.h"
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 class Scope;
+class Symbol;
+
+// Index of a symbol name in the global symbol table (see Symbol::Intern)
+using SymbolId = size_t;
+
+// Tag of the concrete class, lets Is/As and the hot paths avoid RTTI and virtual calls
+enum class ObjectType : uint8_t {
+    kOther,
+    kScope,
+    kNumber,
+    kBigNumber,
+    kSymbol,
+    kLocalSymbol,
+    kBoolean,
+    kString,
+    kCharacter,
+    kCell,
+    kVector,
+    kHashTable,
+    kFunctor,
+    kProcedure,
+    kLambda,
+};
 
 class Object : public std::enable_shared_from_this<Object> {
 public:
-    virtual ~Object() = default;
+    explicit Object(ObjectType type = ObjectType::kOther) : type_(type) {
+    }
+
+    Object(const Object&);
+
+    ObjectType GetType() const {
+        return type_;
+    }
+
+    Object& operator=(const Object&) = delete;
+
+    virtual ~Object();
 
     virtual std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const {
         throw std::runtime_error("Eval is not implemented for Object");
@@ -22,16 +66,78 @@ public:
     virtual bool ToBool() const {
         throw std::runtime_error("ToBool is not implemented for Object");
     }
+
+    // Calls `visit` for every object this one references (see gc.h)
+    virtual void Trace([[maybe_unused]] const std::function<void(Object*)>& visit) const {
+    }
+
+    // Drops the references reported by Trace, called by Heap::Collect on garbage
+    virtual void ClearReferences() {
+    }
+
+protected:
+    // Registers the object in the current heap. Only objects referencing other objects
+    // can be a part of a cycle, so only they call it (from their constructors).
+    void Track();
+
+private:
+    Heap* heap_ = nullptr;
+    Object* gc_prev_ = nullptr;
+    Object* gc_next_ = nullptr;
+    bool gc_marked_ = false;
+    ObjectType type_;
+
+    friend class Heap;
 };
 
 using ObjectVector = std::vector<std::shared_ptr<Object>>;
 
+using ObjectSpan = std::span<const std::shared_ptr<Object>>;
+
+using SlotNames = std::vector<SymbolId>;
+
+// Builtins by the name they are bound to in the global scope
+using BuiltinTable = std::unordered_map<SymbolId, std::shared_ptr<Object>>;
+
+// Line and column of a token in the source, counted from 1. Line 0 means unknown.
+struct SourceLocation {
+    uint32_t line = 0;
+    uint32_t column = 0;
+};
+
+// Binding of a global variable remembered by the code referencing it, see Scope::FindGlobal
+struct GlobalCache {
+    std::shared_ptr<Object>* binding = nullptr;
+    uint64_t epoch = 0;  // of the bindings when it was remembered, 0 if it wasn't
+};
+
+// Validity of the global caches of the code run under one global scope, that is of one
+// interpreter, shared by all the scopes under it (see Scope::FindGlobal)
+struct GlobalEpoch : std::enable_shared_from_this<GlobalEpoch> {
+    uint64_t epoch = 1;
+    // Live frames with bindings outside of their slots, nothing is cached while there are any
+    size_t shadowing_frames = 0;
+};
+
 class Scope : public Object {
 public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kScope;
+    }
+
     explicit Scope(const std::shared_ptr<Scope>& parent);
 
+    // Frame of a lambda call: variables from `slot_names` live in a flat array of slots
+    // (see LocalSymbol), anything else goes to the usual map. The first `args` slots are the
+    // arguments the caller fills in, the rest are the defines of the body and stay unassigned
+    // until they run.
+    Scope(const std::shared_ptr<Scope>& parent, std::shared_ptr<const SlotNames> slot_names,
+          size_t args);
+
     Scope(const std::shared_ptr<Scope>& parent,
-          const std::unordered_map<std::string, std::shared_ptr<Object>>& objects);
+          const std::unordered_map<SymbolId, std::shared_ptr<Object>>& objects);
+
+    ~Scope() override;
 
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
         throw std::runtime_error("Eval is not implemented for Scope");
@@ -45,74 +151,260 @@ public:
         throw std::runtime_error("Serialize is not implemented for Scope");
     }
 
-    std::shared_ptr<Object> Get(const std::string& name) const;
+    std::shared_ptr<Object> Get(const Symbol& name) const;
 
-    bool Contains(const std::string& name) const;
+    // Pointer to the binding of `name` in this scope or its parents, nullptr if there is none
+    std::shared_ptr<Object>* Find(SymbolId name);
 
-    void Define(const std::string& name, std::shared_ptr<Object> object);
+    // Find for a name the resolver didn't bind to a slot, made once per `cache`. A binding of
+    // a global scope stays in place until the scope dies, and the names a lambda frame has
+    // are fixed by its slots, so the cached binding is good until a frame gets a binding
+    // outside of its slots (from a define the resolver didn't see, which may shadow a global)
+    // or a scope with bindings dies. Either starts a new epoch of the scopes under the same
+    // global scope, dropping their caches; other interpreters aren't affected.
+    std::shared_ptr<Object>* FindGlobal(SymbolId name, GlobalCache* cache) {
+        if (cache->epoch == epoch_->epoch) {
+            return cache->binding;
+        }
+        return FindGlobalUncached(name, cache);
+    }
 
-    void Set(const std::string& name, std::shared_ptr<Object> object);
+    bool Contains(const Symbol& name) const;
+
+    // Value of a variable, an unassigned slot leaves the name to the scopes around the frame
+    const std::shared_ptr<Object>& GetSlot(size_t depth, size_t slot) const {
+        const Scope* cur = this;
+        for (; depth > 0; depth--) {
+            cur = cur->parent_.get();
+        }
+        const std::shared_ptr<Object>& value = cur->slots_[slot];
+        if (value.get() == &unassigned) [[unlikely]] {
+            return cur->GetOutside(slot);
+        }
+        return value;
+    }
+
+    // set! of a variable, same as GetSlot for an unassigned slot
+    void AssignSlot(size_t depth, size_t slot, std::shared_ptr<Object> object) {
+        Scope* cur = this;
+        for (; depth > 0; depth--) {
+            cur = cur->parent_.get();
+        }
+        std::shared_ptr<Object>& value = cur->slots_[slot];
+        if (value.get() == &unassigned) [[unlikely]] {
+            cur->SetOutside(slot, std::move(object));
+            return;
+        }
+        value = std::move(object);
+    }
+
+    void SetSlot(size_t depth, size_t slot, std::shared_ptr<Object> object) {
+        Scope* cur = this;
+        for (; depth > 0; depth--) {
+            cur = cur->parent_.get();
+        }
+        cur->slots_[slot] = std::move(object);
+    }
+
+    // Raw value of a slot of this frame, Unassigned() if its define hasn't run yet
+    const std::shared_ptr<Object>& GetSlotValue(size_t slot) const {
+        return slots_[slot];
+    }
+
+    // Value of the slots whose define hasn't run yet
+    static std::shared_ptr<Object> Unassigned();
+
+    // Names of the slots, nullptr if this is not a lambda frame
+    const SlotNames* GetSlotNames() const;
+
+    void Define(const Symbol& name, std::shared_ptr<Object> object);
+
+    void Define(std::string_view name, std::shared_ptr<Object> object);
+
+    void Set(const Symbol& name, std::shared_ptr<Object> object);
 
     size_t GetDepth() const;
 
-    std::unordered_map<std::string, std::shared_ptr<Object>> GetObjects() const;
+    std::unordered_map<SymbolId, std::shared_ptr<Object>> GetObjects() const;
 
     std::shared_ptr<Scope> GetParent() const;
 
+    void Trace(const std::function<void(Object*)>& visit) const override;
+
+    void ClearReferences() override;
+
 private:
+    // Not a value of the language, only marks the unassigned slots
+    static Object unassigned;
+
     std::shared_ptr<Scope> parent_;
-    std::unordered_map<std::string, std::shared_ptr<Object>> objects_;
+    std::shared_ptr<const SlotNames> slot_names_;
+    std::vector<std::shared_ptr<Object>, PoolAllocator<std::shared_ptr<Object>>> slots_;
+    std::unordered_map<SymbolId, std::shared_ptr<Object>> objects_;
+    // Of the global scope, alive as long as the scopes under it run
+    GlobalEpoch* epoch_;
+    // Kept by the global scope, and by any scope that changes the epoch once it is gone
+    std::shared_ptr<GlobalEpoch> epoch_owner_;
+
+    std::shared_ptr<Object>* FindGlobalUncached(SymbolId name, GlobalCache* cache);
+
+    // Index of the last slot named `name`, a later parameter wins over an earlier one of the
+    // same name
+    std::optional<size_t> FindSlot(SymbolId name) const;
+
+    const std::shared_ptr<Object>& GetOutside(size_t slot) const;
+    void SetOutside(size_t slot, std::shared_ptr<Object> object);
+
+    // Called before the bindings of the map are gone
+    void ReleaseObjects();
 };
 
 class Number : public Object {
 public:
-    Number(int value) : value_(value) {
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kNumber;
     }
 
+    Number(int64_t value) : Object(ObjectType::kNumber), value_(value) {
+    }
+
+    // Numbers are immutable, so the ones in [-128, 1024] are shared instead of allocated every
+    // time. Any other value is a new allocation: a loop whose counter goes past 1024 allocates
+    // a number per step (see BM_CountLoop).
+    static std::shared_ptr<Number> FromValue(int64_t value);
+
+    // Literals evaluate to themselves
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
-        return std::shared_ptr<Object>(new Number{value_});
+        return std::const_pointer_cast<Object>(shared_from_this());
     }
 
     std::string Serialize() const override {
         return std::to_string(value_);
     }
 
-    int GetValue() const;
+    int64_t GetValue() const {
+        return value_;
+    }
 
     bool ToBool() const override {
         return true;
     }
 
 private:
-    int value_;
+    int64_t value_;
+};
+
+// Integer that doesn't fit into a Number (see numeric.h)
+class BigNumber : public Object {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kBigNumber;
+    }
+
+    explicit BigNumber(BigInt value) : Object(ObjectType::kBigNumber), value_(std::move(value)) {
+    }
+
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
+
+    std::string Serialize() const override {
+        return value_.ToString();
+    }
+
+    const BigInt& GetValue() const {
+        return value_;
+    }
+
+    bool ToBool() const override {
+        return true;
+    }
+
+private:
+    BigInt value_;
 };
 
 class Symbol : public Object {
 public:
-    Symbol(const std::string& name) : name_(name) {
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kSymbol || type == ObjectType::kLocalSymbol;
     }
 
+    // The canonical Symbol for `name`: names are stored once, in a global table, so
+    // symbols can be compared by pointer or by id. Safe to call from any thread.
+    static std::shared_ptr<Symbol> Intern(std::string_view name);
+
+    static std::shared_ptr<Symbol> FromId(SymbolId id);
+
     const std::string& GetName() const;
 
+    SymbolId GetId() const;
+
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override;
 
     std::string Serialize() const override {
-        return name_;
+        return *name_;
     }
 
     bool ToBool() const override {
         return true;
     }
 
+protected:
+    Symbol(const std::string* name, SymbolId id, ObjectType type = ObjectType::kSymbol)
+        : Object(type), name_(name), id_(id) {
+    }
+
 private:
-    std::string name_;
+    const std::string* name_;
+    SymbolId id_;
+
+    friend class SymbolTable;
+};
+
+// Symbol bound to a slot of a lambda frame, produced by ResolveBody (see resolver.h):
+// the variable lives `depth` frames up from the scope it is evaluated in.
+class LocalSymbol : public Symbol {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kLocalSymbol;
+    }
+
+    LocalSymbol(const Symbol& symbol, size_t depth, size_t slot)
+        : Symbol(&symbol.GetName(), symbol.GetId(), ObjectType::kLocalSymbol),
+          depth_(depth),
+          slot_(slot) {
+    }
+
+    std::shared_ptr<Object> Eval(std::shared_ptr<Scope> scope) const override {
+        return scope->GetSlot(depth_, slot_);
+    }
+
+    size_t GetDepth() const {
+        return depth_;
+    }
+
+    size_t GetSlot() const {
+        return slot_;
+    }
+
+private:
+    size_t depth_;
+    size_t slot_;
 };
 
 class Boolean : public Object {
 public:
-    Boolean(bool value) : value_(value) {
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kBoolean;
     }
 
+    Boolean(bool value) : Object(ObjectType::kBoolean), value_(value) {
+    }
+
+    // One of the two shared instances, #t or #f
+    static std::shared_ptr<Boolean> FromValue(bool value);
+
     std::string Serialize() const override {
         if (value_) {
             return "#t";
@@ -122,10 +414,12 @@ public:
     }
 
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
-        return std::shared_ptr<Boolean>(new Boolean{value_});
+        return std::const_pointer_cast<Object>(shared_from_this());
     }
 
-    bool GetValue() const;
+    bool GetValue() const {
+        return value_;
+    }
 
     bool ToBool() const override {
         return value_;
@@ -135,19 +429,107 @@ private:
     bool value_;
 };
 
+// Immutable string, concatenation and substrings share the text (see rope.h)
+class String : public Object {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kString;
+    }
+
+    explicit String(Rope value) : Object(ObjectType::kString), value_(std::move(value)) {
+    }
+
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
+
+    // A string literal
+    std::string Serialize() const override;
+
+    const Rope& GetValue() const {
+        return value_;
+    }
+
+    bool ToBool() const override {
+        return true;
+    }
+
+private:
+    Rope value_;
+};
+
+class Character : public Object {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kCharacter;
+    }
+
+    Character(char value) : Object(ObjectType::kCharacter), value_(value) {
+    }
+
+    // Characters are shared like small numbers
+    static std::shared_ptr<Character> FromValue(char value);
+
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
+
+    // Character literal, like #\a or #\space
+    std::string Serialize() const override;
+
+    char GetValue() const {
+        return value_;
+    }
+
+    bool ToBool() const override {
+        return true;
+    }
+
+private:
+    char value_;
+};
+
 class Cell : public Object {
 public:
-    std::shared_ptr<Object> GetFirst() const;
-    std::shared_ptr<Object> GetSecond() const;
+    const std::shared_ptr<Object>& GetFirst() const {
+        return first_;
+    }
+
+    const std::shared_ptr<Object>& GetSecond() const {
+        return second_;
+    }
 
     void SetFirst(std::shared_ptr<Object> first) {
         first_ = first;  // too lazy to do this is .cpp
     }
 
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kCell;
+    }
+
+    Cell() : Object(ObjectType::kCell) {
+        Track();
+    }
+
+    // Frees the cells owned only by this one in a loop, long or deeply nested lists would
+    // overflow the stack otherwise
+    ~Cell() override;
+
     void SetSecond(std::shared_ptr<Object> second) {
         second_ = second;
     }
 
+    // Where the list starting with this cell was read from, unknown for lists made by the
+    // program. Columns past 65535 are stored as 65535.
+    SourceLocation GetLocation() const {
+        return {line_, column_};
+    }
+
+    void SetLocation(SourceLocation location) {
+        line_ = location.line;
+        column_ = static_cast<uint16_t>(std::min<uint32_t>(location.column, UINT16_MAX));
+    }
+
     std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override;
 
     std::string Serialize() const override;
@@ -156,22 +538,122 @@ public:
         return true;
     }
 
+    void Trace(const std::function<void(Object*)>& visit) const override;
+
+    void ClearReferences() override;
+
 private:
+    // fit into the padding at the end of Object, so a cell is no bigger with them
+    uint16_t column_ = 0;
+    uint32_t line_ = 0;
     std::shared_ptr<Object> first_;
     std::shared_ptr<Object> second_;
 };
 
+// Fixed size array of objects with O(1) access
+class Vector : public Object {
+public:
+    static bool IsTypeOf(ObjectType type) {
+        return type == ObjectType::kVector;
+    }
+
+    explicit Vector(ObjectVector elements)
+        : Object(ObjectType::kVector), elements_(std::move(elements)) {
+        Track();
+    }
+
+    // Vectors evaluate to themselves
+    std::shared_ptr<Object> Eval([[maybe_unused]] std::shared_ptr<Scope> scope) const override {
+        return std::const_pointer_cast<Object>(shared_from_this());
+    }
+
+    std::string Serialize() const override;
+
+    bool ToBool() const override {
+        return true;
+    }
+
+    ObjectVector& GetElements() {
+        return elements_;
+    }
+
+    const ObjectVector& GetElements() const {
+        return elements_;
+    }
+
+    void Trace(const std::function<void(Object*)>& visit) const override;
+
+    void ClearReferences() override;
+
+private:
+    ObjectVector elements_;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 
 // Runtime type checking and convertion.
-// This can be helpful: https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
+// Classes with a static IsTypeOf(ObjectType) are checked by the type tag, the rest
+// (concrete functors) fall back to RTTI.
+
+template <class T>
+concept TaggedType = requires(ObjectType type) {
+    { T::IsTypeOf(type) } -> std::same_as<bool>;
+};
+
+template <class T>
+bool Is(const std::shared_ptr<Object>& obj) {
+    if constexpr (TaggedType<T>) {
+        return obj && T::IsTypeOf(obj->GetType());
+    } else {
+        return dynamic_cast<T*>(obj.get()) != nullptr;
+    }
+}
 
 template <class T>
 std::shared_ptr<T> As(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+    if constexpr (TaggedType<T>) {
+        return Is<T>(obj) ? std::static_pointer_cast<T>(obj) : nullptr;
+    } else {
+        return std::dynamic_pointer_cast<T>(obj);
+    }
 }
 
+// Same as As, but doesn't touch the reference count: the result lives as long as `obj`
 template <class T>
-bool Is(const std::shared_ptr<Object>& obj) {
-    return std::dynamic_pointer_cast<T>(obj) != nullptr;
+T* AsPtr(const std::shared_ptr<Object>& obj) {
+    if constexpr (TaggedType<T>) {
+        return Is<T>(obj) ? static_cast<T*>(obj.get()) : nullptr;
+    } else {
+        return dynamic_cast<T*>(obj.get());
+    }
+}
+
+// obj->Eval(scope) with the most common cases dispatched on the type tag
+inline std::shared_ptr<Object> Evaluate(const std::shared_ptr<Object>& obj,
+                                        const std::shared_ptr<Scope>& scope) {
+    switch (obj->GetType()) {
+        case ObjectType::kNumber:
+        case ObjectType::kBigNumber:
+        case ObjectType::kBoolean:
+        case ObjectType::kString:
+        case ObjectType::kCharacter:
+            return obj;
+        case ObjectType::kLocalSymbol: {
+            const LocalSymbol* local = static_cast<const LocalSymbol*>(obj.get());
+            return scope->GetSlot(local->GetDepth(), local->GetSlot());
+        }
+        default:
+            return obj->Eval(scope);
+    }
+}
+
+// obj->ToBool() without a virtual call: everything except #f is true
+inline bool IsTrue(const std::shared_ptr<Object>& obj) {
+    if (!obj) {
+        return true;  // empty list
+    }
+    if (obj->GetType() == ObjectType::kBoolean) {
+        return static_cast<const Boolean*>(obj.get())->GetValue();
+    }
+    return obj->ToBool();
 }
@@ -0,0 +1,439 @@
+#include "optimizer.h"
+#include "functors.h"
+#include "helpers.h"
+#include "resolver.h"
+#include <algorithm>
+#include <exception>
+#include <optional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Largest body inlined, in cells
+constexpr size_t kMaxInlineCells = 32;
+
+// Calls inlined into the body of an inlined call, and so on
+constexpr size_t kMaxInlineDepth = 4;
+
+// Names a rewrite relies on, with the values they are expected to be bound to
+using Assumptions = std::vector<std::pair<std::shared_ptr<Object>, std::shared_ptr<Object>>>;
+
+struct Rewritten {
+    std::shared_ptr<Object> expr;
+    Assumptions assumptions;  // empty if `expr` does the same as the original anyway
+};
+
+void Merge(Assumptions* to, const Assumptions& from) {
+    for (const auto& assumption : from) {
+        SymbolId name = AsPtr<Symbol>(assumption.first)->GetId();
+        auto same = [name](const auto& other) {
+            return AsPtr<Symbol>(other.first)->GetId() == name;
+        };
+        if (std::ranges::none_of(*to, same)) {
+            to->push_back(assumption);
+        }
+    }
+}
+
+bool IsConstant(const std::shared_ptr<Object>& expr) {
+    return Is<Number>(expr) || Is<BigNumber>(expr) || Is<Boolean>(expr);
+}
+
+bool IsGlobalSymbol(const std::shared_ptr<Object>& expr) {
+    return expr && expr->GetType() == ObjectType::kSymbol;
+}
+
+// List of `items`, with the source location of `form`
+std::shared_ptr<Object> MakeForm(const ObjectVector& items, const std::shared_ptr<Object>& form) {
+    std::shared_ptr<Object> res = Vector2Object(items);
+    AsPtr<Cell>(res)->SetLocation(AsPtr<Cell>(form)->GetLocation());
+    return res;
+}
+
+// `form` if its items are still `items`, a new list of `items` if not
+std::shared_ptr<Object> Rebuild(const std::shared_ptr<Object>& form, const ObjectVector& old_items,
+                                const ObjectVector& items) {
+    return old_items == items ? form : MakeForm(items, form);
+}
+
+class Rewriter {
+public:
+    Rewriter(const OptimizerPasses& passes, const std::unordered_set<const Object*>& pure,
+             const std::shared_ptr<Object>& guard, const std::shared_ptr<Scope>& globals,
+             OptimizerStats* stats)
+        : passes_(passes), pure_(pure), guard_(guard), globals_(globals), stats_(stats) {
+    }
+
+    std::shared_ptr<Object> RewriteForm(const std::shared_ptr<Object>& form) {
+        CollectAssigned(form);
+        return Guard(Rewrite(form), form);
+    }
+
+private:
+    const OptimizerPasses& passes_;
+    const std::unordered_set<const Object*>& pure_;
+    const std::shared_ptr<Object>& guard_;
+    const std::shared_ptr<Scope>& globals_;
+    OptimizerStats* stats_;
+    std::vector<SlotNames> frames_;          // of the lambdas around the expression rewritten
+    std::unordered_set<SymbolId> assigned_;  // names set! anywhere in the form
+    size_t inline_depth_ = 0;
+
+    // Guard running `res` in place of `original`
+    std::shared_ptr<Object> Guard(const Rewritten& res, const std::shared_ptr<Object>& original) {
+        if (res.assumptions.empty()) {
+            return res.expr;
+        }
+        ObjectVector bindings;
+        for (const auto& [name, value] : res.assumptions) {
+            bindings.push_back(name);
+            bindings.push_back(value);
+        }
+        return MakeForm({guard_, Make<Vector>(std::move(bindings)), res.expr, original}, original);
+    }
+
+    bool IsLocal(SymbolId name) const {
+        return std::ranges::any_of(frames_, [name](const SlotNames& frame) {
+            return std::ranges::find(frame, name) != frame.end();
+        });
+    }
+
+    // Global binding of `expr` if it is a symbol no lambda around binds, nullptr if not
+    std::shared_ptr<Object> GetGlobal(const std::shared_ptr<Object>& expr) const {
+        if (!IsGlobalSymbol(expr) || IsLocal(AsPtr<Symbol>(expr)->GetId())) {
+            return nullptr;
+        }
+        std::shared_ptr<Object>* binding = globals_->Find(AsPtr<Symbol>(expr)->GetId());
+        return binding ? *binding : nullptr;
+    }
+
+    // A global name without a binding yet, like the name of the function a define calls
+    // recursively. It is taken for a procedure, which the guard checks.
+    bool IsUnbound(const std::shared_ptr<Object>& expr) const {
+        return IsGlobalSymbol(expr) && !IsLocal(AsPtr<Symbol>(expr)->GetId()) &&
+               !globals_->Find(AsPtr<Symbol>(expr)->GetId());
+    }
+
+    // A local variable nothing set!s, which can be put in place of a parameter
+    bool IsStableLocal(const std::shared_ptr<Object>& expr) const {
+        return IsGlobalSymbol(expr) && IsLocal(AsPtr<Symbol>(expr)->GetId()) &&
+               !assigned_.contains(AsPtr<Symbol>(expr)->GetId());
+    }
+
+    void CollectAssigned(const std::shared_ptr<Object>& form) {
+        std::vector<const Cell*> todo;
+        if (Is<Cell>(form)) {
+            todo.push_back(AsPtr<Cell>(form));
+        }
+        while (!todo.empty()) {
+            const Cell* cell = todo.back();
+            todo.pop_back();
+            if (IsGlobalSymbol(cell->GetFirst()) && Is<Cell>(cell->GetSecond())) {
+                std::shared_ptr<Object>* head =
+                    globals_->Find(AsPtr<Symbol>(cell->GetFirst())->GetId());
+                const std::shared_ptr<Object>& name = AsPtr<Cell>(cell->GetSecond())->GetFirst();
+                if (head && GetSpecialForm(*head) == SpecialForm::kSet && Is<Symbol>(name)) {
+                    assigned_.insert(AsPtr<Symbol>(name)->GetId());
+                }
+            }
+            for (auto* child : {&cell->GetFirst(), &cell->GetSecond()}) {
+                if (Is<Cell>(*child)) {
+                    todo.push_back(AsPtr<Cell>(*child));
+                }
+            }
+        }
+    }
+
+    Rewritten Rewrite(const std::shared_ptr<Object>& expr) {
+        if (!Is<Cell>(expr)) {
+            return {expr, {}};
+        }
+        std::optional<ObjectVector> items = ProperList2Vector(expr);
+        if (!items || GetSpecialForm(items->front()) == SpecialForm::kGuard) {
+            return {expr, {}};
+        }
+        std::shared_ptr<Object> head = GetGlobal(items->front());
+        switch (GetSpecialForm(head)) {
+            case SpecialForm::kQuote:
+            case SpecialForm::kGuard:
+                return {expr, {}};
+            case SpecialForm::kIf:
+                return RewriteIf(expr, *items, head);
+            case SpecialForm::kAnd:
+            case SpecialForm::kOr:
+                return {RewriteArgs(expr, *items, 1), {}};
+            case SpecialForm::kSet:
+                return {RewriteArgs(expr, *items, 2), {}};
+            case SpecialForm::kDefine:
+                return {RewriteDefine(expr, *items), {}};
+            case SpecialForm::kLambda:
+                return {RewriteLambda(expr, *items), {}};
+            case SpecialForm::kNone:
+                break;
+        }
+        return RewriteCall(expr, *items, head);
+    }
+
+    // `form` with the items from `from` on rewritten each in a guard of its own
+    std::shared_ptr<Object> RewriteArgs(const std::shared_ptr<Object>& form,
+                                        const ObjectVector& items, size_t from) {
+        ObjectVector rewritten = items;
+        for (size_t i = from; i < items.size(); ++i) {
+            rewritten[i] = Guard(Rewrite(items[i]), items[i]);
+        }
+        return Rebuild(form, items, rewritten);
+    }
+
+    // Rewrites the body, starting at items[from], of a lambda taking `args`
+    std::shared_ptr<Object> RewriteBody(const std::shared_ptr<Object>& form,
+                                        const ObjectVector& items, size_t from,
+                                        const SlotNames& args) {
+        ObjectVector body(items.begin() + from, items.end());
+        frames_.push_back(CollectFrameNames(args, body));
+        std::shared_ptr<Object> res = RewriteArgs(form, items, from);
+        frames_.pop_back();
+        return res;
+    }
+
+    std::shared_ptr<Object> RewriteLambda(const std::shared_ptr<Object>& form,
+                                          const ObjectVector& items) {
+        if (items.size() < 3) {
+            return form;
+        }
+        std::optional<ObjectVector> names = ProperList2Vector(items[1]);
+        std::optional<SlotNames> args = names ? Symbols2SlotNames(*names) : std::nullopt;
+        return args ? RewriteBody(form, items, 2, *args) : form;
+    }
+
+    std::shared_ptr<Object> RewriteDefine(const std::shared_ptr<Object>& form,
+                                          const ObjectVector& items) {
+        if (items.size() < 3) {
+            return form;
+        }
+        if (!Is<Cell>(items[1])) {
+            return RewriteArgs(form, items, 2);
+        }
+        std::optional<ObjectVector> names = ProperList2Vector(items[1]);
+        if (!names || !Is<Symbol>(names->front())) {
+            return form;
+        }
+        names->erase(names->begin());
+        std::optional<SlotNames> args = Symbols2SlotNames(*names);
+        return args ? RewriteBody(form, items, 2, *args) : form;
+    }
+
+    Rewritten RewriteIf(const std::shared_ptr<Object>& form, const ObjectVector& items,
+                        const std::shared_ptr<Object>& head) {
+        if (items.size() != 3 && items.size() != 4) {
+            return {form, {}};
+        }
+        Rewritten condition = Rewrite(items[1]);
+        if (passes_.prune_branches && Is<Boolean>(condition.expr) &&
+            (IsTrue(condition.expr) || items.size() == 4)) {
+            Rewritten res = Rewrite(items[IsTrue(condition.expr) ? 2 : 3]);
+            Assumptions assumptions = {{items.front(), head}};
+            Merge(&assumptions, condition.assumptions);
+            Merge(&assumptions, res.assumptions);
+            stats_->pruned++;
+            return {res.expr, std::move(assumptions)};
+        }
+        ObjectVector rewritten = items;
+        rewritten[1] = Guard(condition, items[1]);
+        for (size_t i = 2; i < items.size(); ++i) {
+            rewritten[i] = Guard(Rewrite(items[i]), items[i]);
+        }
+        return {Rebuild(form, items, rewritten), {}};
+    }
+
+    // A call of `head`, the global binding of items[0] if it has one
+    Rewritten RewriteCall(const std::shared_ptr<Object>& form, const ObjectVector& items,
+                          const std::shared_ptr<Object>& head) {
+        if (!EvaluatesArgs(head) && !IsUnbound(items.front())) {
+            // the builtins like list and not that get their arguments as they are written
+            // only see the constants as they would be evaluated
+            if (head && passes_.fold_constants && pure_.contains(head.get())) {
+                std::vector<Rewritten> args;
+                for (size_t i = 1; i < items.size(); ++i) {
+                    args.push_back({items[i], {}});
+                }
+                if (std::optional<Rewritten> res = Fold(items.front(), head, args)) {
+                    stats_->folded++;
+                    return std::move(*res);
+                }
+            }
+            ObjectVector rewritten = items;
+            if (!head) {
+                rewritten[0] = Guard(Rewrite(items[0]), items[0]);
+            }
+            return {Rebuild(form, items, rewritten), {}};
+        }
+        std::vector<Rewritten> args;
+        for (size_t i = 1; i < items.size(); ++i) {
+            args.push_back(Rewrite(items[i]));
+        }
+        if (passes_.fold_constants && pure_.contains(head.get())) {
+            if (std::optional<Rewritten> res = Fold(items.front(), head, args)) {
+                stats_->folded++;
+                return std::move(*res);
+            }
+        }
+        if (Is<LambdaFunctor>(head) && passes_.inline_lambdas) {
+            if (std::optional<Rewritten> res = Inline(items.front(), head, args)) {
+                stats_->inlined++;
+                return std::move(*res);
+            }
+        }
+        ObjectVector rewritten = items;
+        for (size_t i = 1; i < items.size(); ++i) {
+            rewritten[i] = Guard(args[i - 1], items[i]);
+        }
+        if (rewritten == items) {
+            return {form, {}};
+        }
+        // the arguments are rewritten as long as `head` evaluates them, or for an unbound
+        // name, whatever it is bound to by the time of the call
+        return {MakeForm(rewritten, form), {{items.front(), head ? head : guard_}}};
+    }
+
+    std::optional<Rewritten> Fold(const std::shared_ptr<Object>& name,
+                                  const std::shared_ptr<Object>& head,
+                                  const std::vector<Rewritten>& args) const {
+        Assumptions assumptions = {{name, head}};
+        ObjectVector values;
+        for (const auto& arg : args) {
+            if (!IsConstant(arg.expr)) {
+                return std::nullopt;
+            }
+            values.push_back(arg.expr);
+            Merge(&assumptions, arg.assumptions);
+        }
+        std::shared_ptr<Object> value;
+        try {
+            value = AsPtr<IFunctor>(head)->Calc(values, globals_);
+        } catch (const std::exception&) {
+            return std::nullopt;  // the error is left to the run
+        }
+        if (!IsConstant(value)) {
+            return std::nullopt;
+        }
+        return Rewritten{std::move(value), std::move(assumptions)};
+    }
+
+    std::optional<Rewritten> Inline(const std::shared_ptr<Object>& name,
+                                    const std::shared_ptr<Object>& head,
+                                    const std::vector<Rewritten>& args) {
+        const LambdaFunctor* lambda = AsPtr<LambdaFunctor>(head);
+        const LambdaPrototype& prototype = *lambda->GetPrototype();
+        if (inline_depth_ == kMaxInlineDepth || lambda->GetParentScope() != globals_ ||
+            prototype.body.size() != 1 || prototype.frame->size() != prototype.args.size() ||
+            args.size() != prototype.args.size()) {
+            return std::nullopt;
+        }
+        Assumptions assumptions = {{name, head}};
+        ObjectVector values;
+        for (const auto& arg : args) {
+            if (!IsConstant(arg.expr) && !IsStableLocal(arg.expr)) {
+                return std::nullopt;
+            }
+            values.push_back(arg.expr);
+            Merge(&assumptions, arg.assumptions);
+        }
+        size_t cells = 0;
+        if (!CanInline(prototype.body.front(), head, &cells, &assumptions)) {
+            return std::nullopt;
+        }
+        ++inline_depth_;
+        Rewritten body = Rewrite(Substitute(prototype.body.front(), values));
+        --inline_depth_;
+        Merge(&assumptions, body.assumptions);
+        return Rewritten{std::move(body.expr), std::move(assumptions)};
+    }
+
+    // Whether the resolved body `expr` of `lambda` can be put in place of a call: it is small,
+    // doesn't bind or set! variables or refer to the lambda, the lambdas around the call don't
+    // bind the names it refers to, and the functions it calls evaluate their arguments. Adds
+    // the bindings of the functions called to `assumptions`.
+    bool CanInline(const std::shared_ptr<Object>& expr, const std::shared_ptr<Object>& lambda,
+                   size_t* cells, Assumptions* assumptions) const {
+        if (Is<LocalSymbol>(expr)) {
+            return AsPtr<LocalSymbol>(expr)->GetDepth() == 0;
+        }
+        if (IsGlobalSymbol(expr)) {
+            SymbolId name = AsPtr<Symbol>(expr)->GetId();
+            std::shared_ptr<Object>* binding = globals_->Find(name);
+            return !IsLocal(name) && (!binding || *binding != lambda);
+        }
+        if (!Is<Cell>(expr)) {
+            return true;
+        }
+        std::optional<ObjectVector> items = ProperList2Vector(expr);
+        if (!items) {
+            return false;
+        }
+        auto can_inline = [&](const std::shared_ptr<Object>& item) {
+            return ++*cells <= kMaxInlineCells && CanInline(item, lambda, cells, assumptions);
+        };
+        if (GetSpecialForm(items->front()) == SpecialForm::kGuard) {
+            // a guard of the body itself: the bindings it checks are in its forms too
+            return items->size() == 4 && can_inline((*items)[2]) && can_inline((*items)[3]);
+        }
+        std::shared_ptr<Object> head = GetGlobal(items->front());
+        switch (GetSpecialForm(head)) {
+            case SpecialForm::kQuote:
+                return true;
+            case SpecialForm::kIf:
+            case SpecialForm::kAnd:
+            case SpecialForm::kOr:
+                break;
+            case SpecialForm::kNone:
+                if (!EvaluatesArgs(head)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+        Merge(assumptions, {{items->front(), head}});
+        return std::ranges::all_of(*items, can_inline);
+    }
+
+    // Copy of the body `expr` with the parameters replaced by `values`
+    std::shared_ptr<Object> Substitute(const std::shared_ptr<Object>& expr,
+                                       const ObjectVector& values) const {
+        if (Is<LocalSymbol>(expr)) {
+            return values[AsPtr<LocalSymbol>(expr)->GetSlot()];
+        }
+        if (!Is<Cell>(expr)) {
+            return expr;
+        }
+        ObjectVector items = *ProperList2Vector(expr);
+        if (GetSpecialForm(GetGlobal(items.front())) == SpecialForm::kQuote) {
+            return expr;
+        }
+        for (auto& item : items) {
+            item = Substitute(item, values);
+        }
+        return MakeForm(items, expr);
+    }
+};
+
+}  // namespace
+
+Optimizer::Optimizer(OptimizerPasses passes, const BuiltinTable& builtins) : passes_(passes) {
+    for (const char* name : {"+", "-", "*", "/", "abs", "max", "min", "<", ">", "=", "<=", ">=",
+                             "number?", "boolean?", "not"}) {
+        pure_.insert(builtins.at(Symbol::Intern(name)->GetId()).get());
+    }
+    guard_ = builtins.at(Symbol::Intern("#guard")->GetId());
+}
+
+std::shared_ptr<Object> Optimizer::Optimize(const std::shared_ptr<Object>& form,
+                                            const std::shared_ptr<Scope>& globals) {
+    return Rewriter(passes_, pure_, guard_, globals, &stats_).RewriteForm(form);
+}
+
+const OptimizerStats& Optimizer::GetStats() const {
+    return stats_;
+}
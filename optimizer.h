@@ -0,0 +1,58 @@
+#pragma once
+
+#include "object.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+
+// Rewrites the forms run by the interpreter before they are evaluated, see
+// Interpreter::EnableOptimizer. The passes:
+// - constant folding: a call of a pure builtin (arithmetic, comparisons, not, number?,
+//   boolean?) with numbers and booleans for arguments becomes its value
+// - dead branches: an if with a constant condition becomes the branch it takes
+// - inlining: a call of a small lambda defined at the top level becomes its body with the
+//   arguments put in place of the parameters. The body must be a single expression that
+//   doesn't bind or set! variables or call the lambda itself, the arguments must be
+//   constants or local variables nothing set!s.
+//
+// A rewrite relies on the names it looked up staying bound to what they were: the builtin,
+// the if, the lambda. So it is wrapped in a guard (see GuardFunctor) that runs the original
+// expression instead once any of them is bound to something else, by define or set!. The
+// guard is checked where the original expression would look the names up, so a builtin
+// redefined halfway through a form is noticed too.
+//
+// The arguments of a call are rewritten only when the function called evaluates them: a
+// builtin like list gets them as they are written. A global name that isn't bound yet when
+// the form is optimized, like a function calling itself in its define, is taken for a
+// procedure: the guard of the call checks that it is unbound or bound to a function
+// evaluating its arguments.
+
+struct OptimizerPasses {
+    bool fold_constants = true;
+    bool prune_branches = true;
+    bool inline_lambdas = true;
+};
+
+// Number of times each pass rewrote something
+struct OptimizerStats {
+    uint64_t folded = 0;
+    uint64_t pruned = 0;
+    uint64_t inlined = 0;
+};
+
+class Optimizer {
+public:
+    Optimizer(OptimizerPasses passes, const BuiltinTable& builtins);
+
+    // Rewrite of `form`, evaluated in the global scope `globals`. The form isn't changed.
+    std::shared_ptr<Object> Optimize(const std::shared_ptr<Object>& form,
+                                     const std::shared_ptr<Scope>& globals);
+
+    const OptimizerStats& GetStats() const;
+
+private:
+    OptimizerPasses passes_;
+    std::unordered_set<const Object*> pure_;  // the builtins that can be folded
+    std::shared_ptr<Object> guard_;
+    OptimizerStats stats_;
+};
@@ -1,109 +1,175 @@
 #include <parser.h>
+#include <string>
 #include <vector>
 #include "error.h"
 
+namespace {
+
 enum DotInfo { kNoDots, kWasDot, kAfterDot };
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("No tokens");
-    }
-    std::shared_ptr<Cell> res(new Cell);
-    std::shared_ptr<Cell> cur(res);
+// A list being read or a quote waiting for its datum
+struct Frame {
+    bool quote = false;
+    std::shared_ptr<Cell> head;  // nullptr while the list is empty
+    Cell* tail = nullptr;
     DotInfo dot_info = kNoDots;
-    bool non_empty_cell = false;
+    SourceLocation location;  // of the open bracket, given to the head
+};
 
-    while (true) {
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError("Unexpected EOF");
-        }
-        if (IsTokenT<BracketToken>(tokenizer->GetToken()) &&
-            std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE) {
-            tokenizer->Next();
-            break;
-        }
-        if (dot_info == kAfterDot) {
-            throw SyntaxError("smth after dot twice");
-        }
-        if (IsTokenT<DotToken>(tokenizer->GetToken())) {
-            if (!cur->GetFirst()) {
-                throw SyntaxError("bad dots (1)");
-            }
-            tokenizer->Next();
-            dot_info = kWasDot;
-            continue;
-        }
-        if (dot_info == kWasDot) {
-            dot_info = kAfterDot;
-            cur->SetSecond(Read(tokenizer));
-        } else {
-            if (non_empty_cell) {
-                std::shared_ptr<Cell> next(new Cell);
-                cur->SetSecond(next);
-                cur = next;
-            }
-            cur->SetFirst(Read(tokenizer));
-        }
-        non_empty_cell = true;
-    }
-    if (dot_info == kWasDot) {
-        throw SyntaxError("nothing after a dot");
-    }
-    if (!non_empty_cell) {
-        return nullptr;
-    }
+std::shared_ptr<Object> MakeQuote(std::shared_ptr<Object> obj) {
+    static const std::shared_ptr<Symbol> kQuote = Symbol::Intern("quote");
+    std::shared_ptr<Cell> res = Make<Cell>();
+    std::shared_ptr<Cell> tmp = Make<Cell>();
+    tmp->SetFirst(std::move(obj));
+    res->SetFirst(kQuote);
+    res->SetSecond(tmp);
     return res;
 }
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("No tokens");
-    }
-    Token cur_token = tokenizer->GetToken();
+// A datum that is a single token
+std::shared_ptr<Object> ReadAtom(Tokenizer* tokenizer) {
+    const Token& cur_token = tokenizer->GetToken();
     if (IsTokenT<BracketToken>(cur_token)) {
-        if (std::get<BracketToken>(tokenizer->GetToken()) == BracketToken::CLOSE) {
-            throw SyntaxError("unexpected close bracket");
-        }
-        tokenizer->Next();
-        return ReadList(tokenizer);
+        throw SyntaxError("unexpected close bracket");
     }
     if (IsTokenT<ConstantToken>(cur_token)) {
-        int value = std::get<ConstantToken>(cur_token).value;
+        int64_t value = std::get<ConstantToken>(cur_token).value;
+        tokenizer->Next();
+        return Number::FromValue(value);
+    }
+    if (IsTokenT<BigConstantToken>(cur_token)) {
+        std::shared_ptr<Object> res = Make<BigNumber>(std::get<BigConstantToken>(cur_token).value);
+        tokenizer->Next();
+        return res;
+    }
+    if (IsTokenT<StringToken>(cur_token)) {
+        std::shared_ptr<Object> res = Make<String>(Rope(std::get<StringToken>(cur_token).value));
+        tokenizer->Next();
+        return res;
+    }
+    if (IsTokenT<CharToken>(cur_token)) {
+        char value = std::get<CharToken>(cur_token).value;
         tokenizer->Next();
-        return std::shared_ptr<Object>(new Number(value));
+        return Character::FromValue(value);
     }
     if (IsTokenT<SymbolToken>(cur_token)) {
-        std::string symbol = std::get<SymbolToken>(cur_token).name;
-        if (symbol.starts_with('#')) {
-            if (symbol.size() < 2) {
+        std::shared_ptr<Symbol> symbol = std::get<SymbolToken>(cur_token).symbol;
+        const std::string& name = symbol->GetName();
+        if (name.starts_with('#')) {
+            if (name.size() < 2) {
                 throw SyntaxError("nothing after #");
-            } else if (symbol[1] == 't') {
+            } else if (name[1] == 't') {
                 tokenizer->Next();
-                return std::shared_ptr<Object>(new Boolean(true));
-            } else if (symbol[1] == 'f') {
+                return Boolean::FromValue(true);
+            } else if (name[1] == 'f') {
                 tokenizer->Next();
-                return std::shared_ptr<Object>(new Boolean(false));
+                return Boolean::FromValue(false);
             } else {
-                throw SyntaxError(std::string("illegal symbol: ") + symbol);
+                throw SyntaxError(std::string("illegal symbol: ") + name);
             }
         }
         tokenizer->Next();
-        return std::shared_ptr<Object>(new Symbol(symbol));
+        return symbol;
     }
     if (IsTokenT<DotToken>(cur_token)) {
         throw SyntaxError("unexpected dot");
     }
-    if (IsTokenT<QuoteToken>(cur_token)) {
-        tokenizer->Next();
-        std::shared_ptr<Object> quote_obj = Read(tokenizer);
-        std::shared_ptr<Object> res(new Cell);
-        As<Cell>(res)->SetFirst(std::shared_ptr<Object>(new Symbol("quote")));
-        std::shared_ptr<Object> tmp(new Cell);
+    throw SyntaxError("shit happened");
+}
 
-        As<Cell>(tmp)->SetFirst(quote_obj);
-        As<Cell>(tmp)->SetSecond(nullptr);
-        As<Cell>(res)->SetSecond(tmp);
-        return res;
+// Reads a datum, or the rest of a list if `stack` starts with one. Nested lists and
+// quotes go to `stack` instead of the native one, the elements are appended to the
+// innermost list as they are read.
+std::shared_ptr<Object> ReadWithStack(Tokenizer* tokenizer, std::vector<Frame> stack,
+                                      size_t max_nesting) {
+    while (true) {
+        std::shared_ptr<Object> datum;
+        bool closed = false;  // `datum` is a list just read, nullptr if it's empty
+        if (!stack.empty() && !stack.back().quote) {
+            Frame& list = stack.back();
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("Unexpected EOF");
+            }
+            const Token& token = tokenizer->GetToken();
+            if (IsTokenT<BracketToken>(token) &&
+                std::get<BracketToken>(token) == BracketToken::CLOSE) {
+                if (list.dot_info == kWasDot) {
+                    throw SyntaxError("nothing after a dot");
+                }
+                tokenizer->Next();
+                datum = std::move(list.head);
+                stack.pop_back();
+                closed = true;
+            } else if (list.dot_info == kAfterDot) {
+                throw SyntaxError("smth after dot twice");
+            } else if (IsTokenT<DotToken>(token)) {
+                if (!list.head || list.dot_info == kWasDot) {
+                    throw SyntaxError("bad dots (1)");
+                }
+                tokenizer->Next();
+                list.dot_info = kWasDot;
+                continue;
+            }
+        }
+        if (!closed) {
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("No tokens");
+            }
+            const Token& token = tokenizer->GetToken();
+            bool open = IsTokenT<BracketToken>(token) &&
+                        std::get<BracketToken>(token) == BracketToken::OPEN;
+            if (open || IsTokenT<QuoteToken>(token)) {
+                if (stack.size() >= max_nesting) {
+                    throw SyntaxError("nesting is deeper than " + std::to_string(max_nesting));
+                }
+                SourceLocation location = tokenizer->GetLocation();
+                tokenizer->Next();
+                stack.push_back({.quote = !open, .head = nullptr, .location = location});
+                continue;
+            }
+            datum = ReadAtom(tokenizer);
+        }
+        // hand the datum to the enclosing quotes and the innermost list
+        while (true) {
+            if (stack.empty()) {
+                return datum;
+            }
+            Frame& top = stack.back();
+            if (top.quote) {
+                datum = MakeQuote(std::move(datum));
+                stack.pop_back();
+                continue;
+            }
+            if (top.dot_info == kWasDot) {
+                top.dot_info = kAfterDot;
+                top.tail->SetSecond(std::move(datum));
+            } else {
+                std::shared_ptr<Cell> cell = Make<Cell>();
+                cell->SetFirst(std::move(datum));
+                Cell* next = cell.get();
+                if (top.head) {
+                    top.tail->SetSecond(std::move(cell));
+                } else {
+                    next->SetLocation(top.location);
+                    top.head = std::move(cell);
+                }
+                top.tail = next;
+            }
+            break;
+        }
     }
-    throw SyntaxError("shit happened");
+}
+
+}  // namespace
+
+std::shared_ptr<Object> ReadList(Tokenizer* tokenizer, size_t max_nesting) {
+    if (tokenizer->IsEnd()) {
+        throw SyntaxError("No tokens");
+    }
+    std::vector<Frame> stack(1);
+    return ReadWithStack(tokenizer, std::move(stack), max_nesting);
+}
+
+std::shared_ptr<Object> Read(Tokenizer* tokenizer, size_t max_nesting) {
+    return ReadWithStack(tokenizer, {}, max_nesting);
 }
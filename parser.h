@@ -1,10 +1,16 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
 
 #include "object.h"
 #include <tokenizer.h>
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer);
+// Nested lists and quotes are read with a stack on the heap, so the depth is bounded by
+// `max_nesting` rather than by the native stack. Deeper input is a SyntaxError.
+constexpr size_t kDefaultMaxNesting = 10000;
 
-std::shared_ptr<Object> ReadList(Tokenizer* tokenizer);
+std::shared_ptr<Object> Read(Tokenizer* tokenizer, size_t max_nesting = kDefaultMaxNesting);
+
+// The rest of a list whose open bracket was already read
+std::shared_ptr<Object> ReadList(Tokenizer* tokenizer, size_t max_nesting = kDefaultMaxNesting);
@@ -0,0 +1,108 @@
+#include "pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        threads_.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::GetThreads() const {
+    return threads_.size();
+}
+
+void ThreadPool::Run(size_t count, const std::function<void(size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    std::lock_guard run_lock(run_mutex_);
+    // contiguous ranges of about the same size, the stealing evens out the rest
+    size_t threads = threads_.size();
+    for (size_t i = 0; i < threads; i++) {
+        std::lock_guard lock(queues_[i]->mutex);
+        queues_[i]->begin = count * i / threads;
+        queues_[i]->end = count * (i + 1) / threads;
+    }
+    std::unique_lock lock(mutex_);
+    body_ = &body;
+    finished_ = 0;
+    batch_++;
+    start_.notify_all();
+    // every thread has to see the batch: one that is late must not find the next one's
+    // tasks with this one's body
+    finish_.wait(lock, [this, threads] { return finished_ == threads; });
+    body_ = nullptr;
+}
+
+void ThreadPool::Work(size_t index) {
+    size_t seen = 0;
+    while (true) {
+        const std::function<void(size_t)>* body;
+        {
+            std::unique_lock lock(mutex_);
+            start_.wait(lock, [this, seen] { return stop_ || batch_ != seen; });
+            if (stop_) {
+                return;
+            }
+            seen = batch_;
+            body = body_;
+        }
+        size_t task;
+        while (Take(index, &task)) {
+            (*body)(task);
+        }
+        std::lock_guard lock(mutex_);
+        if (++finished_ == threads_.size()) {
+            finish_.notify_one();
+        }
+    }
+}
+
+bool ThreadPool::Take(size_t index, size_t* task) {
+    Queue& own = *queues_[index];
+    {
+        std::lock_guard lock(own.mutex);
+        if (own.begin < own.end) {
+            *task = own.begin++;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+        Queue& victim = *queues_[(index + i) % queues_.size()];
+        size_t begin;
+        size_t end;
+        {
+            std::lock_guard lock(victim.mutex);
+            if (victim.begin == victim.end) {
+                continue;
+            }
+            begin = victim.begin + (victim.end - victim.begin) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        // the own range is empty, no one steals from it in the meantime
+        std::lock_guard lock(own.mutex);
+        *task = begin;
+        own.begin = begin + 1;
+        own.end = end;
+        return true;
+    }
+    return false;
+}
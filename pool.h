@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running batches of independent tasks. Each thread has a range of
+// the task indices of its own and takes them from the front; once it runs out, it steals
+// the back half of the range of another thread. So the threads share the work out even
+// when the tasks take very different time, and mostly touch only their own range.
+class ThreadPool {
+public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    size_t GetThreads() const;
+
+    // Calls `body` with every index below `count` on the pool threads and waits until all
+    // of them are done. `body` must not throw. Batches from several threads run one after
+    // another; a batch must not be started from a task.
+    void Run(size_t count, const std::function<void(size_t)>& body);
+
+private:
+    // Tasks not taken yet from the range of one thread
+    struct Queue {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;  // one batch at a time
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable finish_;
+    const std::function<void(size_t)>* body_ = nullptr;
+    size_t batch_ = 0;     // number of batches started
+    size_t finished_ = 0;  // threads done with the current batch
+    bool stop_ = false;
+
+    void Work(size_t index);
+
+    // Takes a task for the thread `index`, false if there are none left anywhere
+    bool Take(size_t index, size_t* task);
+};
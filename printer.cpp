@@ -0,0 +1,137 @@
+#include "printer.h"
+#include <charconv>
+#include <vector>
+
+namespace {
+
+constexpr size_t kChunkSize = 1 << 16;
+
+class Printer {
+public:
+    // Output goes to `buffer`, which is flushed to `stream` once it grows big if a stream
+    // is given
+    Printer(std::string* buffer, std::ostream* stream) : buffer_(buffer), stream_(stream) {
+    }
+
+    void Run(const Object* root) {
+        Open(root);
+        while (!stack_.empty()) {
+            Step();
+            if (stream_ && buffer_->size() >= kChunkSize) {
+                Flush();
+            }
+        }
+        if (stream_) {
+            Flush();
+        }
+    }
+
+private:
+    // A list being printed, `obj` is its current cell
+    enum CellState : size_t { kFirst, kRest, kClose };
+
+    // `index` is a CellState for lists, the next element for vectors
+    struct Frame {
+        const Object* obj;
+        size_t index;
+    };
+
+    std::string* buffer_;
+    std::ostream* stream_;
+    std::vector<Frame> stack_;
+
+    void Flush() {
+        stream_->write(buffer_->data(), buffer_->size());
+        buffer_->clear();
+    }
+
+    // Prints an atom or starts a list or a vector
+    void Open(const Object* obj) {
+        if (!obj) {
+            *buffer_ += "()";
+            return;
+        }
+        switch (obj->GetType()) {
+            case ObjectType::kCell:
+                *buffer_ += '(';
+                stack_.push_back({obj, kFirst});
+                break;
+            case ObjectType::kVector:
+                *buffer_ += "#(";
+                stack_.push_back({obj, 0});
+                break;
+            case ObjectType::kNumber: {
+                char digits[24];
+                auto res = std::to_chars(digits, std::end(digits),
+                                         static_cast<const Number*>(obj)->GetValue());
+                buffer_->append(digits, res.ptr);
+                break;
+            }
+            case ObjectType::kSymbol:
+            case ObjectType::kLocalSymbol:
+                *buffer_ += static_cast<const Symbol*>(obj)->GetName();
+                break;
+            case ObjectType::kBoolean:
+                *buffer_ += static_cast<const Boolean*>(obj)->GetValue() ? "#t" : "#f";
+                break;
+            default:
+                *buffer_ += obj->Serialize();
+        }
+    }
+
+    // Continues the innermost list or vector. `top` is not used after Open, which may
+    // push a frame.
+    void Step() {
+        Frame& top = stack_.back();
+        if (top.obj->GetType() == ObjectType::kVector) {
+            const ObjectVector& elements = static_cast<const Vector*>(top.obj)->GetElements();
+            if (top.index == elements.size()) {
+                *buffer_ += ')';
+                stack_.pop_back();
+                return;
+            }
+            if (top.index > 0) {
+                *buffer_ += ' ';
+            }
+            Open(elements[top.index++].get());
+            return;
+        }
+        const Cell* cell = static_cast<const Cell*>(top.obj);
+        switch (top.index) {
+            case kFirst:
+                top.index = kRest;
+                Open(cell->GetFirst().get());
+                return;
+            case kRest: {
+                const Object* next = cell->GetSecond().get();
+                if (!next) {
+                    *buffer_ += ')';
+                    stack_.pop_back();
+                } else if (next->GetType() == ObjectType::kCell) {
+                    *buffer_ += ' ';
+                    top.obj = next;
+                    Open(static_cast<const Cell*>(next)->GetFirst().get());
+                } else {
+                    *buffer_ += " . ";
+                    top.index = kClose;
+                    Open(next);
+                }
+                return;
+            }
+            default:
+                *buffer_ += ')';
+                stack_.pop_back();
+        }
+    }
+};
+
+}  // namespace
+
+void Print(const Object* obj, std::string* out) {
+    Printer(out, nullptr).Run(obj);
+}
+
+void Print(const Object* obj, std::ostream* out) {
+    std::string buffer;
+    Printer(&buffer, out).Run(obj);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "object.h"
+#include <ostream>
+#include <string>
+
+// External representation of objects, what Serialize returns. Lists and vectors are
+// walked with an explicit stack, so printing is linear in the size of the output and
+// deep nesting doesn't overflow the native stack.
+
+// Appends the representation of `obj` to `out`, nullptr is the empty list
+void Print(const Object* obj, std::string* out);
+
+// Writes the representation of `obj` to `out` in chunks, without building all of it
+void Print(const Object* obj, std::ostream* out);
@@ -0,0 +1,256 @@
+#include "profiler.h"
+#include "functors.h"
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+// Call paths deeper than this are cut: the calls below are recorded as made by the
+// function at this depth. Recursion doesn't deepen the paths anyway.
+constexpr size_t kMaxPathDepth = 1024;
+
+size_t Combine(size_t seed, size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+}  // namespace
+
+constinit thread_local Profiler* Profiler::current = nullptr;
+
+bool Profiler::FunctionKey::operator==(const FunctionKey& other) const {
+    return id == other.id && lambda == other.lambda && location.line == other.location.line &&
+           location.column == other.location.column;
+}
+
+size_t Profiler::FunctionKeyHash::operator()(const FunctionKey& key) const {
+    size_t res = std::hash<const void*>()(key.id);
+    res = Combine(res, key.location.line);
+    return Combine(res, key.location.column);
+}
+
+bool Profiler::ChildKey::operator==(const ChildKey& other) const {
+    return parent == other.parent && function == other.function;
+}
+
+size_t Profiler::ChildKeyHash::operator()(const ChildKey& key) const {
+    return Combine(FunctionKeyHash()(key.function), key.parent);
+}
+
+Profiler::Profiler(ProfileMode mode, const BuiltinTable& builtins) : mode_(mode) {
+    for (auto& [name, functor] : builtins) {
+        builtin_names_.emplace(functor.get(), Symbol::FromId(name)->GetName());
+    }
+    nodes_.push_back({.function = kUnresolved, .parent = kRoot});
+}
+
+Profiler::FunctionKey Profiler::GetKey(const Object* functor) const {
+    if (functor->GetType() == ObjectType::kLambda) {
+        const LambdaOrigin& origin =
+            static_cast<const LambdaFunctor*>(functor)->GetPrototype()->origin;
+        return {origin.name.get(), origin.location, true};
+    }
+    return {functor, {}, false};
+}
+
+void Profiler::Push(const Object* functor) {
+    Account();
+    stack_.push_back({GetKey(functor), kUnresolved});
+    if (mode_ == ProfileMode::kExact) {
+        nodes_[Resolve(stack_.size() - 1)].calls++;
+    }
+}
+
+void Profiler::Replace(const Object* functor) {
+    Account();
+    stack_.back() = {GetKey(functor), kUnresolved};
+    resolved_ = std::min(resolved_, stack_.size() - 1);
+    if (mode_ == ProfileMode::kExact) {
+        nodes_[Resolve(stack_.size() - 1)].calls++;
+    }
+}
+
+void Profiler::PopTo(size_t depth) {
+    if (depth == stack_.size()) {
+        return;
+    }
+    Account();
+    stack_.resize(depth);
+    resolved_ = std::min(resolved_, depth);
+}
+
+uint64_t Profiler::Now() const {
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (mode_ == ProfileMode::kSampling) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        return now.tv_sec * uint64_t{1'000'000'000} + now.tv_nsec;
+    }
+#endif
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+void Profiler::Account() {
+    uint64_t now = Now();
+    if (now == last_) {
+        return;  // the coarse clock didn't tick, most calls see no tick
+    }
+    nodes_[stack_.empty() ? kRoot : Resolve(stack_.size() - 1)].self += now - last_;
+    last_ = now;
+}
+
+uint32_t Profiler::Resolve(size_t index) {
+    for (; resolved_ <= index; resolved_++) {
+        uint32_t parent =
+            resolved_ == 0 ? kRoot : stack_[std::min(resolved_, kMaxPathDepth) - 1].node;
+        stack_[resolved_].node = GetChild(parent, stack_[resolved_].function);
+    }
+    return stack_[index].node;
+}
+
+uint32_t Profiler::GetChild(uint32_t parent, const FunctionKey& function) {
+    auto [child, inserted] = children_.try_emplace({parent, function}, 0);
+    if (!inserted) {
+        return child->second;
+    }
+    auto [id, new_function] = function_ids_.try_emplace(function, function_names_.size());
+    if (new_function) {
+        std::string name;
+        if (!function.lambda) {
+            auto builtin = builtin_names_.find(static_cast<const Object*>(function.id));
+            name = builtin != builtin_names_.end() ? builtin->second : "builtin";
+        } else {
+            name = function.id ? static_cast<const Symbol*>(function.id)->GetName() : "lambda";
+            if (function.location.line) {
+                name += ":" + std::to_string(function.location.line) + ":" +
+                        std::to_string(function.location.column);
+            }
+        }
+        function_names_.push_back(std::move(name));
+    }
+    // a recursive call goes back to the node of the outer call of the function
+    for (uint32_t node = parent; node != kRoot; node = nodes_[node].parent) {
+        if (nodes_[node].function == id->second) {
+            child->second = node;
+            return node;
+        }
+    }
+    child->second = nodes_.size();
+    nodes_.push_back({.function = id->second, .parent = parent});
+    return child->second;
+}
+
+void Profiler::Resume() {
+    resumed_ = std::chrono::steady_clock::now();
+    last_ = Now();
+}
+
+void Profiler::Pause() {
+    Account();
+    profiled_ += std::chrono::steady_clock::now() - resumed_;
+}
+
+Profile Profiler::GetProfile() const {
+    Profile res;
+    res.total = profiled_;
+    std::vector<FunctionProfile> functions(function_names_.size());
+    for (size_t i = 0; i < functions.size(); i++) {
+        functions[i].name = function_names_[i];
+    }
+    // a node is created after its parent, so the children come first from the end
+    std::vector<uint64_t> totals(nodes_.size());
+    std::vector<std::vector<uint32_t>> children(nodes_.size());
+    for (size_t i = nodes_.size() - 1; i > kRoot; i--) {
+        const Node& node = nodes_[i];
+        totals[i] += node.self;
+        totals[node.parent] += totals[i];
+        children[node.parent].push_back(i);
+        functions[node.function].calls += node.calls;
+        functions[node.function].exclusive += std::chrono::nanoseconds(node.self);
+    }
+    // the inclusive time of a function is the total of its outermost nodes, the paths are
+    // made while walking down the tree
+    std::vector<uint32_t> active(functions.size());
+    std::string path;
+    std::vector<size_t> path_sizes;
+    std::vector<std::pair<uint32_t, bool>> todo = {{kRoot, false}};  // node, leaving it
+    while (!todo.empty()) {
+        auto [index, leaving] = todo.back();
+        todo.pop_back();
+        const Node& node = nodes_[index];
+        if (leaving) {
+            active[node.function]--;
+            path.resize(path_sizes.back());
+            path_sizes.pop_back();
+            continue;
+        }
+        if (index != kRoot) {
+            if (active[node.function]++ == 0) {
+                functions[node.function].inclusive +=
+                    std::chrono::nanoseconds(totals[index]);
+            }
+            path_sizes.push_back(path.size());
+            if (!path.empty()) {
+                path += ';';
+            }
+            path += function_names_[node.function];
+            if (node.self) {
+                res.paths.emplace_back(path, std::chrono::nanoseconds(node.self));
+            }
+            todo.push_back({index, true});
+        }
+        for (uint32_t child : children[index]) {
+            todo.push_back({child, false});
+        }
+    }
+    std::erase_if(functions, [](const FunctionProfile& function) {
+        return !function.calls && function.inclusive.count() == 0;
+    });
+    std::ranges::stable_sort(functions, std::greater<>(), &FunctionProfile::exclusive);
+    res.functions = std::move(functions);
+    return res;
+}
+
+std::string Profile::ToString() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "total " << std::chrono::duration<double, std::milli>(total).count() << " ms\n";
+    out << std::setw(12) << "calls" << std::setw(16) << "inclusive ms" << std::setw(16)
+        << "exclusive ms"
+        << "  function\n";
+    for (const FunctionProfile& function : functions) {
+        out << std::setw(12) << function.calls << std::setw(16)
+            << std::chrono::duration<double, std::milli>(function.inclusive).count()
+            << std::setw(16)
+            << std::chrono::duration<double, std::milli>(function.exclusive).count() << "  "
+            << function.name << "\n";
+    }
+    return out.str();
+}
+
+std::string Profile::ToFoldedStacks() const {
+    std::string res;
+    for (auto& [path, time] : paths) {
+        auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+        if (microseconds) {
+            res += path + " " + std::to_string(microseconds) + "\n";
+        }
+    }
+    return res;
+}
+
+ProfilerGuard::ProfilerGuard(Profiler* profiler) : previous_(Profiler::current) {
+    Profiler::current = profiler;
+    if (profiler) {
+        profiler->Resume();
+    }
+}
+
+ProfilerGuard::~ProfilerGuard() {
+    if (Profiler::current) {
+        Profiler::current->Pause();
+    }
+    Profiler::current = previous_;
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "object.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Profiler of the calls of lambdas and builtins, see Interpreter::StartProfiler.
+//
+// The engines report the calls they make to the profiler of their thread, which keeps a
+// shadow stack of them. A call in tail position replaces its caller where the engine
+// itself reuses the caller's frame, so loops don't grow the stack. The time between two
+// reports goes to the call on top of the stack and to its path of callers: in kExact mode
+// it is measured, in kSampling mode it is read from the coarse clock of the system, which
+// ticks every few milliseconds, and the path is only looked up when it ticked. That saves
+// most of the slowdown of a profiled program, but calls aren't counted. (A thread ticking
+// a clock of its own would do without the system's, but once a process has started a
+// thread all the reference counts are updated atomically, which slows the engines down
+// twice as much.)
+//
+// Special forms are not calls, their time belongs to the function they are in. The builtins
+// of the tree walker evaluate their arguments themselves, so the calls made in the arguments
+// are made by the builtin there. A recursive call is counted in the outer call of the
+// function, which keeps the paths short. Lambdas are told apart by the name define bound
+// them to and their location in the source.
+
+enum class ProfileMode {
+    kExact,
+    kSampling,
+};
+
+// Totals of one function
+struct FunctionProfile {
+    // The name the lambda was defined with ("lambda" for an anonymous one) and the location
+    // of its parameters, like "fib:1:9", or the name of the builtin
+    std::string name;
+    uint64_t calls = 0;                     // 0 in kSampling mode
+    std::chrono::nanoseconds inclusive{0};  // with the calls it made, recursion counted once
+    std::chrono::nanoseconds exclusive{0};  // in the function itself
+};
+
+struct Profile {
+    std::vector<FunctionProfile> functions;  // by exclusive time, longest first
+    // Exclusive time of every call path that had any, the names of the functions on it
+    // joined by ';' from the outermost
+    std::vector<std::pair<std::string, std::chrono::nanoseconds>> paths;
+    std::chrono::nanoseconds total{0};  // profiled, in the calls and outside of them
+
+    // Table of the functions
+    std::string ToString() const;
+
+    // A line per path with the time in microseconds, the "folded stacks" flamegraph tools read
+    std::string ToFoldedStacks() const;
+};
+
+class Profiler {
+public:
+    Profiler(ProfileMode mode, const BuiltinTable& builtins);
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Profiler of the calling thread, nullptr if none (see ProfilerGuard)
+    static Profiler* Current() {
+        return current;
+    }
+
+    // The calls reported so far. The stack must be empty.
+    Profile GetProfile() const;
+
+    // Calls `functor` on top of the stack
+    void Push(const Object* functor);
+
+    // Replaces the call on top of the stack by a call of `functor`
+    void Replace(const Object* functor);
+
+    // Leaves the `depth` outermost calls on the stack
+    void PopTo(size_t depth);
+
+    size_t GetDepth() const {
+        return stack_.size();
+    }
+
+private:
+    // A lambda is identified by its name (the Symbol, nullptr if it has none) and location,
+    // a builtin by its functor
+    struct FunctionKey {
+        const void* id;
+        SourceLocation location;
+        bool lambda;
+
+        bool operator==(const FunctionKey& other) const;
+    };
+
+    struct FunctionKeyHash {
+        size_t operator()(const FunctionKey& key) const;
+    };
+
+    // Call path: a function called by the function of the parent node
+    struct Node {
+        uint32_t function;
+        uint32_t parent;
+        uint64_t calls = 0;
+        uint64_t self = 0;  // nanoseconds
+    };
+
+    struct ChildKey {
+        uint32_t parent;
+        FunctionKey function;
+
+        bool operator==(const ChildKey& other) const;
+    };
+
+    struct ChildKeyHash {
+        size_t operator()(const ChildKey& key) const;
+    };
+
+    struct Entry {
+        FunctionKey function;
+        uint32_t node;  // kUnresolved until it's needed in kSampling mode
+    };
+
+    static constexpr uint32_t kRoot = 0;
+    static constexpr uint32_t kUnresolved = UINT32_MAX;
+
+    static constinit thread_local Profiler* current;
+
+    ProfileMode mode_;
+    std::unordered_map<const Object*, std::string> builtin_names_;
+
+    std::vector<std::string> function_names_;
+    std::unordered_map<FunctionKey, uint32_t, FunctionKeyHash> function_ids_;
+    std::vector<Node> nodes_;
+    std::unordered_map<ChildKey, uint32_t, ChildKeyHash> children_;
+
+    std::vector<Entry> stack_;
+    size_t resolved_ = 0;  // the nodes of so many entries at the bottom are known
+
+    uint64_t last_ = 0;  // time of the previous report, in nanoseconds
+    std::chrono::steady_clock::time_point resumed_;
+    std::chrono::nanoseconds profiled_{0};
+
+    FunctionKey GetKey(const Object* functor) const;
+
+    // Nanoseconds from the clock of the mode
+    uint64_t Now() const;
+
+    // Node of the entry `index` of the stack, resolving the entries under it as well
+    uint32_t Resolve(size_t index);
+
+    uint32_t GetChild(uint32_t parent, const FunctionKey& function);
+
+    // Charges the time since the previous report to the call on top of the stack
+    void Account();
+
+    // Called when the thread starts and stops running code of the interpreter
+    void Resume();
+    void Pause();
+
+    friend class ProfilerGuard;
+};
+
+// Makes `profiler` (may be nullptr) the profiler of the calling thread during its lifetime,
+// the time before and after it isn't profiled
+class ProfilerGuard {
+public:
+    explicit ProfilerGuard(Profiler* profiler);
+
+    ProfilerGuard(const ProfilerGuard&) = delete;
+    ProfilerGuard& operator=(const ProfilerGuard&) = delete;
+
+    ~ProfilerGuard();
+
+private:
+    Profiler* previous_;
+};
+
+// Calls reported by one invocation of an engine loop, removed from the stack when it exits,
+// by an exception too. Does nothing if the thread has no profiler, so the engines pay only
+// for a check when profiling is off.
+class ProfileScope {
+public:
+    ProfileScope()
+        : profiler_(Profiler::Current()), base_(profiler_ ? profiler_->GetDepth() : 0) {
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope() {
+        if (profiler_ && profiler_->GetDepth() != base_) {
+            profiler_->PopTo(base_);
+        }
+    }
+
+    bool IsActive() const {
+        return profiler_;
+    }
+
+    // A call of `functor` made by the innermost one
+    void Call(const Object* functor) {
+        if (profiler_) {
+            profiler_->Push(functor);
+        }
+    }
+
+    // A call in tail position: replaces the innermost call if it was reported here
+    void TailCall(const Object* functor) {
+        if (profiler_) {
+            if (profiler_->GetDepth() > base_) {
+                profiler_->Replace(functor);
+            } else {
+                profiler_->Push(functor);
+            }
+        }
+    }
+
+    // The innermost call reported here returned
+    void Return() {
+        if (profiler_) {
+            profiler_->PopTo(profiler_->GetDepth() - 1);
+        }
+    }
+
+private:
+    Profiler* profiler_;
+    size_t base_;
+};
@@ -0,0 +1,149 @@
+#include "resolver.h"
+#include <algorithm>
+#include <optional>
+
+namespace {
+
+const SymbolId kQuote = Symbol::Intern("quote")->GetId();
+const SymbolId kLambda = Symbol::Intern("lambda")->GetId();
+const SymbolId kDefine = Symbol::Intern("define")->GetId();
+
+bool IsHead(const std::shared_ptr<Cell>& cell, SymbolId name) {
+    return Is<Symbol>(cell->GetFirst()) && As<Symbol>(cell->GetFirst())->GetId() == name;
+}
+
+struct Address {
+    size_t depth;
+    size_t slot;
+};
+
+// The last slot named `name`: of two parameters of the same name, the later one wins
+std::optional<size_t> FindLast(const SlotNames& names, SymbolId name) {
+    auto it = std::find(names.rbegin(), names.rend(), name);
+    if (it == names.rend()) {
+        return std::nullopt;
+    }
+    return names.rend() - it - 1;
+}
+
+class Resolver {
+public:
+    Resolver(const SlotNames& frame, const std::shared_ptr<Scope>& parent)
+        : frame_(frame), parent_(parent) {
+    }
+
+    std::shared_ptr<Object> Resolve(const std::shared_ptr<Object>& obj) const {
+        if (Is<Symbol>(obj)) {
+            const Symbol& symbol = *As<Symbol>(obj);
+            if (std::optional<Address> address = Lookup(symbol.GetId())) {
+                return Make<LocalSymbol>(symbol, address->depth, address->slot);
+            }
+            return obj;
+        }
+        if (!Is<Cell>(obj) || IsSkipped(As<Cell>(obj))) {
+            return obj;
+        }
+        std::shared_ptr<Cell> res = Make<Cell>();
+        res->SetLocation(AsPtr<Cell>(obj)->GetLocation());
+        std::shared_ptr<Cell> cur = res;
+        std::shared_ptr<Object> src = obj;
+        while (true) {
+            std::shared_ptr<Cell> src_cell = As<Cell>(src);
+            cur->SetFirst(Resolve(src_cell->GetFirst()));
+            src = src_cell->GetSecond();
+            if (!Is<Cell>(src)) {
+                cur->SetSecond(Resolve(src));
+                break;
+            }
+            std::shared_ptr<Cell> next = Make<Cell>();
+            cur->SetSecond(next);
+            cur = next;
+        }
+        return res;
+    }
+
+private:
+    const SlotNames& frame_;
+    const std::shared_ptr<Scope>& parent_;
+
+    std::optional<Address> Lookup(SymbolId name) const {
+        if (std::optional<size_t> slot = FindLast(frame_, name)) {
+            return Address{0, *slot};
+        }
+        size_t depth = 1;
+        for (Scope* cur = parent_.get(); cur && cur->GetSlotNames(); cur = cur->GetParent().get()) {
+            if (std::optional<size_t> slot = FindLast(*cur->GetSlotNames(), name)) {
+                return Address{depth, *slot};
+            }
+            depth++;
+        }
+        return std::nullopt;
+    }
+
+    bool IsSpecialForm(const std::shared_ptr<Cell>& cell, SymbolId name) const {
+        return IsHead(cell, name) && !Lookup(name);
+    }
+
+    // quote, lambda and function defines
+    bool IsSkipped(const std::shared_ptr<Cell>& cell) const {
+        if (IsSpecialForm(cell, kQuote) || IsSpecialForm(cell, kLambda)) {
+            return true;
+        }
+        return IsSpecialForm(cell, kDefine) && Is<Cell>(cell->GetSecond()) &&
+               Is<Cell>(As<Cell>(cell->GetSecond())->GetFirst());
+    }
+};
+
+void CollectDefines(const std::shared_ptr<Object>& obj, SlotNames* names) {
+    if (!Is<Cell>(obj)) {
+        return;
+    }
+    std::shared_ptr<Cell> cell = As<Cell>(obj);
+    if (IsHead(cell, kQuote) || IsHead(cell, kLambda)) {
+        return;
+    }
+    if (IsHead(cell, kDefine) && Is<Cell>(cell->GetSecond())) {
+        std::shared_ptr<Object> target = As<Cell>(cell->GetSecond())->GetFirst();
+        if (Is<Cell>(target)) {
+            // function define, its body belongs to another frame
+            target = As<Cell>(target)->GetFirst();
+            if (Is<Symbol>(target)) {
+                names->push_back(As<Symbol>(target)->GetId());
+            }
+            return;
+        }
+        if (Is<Symbol>(target)) {
+            names->push_back(As<Symbol>(target)->GetId());
+        }
+    }
+    for (std::shared_ptr<Object> cur = obj; Is<Cell>(cur); cur = As<Cell>(cur)->GetSecond()) {
+        CollectDefines(As<Cell>(cur)->GetFirst(), names);
+    }
+}
+
+}  // namespace
+
+SlotNames CollectFrameNames(const SlotNames& args, const ObjectVector& body) {
+    SlotNames names = args;
+    SlotNames defines;
+    for (auto& i : body) {
+        CollectDefines(i, &defines);
+    }
+    for (auto& i : defines) {
+        if (std::find(names.begin(), names.end(), i) == names.end()) {
+            names.push_back(i);
+        }
+    }
+    return names;
+}
+
+ObjectVector ResolveBody(const ObjectVector& body, const SlotNames& frame,
+                         const std::shared_ptr<Scope>& parent) {
+    Resolver resolver(frame, parent);
+    ObjectVector res;
+    res.reserve(body.size());
+    for (auto& i : body) {
+        res.push_back(resolver.Resolve(i));
+    }
+    return res;
+}
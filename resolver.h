@@ -0,0 +1,20 @@
+#pragma once
+
+#include "object.h"
+#include <memory>
+#include <vector>
+
+// Lexical addressing of lambda bodies. Every lambda call gets a frame with a slot per
+// argument and per `define` of the body, so references to these variables can be
+// turned into (depth, slot) pairs once, when the lambda is created.
+
+// Slot names of a lambda frame: arguments first, then the names defined in the body
+// (defines of nested lambdas are not included).
+SlotNames CollectFrameNames(const SlotNames& args, const ObjectVector& body);
+
+// Copy of `body` with Symbols bound to lambda frames replaced by LocalSymbols. `frame`
+// describes the frame the body is evaluated in, `parent` is the scope the lambda is
+// created in. Quoted data and nested lambdas are left as they are; the latter are
+// resolved when they are created.
+ObjectVector ResolveBody(const ObjectVector& body, const SlotNames& frame,
+                         const std::shared_ptr<Scope>& parent);
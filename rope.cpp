@@ -0,0 +1,253 @@
+#include "rope.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// A leaf is a slice of a buffer, a concatenation has both children. Heights of siblings
+// differ by at most one, like in an AVL tree.
+struct RopeNode {
+    size_t size;
+    int height;  // 0 for leaves
+    std::shared_ptr<const std::string> buffer;
+    size_t offset = 0;
+    std::shared_ptr<const RopeNode> left;
+    std::shared_ptr<const RopeNode> right;
+
+    std::string_view Text() const {
+        return std::string_view(*buffer).substr(offset, size);
+    }
+};
+
+namespace {
+
+using NodePtr = std::shared_ptr<const RopeNode>;
+
+// Appending a short string to a short leaf copies both into a new leaf instead of making
+// another node, so a string built by small appends has leaves of about this size
+constexpr size_t kMaxLeafSize = 512;
+
+int Height(const NodePtr& node) {
+    return node->height;
+}
+
+NodePtr MakeLeaf(std::shared_ptr<const std::string> buffer, size_t offset, size_t size) {
+    return std::make_shared<const RopeNode>(
+        RopeNode{size, 0, std::move(buffer), offset, nullptr, nullptr});
+}
+
+NodePtr MakeLeaf(std::string text) {
+    size_t size = text.size();
+    return MakeLeaf(std::make_shared<const std::string>(std::move(text)), 0, size);
+}
+
+NodePtr MakeConcat(NodePtr left, NodePtr right) {
+    size_t size = left->size + right->size;
+    int height = 1 + std::max(Height(left), Height(right));
+    return std::make_shared<const RopeNode>(
+        RopeNode{size, height, nullptr, 0, std::move(left), std::move(right)});
+}
+
+void ForEachLeaf(const RopeNode& node, const std::function<void(std::string_view)>& visit) {
+    if (node.height == 0) {
+        visit(node.Text());
+        return;
+    }
+    ForEachLeaf(*node.left, visit);
+    ForEachLeaf(*node.right, visit);
+}
+
+// Concatenation of two siblings, short leaves are merged into one. Only leaves are, so the
+// height is never off by more than the one the joins below expect.
+NodePtr MakePair(const NodePtr& left, const NodePtr& right) {
+    if (left->height > 0 || right->height > 0 || left->size + right->size > kMaxLeafSize) {
+        return MakeConcat(left, right);
+    }
+    std::string text;
+    text.reserve(left->size + right->size);
+    text += left->Text();
+    text += right->Text();
+    return MakeLeaf(std::move(text));
+}
+
+// (a (b c)) -> ((a b) c)
+NodePtr RotateLeft(const NodePtr& node) {
+    return MakeConcat(MakeConcat(node->left, node->right->left), node->right->right);
+}
+
+// ((a b) c) -> (a (b c))
+NodePtr RotateRight(const NodePtr& node) {
+    return MakeConcat(node->left->left, MakeConcat(node->left->right, node->right));
+}
+
+// `left` is taller than `right` by more than one: `right` goes down the right spine
+NodePtr JoinRight(const NodePtr& left, const NodePtr& right) {
+    const NodePtr& l = left->left;
+    const NodePtr& r = left->right;
+    NodePtr joined = Height(r) <= Height(right) + 1 ? MakePair(r, right) : JoinRight(r, right);
+    if (Height(joined) <= Height(l) + 1) {
+        return MakeConcat(l, joined);
+    }
+    if (Height(joined->left) > Height(joined->right)) {
+        joined = RotateRight(joined);
+    }
+    return RotateLeft(MakeConcat(l, joined));
+}
+
+// Mirrors JoinRight
+NodePtr JoinLeft(const NodePtr& left, const NodePtr& right) {
+    const NodePtr& l = right->left;
+    const NodePtr& r = right->right;
+    NodePtr joined = Height(l) <= Height(left) + 1 ? MakePair(left, l) : JoinLeft(left, l);
+    if (Height(joined) <= Height(r) + 1) {
+        return MakeConcat(joined, r);
+    }
+    if (Height(joined->right) > Height(joined->left)) {
+        joined = RotateLeft(joined);
+    }
+    return RotateRight(MakeConcat(joined, r));
+}
+
+NodePtr Join(const NodePtr& left, const NodePtr& right) {
+    if (Height(left) > Height(right) + 1) {
+        return JoinRight(left, right);
+    }
+    if (Height(right) > Height(left) + 1) {
+        return JoinLeft(left, right);
+    }
+    return MakePair(left, right);
+}
+
+NodePtr Slice(const NodePtr& node, size_t start, size_t end) {
+    if (start == 0 && end == node->size) {
+        return node;
+    }
+    if (node->height == 0) {
+        return MakeLeaf(node->buffer, node->offset + start, end - start);
+    }
+    size_t middle = node->left->size;
+    if (end <= middle) {
+        return Slice(node->left, start, end);
+    }
+    if (start >= middle) {
+        return Slice(node->right, start - middle, end - middle);
+    }
+    return Join(Slice(node->left, start, middle), Slice(node->right, 0, end - middle));
+}
+
+std::vector<std::string_view> Pieces(const Rope& rope) {
+    std::vector<std::string_view> res;
+    rope.ForEachPiece([&res](std::string_view piece) { res.push_back(piece); });
+    return res;
+}
+
+}  // namespace
+
+Rope::Rope(std::string_view text) : size_(text.size()) {
+    if (size_ <= kInlineCapacity) {
+        std::memcpy(inline_, text.data(), size_);
+    } else {
+        node_ = MakeLeaf(std::string(text));
+    }
+}
+
+Rope::Rope(std::shared_ptr<const RopeNode> node) : size_(node->size) {
+    if (size_ <= kInlineCapacity) {
+        // doesn't keep a big buffer alive for a few characters
+        char* out = inline_;
+        ForEachLeaf(*node, [&out](std::string_view piece) {
+            out = std::copy(piece.begin(), piece.end(), out);
+        });
+    } else {
+        node_ = std::move(node);
+    }
+}
+
+std::shared_ptr<const RopeNode> Rope::ToNode() const {
+    return node_ ? node_ : MakeLeaf(std::string(inline_, size_));
+}
+
+char Rope::At(size_t index) const {
+    if (!node_) {
+        return inline_[index];
+    }
+    const RopeNode* node = node_.get();
+    while (node->height > 0) {
+        if (index < node->left->size) {
+            node = node->left.get();
+        } else {
+            index -= node->left->size;
+            node = node->right.get();
+        }
+    }
+    return node->Text()[index];
+}
+
+Rope Rope::Substring(size_t start, size_t end) const {
+    if (!node_) {
+        return Rope(std::string_view(inline_ + start, end - start));
+    }
+    if (start == end) {
+        return Rope();
+    }
+    return Rope(Slice(node_, start, end));
+}
+
+std::string Rope::ToString() const {
+    std::string res;
+    res.reserve(size_);
+    ForEachPiece([&res](std::string_view piece) { res += piece; });
+    return res;
+}
+
+void Rope::ForEachPiece(const std::function<void(std::string_view)>& visit) const {
+    if (!node_) {
+        visit(std::string_view(inline_, size_));
+    } else {
+        ForEachLeaf(*node_, visit);
+    }
+}
+
+Rope operator+(const Rope& a, const Rope& b) {
+    if (a.size_ + b.size_ <= Rope::kInlineCapacity) {
+        Rope res;
+        res.size_ = a.size_ + b.size_;
+        std::memcpy(res.inline_, a.inline_, a.size_);
+        std::memcpy(res.inline_ + a.size_, b.inline_, b.size_);
+        return res;
+    }
+    if (a.size_ == 0) {
+        return b;
+    }
+    if (b.size_ == 0) {
+        return a;
+    }
+    return Rope(Join(a.ToNode(), b.ToNode()));
+}
+
+bool operator==(const Rope& a, const Rope& b) {
+    return a.size_ == b.size_ && (a <=> b) == 0;
+}
+
+std::strong_ordering operator<=>(const Rope& a, const Rope& b) {
+    std::vector<std::string_view> lhs = Pieces(a);
+    std::vector<std::string_view> rhs = Pieces(b);
+    size_t i = 0, j = 0;
+    std::string_view x, y;
+    while (true) {
+        while (x.empty() && i < lhs.size()) {
+            x = lhs[i++];
+        }
+        while (y.empty() && j < rhs.size()) {
+            y = rhs[j++];
+        }
+        if (x.empty() || y.empty()) {
+            return !x.empty() <=> !y.empty();
+        }
+        size_t common = std::min(x.size(), y.size());
+        if (int cmp = x.substr(0, common).compare(y.substr(0, common)); cmp != 0) {
+            return cmp <=> 0;
+        }
+        x.remove_prefix(common);
+        y.remove_prefix(common);
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct RopeNode;
+
+// Immutable byte string. Short strings are stored inline, longer ones are balanced trees
+// of slices of shared buffers, so concatenation and substrings don't copy the text.
+class Rope {
+public:
+    Rope() = default;
+
+    explicit Rope(std::string_view text);
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // O(log n)
+    char At(size_t index) const;
+
+    // Characters [start, end), sharing the buffers of this rope
+    Rope Substring(size_t start, size_t end) const;
+
+    std::string ToString() const;
+
+    // Calls `visit` for the contiguous pieces of the text, in order
+    void ForEachPiece(const std::function<void(std::string_view)>& visit) const;
+
+    // O(log n), the result shares both operands
+    friend Rope operator+(const Rope& a, const Rope& b);
+
+    friend bool operator==(const Rope& a, const Rope& b);
+
+    friend std::strong_ordering operator<=>(const Rope& a, const Rope& b);
+
+private:
+    static constexpr size_t kInlineCapacity = 16;
+
+    std::shared_ptr<const RopeNode> node_;  // null for inline strings
+    size_t size_ = 0;
+    char inline_[kInlineCapacity] = {};
+
+    explicit Rope(std::shared_ptr<const RopeNode> node);
+
+    std::shared_ptr<const RopeNode> ToNode() const;
+};
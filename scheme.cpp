@@ -1,77 +1,358 @@
 #include "scheme.h"
+#include "ast.h"
+#include "bytecode.h"
 #include "parser.h"
 #include "tokenizer.h"
 #include "error.h"
+#include "file.h"
 #include "object.h"
 #include "functors.h"
-#include <sstream>
+#include "printer.h"
+#include "hashtable.h"
+#include "pool.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include <cerrno>
+#include <fstream>
+#include <system_error>
 
-std::string Interpreter::Run(const std::string &s) {
-    std::stringstream ss{s};
-    Tokenizer tokenizer{&ss};
-    auto obj = Read(&tokenizer);
-    if (!tokenizer.IsEnd()) {
-        throw SyntaxError("Didn't read all the tokens for some reason");
-    }
-    if (!obj) {
-        throw RuntimeError("Trying to Eval nullptr");
-    }
-    auto tmp = obj->Eval(root_scope_);
-    if (!tmp) {
-        return "()";
+namespace {
+
+constexpr size_t kMinGcThreshold = 1 << 16;
+
+}  // namespace
+
+// Collects garbage when a Run call exits, even by an exception
+struct Interpreter::CollectOnExit {
+    Interpreter *interpreter;
+    ~CollectOnExit() {
+        interpreter->MaybeCollectGarbage();
     }
+};
+
+namespace {
+
+// Prints `res` with `print`, reporting any failure as a SyntaxError
+void PrintResult(const std::shared_ptr<Object> &res,
+                 const std::function<void(const Object *)> &print) {
     try {
-        return tmp->Serialize();
+        print(res.get());
     } catch (...) {
         // shit happened
         throw SyntaxError("Couldn't Serialize result. It's either bug in scheme or in test");
     }
 }
 
-Interpreter::Interpreter() {
-    root_scope_ = std::shared_ptr<Scope>(new Scope(nullptr));
-    root_scope_->Define("+", std::shared_ptr<Object>(new NumberFunctor(std::plus<int>(), 0)));
-    root_scope_->Define("-", std::shared_ptr<Object>(new NumberFunctor(std::minus<int>())));
-    root_scope_->Define("*", std::shared_ptr<Object>(new NumberFunctor(std::multiplies<int>(), 1)));
-    root_scope_->Define("/", std::shared_ptr<Object>(new NumberFunctor(std::divides<int>())));
-    root_scope_->Define("abs", std::shared_ptr<Object>(new AbsFunctor));
-    auto maxi = [&](long long a, long long b) { return std::max(a, b); };
-    root_scope_->Define("max", std::shared_ptr<Object>(new NumberFunctor(maxi)));
-    auto mini = [&](long long a, long long b) { return std::min(a, b); };
-    root_scope_->Define("min", std::shared_ptr<Object>(new NumberFunctor(mini)));
-    root_scope_->Define("<", std::shared_ptr<Object>(new ComparisonFunctor(std::less<int>())));
-    root_scope_->Define(">", std::shared_ptr<Object>(new ComparisonFunctor(std::greater<int>())));
-    root_scope_->Define("=", std::shared_ptr<Object>(new ComparisonFunctor(std::equal_to<int>())));
-    root_scope_->Define("<=",
-                        std::shared_ptr<Object>(new ComparisonFunctor(std::less_equal<int>())));
-    root_scope_->Define(">=",
-                        std::shared_ptr<Object>(new ComparisonFunctor(std::greater_equal<int>())));
-    root_scope_->Define("number?", std::shared_ptr<Object>(new CheckTypeFunctor<Number>));
-    root_scope_->Define("quote", std::shared_ptr<Object>(new QuoteFunctor));
-
-    root_scope_->Define("and",
-                        std::shared_ptr<Object>(new BooleanFunctor(std::logical_and<bool>(), 0)));
-    root_scope_->Define("or",
-                        std::shared_ptr<Object>(new BooleanFunctor(std::logical_or<bool>(), 1)));
-    root_scope_->Define("not", std::shared_ptr<Object>(new NotFunctor));
-    root_scope_->Define("boolean?", std::shared_ptr<Object>(new CheckTypeFunctor<Boolean>));
-
-    root_scope_->Define("pair?", std::shared_ptr<Object>(new CheckTypeFunctor<Cell>));
-    root_scope_->Define("null?", std::shared_ptr<Object>(new CheckNullFunctor));
-    root_scope_->Define("car", std::shared_ptr<Object>(new CarFunctor));
-    root_scope_->Define("cdr", std::shared_ptr<Object>(new CdrFunctor));
-    root_scope_->Define("cons", std::shared_ptr<Object>(new ConsFunctor));
-
-    root_scope_->Define("list?", std::shared_ptr<Object>(new CheckListFunctor));
-    root_scope_->Define("list", std::shared_ptr<Object>(new ListFunctor));
-    root_scope_->Define("list-tail", std::shared_ptr<Object>(new ListTailFunctor));
-    root_scope_->Define("list-ref", std::shared_ptr<Object>(new ListRefFunctor));
-
-    root_scope_->Define("symbol?", std::shared_ptr<Object>(new CheckTypeFunctor<Symbol>()));
-    root_scope_->Define("if", std::shared_ptr<Object>(new IfFunctor));
-    root_scope_->Define("define", std::shared_ptr<Object>(new DefineFunctor));
-    root_scope_->Define("set!", std::shared_ptr<Object>(new SetFunctor));
-    root_scope_->Define("set-car!", std::shared_ptr<Object>(new SetCarFunctor));
-    root_scope_->Define("set-cdr!", std::shared_ptr<Object>(new SetCdrFunctor));
-    root_scope_->Define("lambda", std::shared_ptr<Object>(new LambdaCreatorFunctor));
+// The builtins are stateless, so every interpreter binds the same instances, made once
+const BuiltinTable& GetBuiltins() {
+    static const BuiltinTable kBuiltins = [] {
+        HeapGuard heap_guard(nullptr);  // shared by all the heaps, owned by none
+        std::shared_ptr<Scope> builtins(new Scope(nullptr));
+        builtins->Define("+", std::shared_ptr<Object>(new NumberFunctor(AddOp(), 0)));
+        builtins->Define("-", std::shared_ptr<Object>(new NumberFunctor(SubtractOp())));
+        builtins->Define("*", std::shared_ptr<Object>(new NumberFunctor(MultiplyOp(), 1)));
+        builtins->Define("/", std::shared_ptr<Object>(new NumberFunctor(DivideOp())));
+        builtins->Define("abs", std::shared_ptr<Object>(new AbsFunctor));
+        builtins->Define("max", std::shared_ptr<Object>(new NumberFunctor(MaxOp())));
+        builtins->Define("min", std::shared_ptr<Object>(new NumberFunctor(MinOp())));
+        builtins->Define("<", std::shared_ptr<Object>(new ComparisonFunctor(std::less<int64_t>())));
+        builtins->Define(">",
+                         std::shared_ptr<Object>(new ComparisonFunctor(std::greater<int64_t>())));
+        builtins->Define("=",
+                         std::shared_ptr<Object>(new ComparisonFunctor(std::equal_to<int64_t>())));
+        builtins->Define(
+            "<=", std::shared_ptr<Object>(new ComparisonFunctor(std::less_equal<int64_t>())));
+        builtins->Define(
+            ">=", std::shared_ptr<Object>(new ComparisonFunctor(std::greater_equal<int64_t>())));
+        builtins->Define("number?", std::shared_ptr<Object>(new CheckTypeFunctor<Numeric>));
+        builtins->Define("quote", std::shared_ptr<Object>(new QuoteFunctor));
+
+        builtins->Define("and",
+                         std::shared_ptr<Object>(new BooleanFunctor(std::logical_and<bool>(), 0)));
+        builtins->Define("or",
+                         std::shared_ptr<Object>(new BooleanFunctor(std::logical_or<bool>(), 1)));
+        builtins->Define("not", std::shared_ptr<Object>(new NotFunctor));
+        builtins->Define("boolean?", std::shared_ptr<Object>(new CheckTypeFunctor<Boolean>));
+
+        builtins->Define("pair?", std::shared_ptr<Object>(new CheckTypeFunctor<Cell>));
+        builtins->Define("null?", std::shared_ptr<Object>(new CheckNullFunctor));
+        builtins->Define("car", std::shared_ptr<Object>(new CarFunctor));
+        builtins->Define("cdr", std::shared_ptr<Object>(new CdrFunctor));
+        builtins->Define("cons", std::shared_ptr<Object>(new ConsFunctor));
+
+        builtins->Define("list?", std::shared_ptr<Object>(new CheckListFunctor));
+        builtins->Define("list", std::shared_ptr<Object>(new ListFunctor));
+        builtins->Define("list-tail", std::shared_ptr<Object>(new ListTailFunctor));
+        builtins->Define("list-ref", std::shared_ptr<Object>(new ListRefFunctor));
+
+        builtins->Define("vector?", std::shared_ptr<Object>(new CheckTypeFunctor<Vector>));
+        builtins->Define("make-vector", std::shared_ptr<Object>(new MakeVectorFunctor));
+        builtins->Define("vector", std::shared_ptr<Object>(new VectorFunctor));
+        builtins->Define("vector-length", std::shared_ptr<Object>(new VectorLengthFunctor));
+        builtins->Define("vector-ref", std::shared_ptr<Object>(new VectorRefFunctor));
+        builtins->Define("vector-set!", std::shared_ptr<Object>(new VectorSetFunctor));
+        builtins->Define("vector-fill!", std::shared_ptr<Object>(new VectorFillFunctor));
+        builtins->Define("list->vector", std::shared_ptr<Object>(new ListToVectorFunctor));
+        builtins->Define("vector->list", std::shared_ptr<Object>(new VectorToListFunctor));
+
+        builtins->Define("hash-table?", std::shared_ptr<Object>(new CheckTypeFunctor<HashTable>));
+        builtins->Define("make-hash-table", std::shared_ptr<Object>(new MakeHashTableFunctor));
+        builtins->Define("hash-table-ref", std::shared_ptr<Object>(new HashTableRefFunctor));
+        builtins->Define("hash-table-ref/default",
+                         std::shared_ptr<Object>(new HashTableRefDefaultFunctor));
+        builtins->Define("hash-table-set!", std::shared_ptr<Object>(new HashTableSetFunctor));
+        builtins->Define("hash-table-delete!", std::shared_ptr<Object>(new HashTableDeleteFunctor));
+        builtins->Define("hash-table-exists?", std::shared_ptr<Object>(new HashTableExistsFunctor));
+        builtins->Define("hash-table-count", std::shared_ptr<Object>(new HashTableCountFunctor));
+        builtins->Define("hash-table-walk", std::shared_ptr<Object>(new HashTableWalkFunctor));
+        builtins->Define("hash-table-keys", std::shared_ptr<Object>(new HashTableKeysFunctor));
+        builtins->Define("hash-table-values", std::shared_ptr<Object>(new HashTableValuesFunctor));
+
+        builtins->Define("string?", std::shared_ptr<Object>(new CheckTypeFunctor<String>));
+        builtins->Define("string-length", std::shared_ptr<Object>(new StringLengthFunctor));
+        builtins->Define("string-ref", std::shared_ptr<Object>(new StringRefFunctor));
+        builtins->Define("substring", std::shared_ptr<Object>(new SubstringFunctor));
+        builtins->Define("string-append", std::shared_ptr<Object>(new StringAppendFunctor));
+        builtins->Define("string=?", std::shared_ptr<Object>(
+                                         new StringComparisonFunctor(std::equal_to<Rope>())));
+        builtins->Define("string<?",
+                         std::shared_ptr<Object>(new StringComparisonFunctor(std::less<Rope>())));
+        builtins->Define("string->symbol", std::shared_ptr<Object>(new StringToSymbolFunctor));
+        builtins->Define("symbol->string", std::shared_ptr<Object>(new SymbolToStringFunctor));
+        builtins->Define("number->string", std::shared_ptr<Object>(new NumberToStringFunctor));
+        builtins->Define("char?", std::shared_ptr<Object>(new CheckTypeFunctor<Character>));
+        builtins->Define("char->integer", std::shared_ptr<Object>(new CharToIntegerFunctor));
+        builtins->Define("integer->char", std::shared_ptr<Object>(new IntegerToCharFunctor));
+
+        builtins->Define("symbol?", std::shared_ptr<Object>(new CheckTypeFunctor<Symbol>()));
+        builtins->Define("if", std::shared_ptr<Object>(new IfFunctor));
+        builtins->Define("define", std::shared_ptr<Object>(new DefineFunctor));
+        builtins->Define("set!", std::shared_ptr<Object>(new SetFunctor));
+        builtins->Define("set-car!", std::shared_ptr<Object>(new SetCarFunctor));
+        builtins->Define("set-cdr!", std::shared_ptr<Object>(new SetCdrFunctor));
+        builtins->Define("lambda", std::shared_ptr<Object>(new LambdaCreatorFunctor));
+        // put into the forms by the optimizer, the name only makes it known to images
+        builtins->Define("#guard", std::shared_ptr<Object>(new GuardFunctor));
+        return builtins->GetObjects();
+    }();
+    return kBuiltins;
+}
+
+}  // namespace
+
+std::string Interpreter::Run(const std::string &s) {
+    std::string res;
+    RunForm(s, [&res](const Object *value) { Print(value, &res); });
+    return res;
+}
+
+void Interpreter::Run(const std::string &s, std::ostream *out) {
+    RunForm(s, [out](const Object *value) { Print(value, out); });
+}
+
+void Interpreter::RunForm(const std::string &s,
+                          const std::function<void(const Object *)> &print) {
+    HeapGuard heap_guard(heap_.get());
+    EngineGuard engine_guard(engine_);
+    ProfilerGuard profiler_guard(profiler_.get());
+    BudgetGuard budget_guard(&budget_);
+    CollectOnExit collect_on_exit{this};
+    PrintResult(EvalForm(ReadForm(s)), print);
+}
+
+std::shared_ptr<Object> Interpreter::ReadForm(const std::string &s) {
+    auto read = [this, &s] {
+        Tokenizer tokenizer{std::string_view(s)};
+        auto obj = Read(&tokenizer, max_nesting_);
+        if (!tokenizer.IsEnd()) {
+            throw SyntaxError("Didn't read all the tokens for some reason");
+        }
+        return obj;
+    };
+    if (!parse_cache_) {
+        return read();
+    }
+    if (auto obj = parse_cache_->Find(s)) {
+        return obj;
+    }
+    std::shared_ptr<Object> obj;
+    {
+        HeapGuard heap_guard(nullptr);  // owned by the cache, not by the heap
+        obj = read();
+    }
+    return parse_cache_->Add(s, std::move(obj));
+}
+
+std::string Interpreter::RunAll(std::string_view source) {
+    return RunSource(source, nullptr);
+}
+
+std::string Interpreter::RunFile(const std::string &path) {
+    MappedFile file(path);
+    return RunSource(file.Get(), &file);
+}
+
+std::string Interpreter::RunSource(std::string_view source, MappedFile *file) {
+    HeapGuard heap_guard(heap_.get());
+    EngineGuard engine_guard(engine_);
+    ProfilerGuard profiler_guard(profiler_.get());
+    BudgetGuard budget_guard(&budget_);
+    CollectOnExit collect_on_exit{this};
+    Tokenizer tokenizer{source};
+    std::shared_ptr<Object> res;
+    while (!tokenizer.IsEnd()) {
+        res = EvalForm(Read(&tokenizer, max_nesting_));
+        // nothing but the result is in use between forms
+        MaybeCollectGarbage(res);
+        if (file) {
+            file->Release(tokenizer.GetPosition());
+        }
+    }
+    std::string serialized;
+    PrintResult(res, [&serialized](const Object *value) { Print(value, &serialized); });
+    return serialized;
+}
+
+std::shared_ptr<Object> Interpreter::EvalForm(const std::shared_ptr<Object> &form) {
+    if (!form) {
+        throw RuntimeError("Trying to Eval nullptr");
+    }
+    std::shared_ptr<Object> obj = optimizer_ ? optimizer_->Optimize(form, root_scope_) : form;
+    if (engine_ == Engine::kBytecode) {
+        return Execute(Compile({obj}, root_scope_), root_scope_);
+    }
+    if (engine_ == Engine::kAst) {
+        return BuildTree({obj}, root_scope_)->Execute(root_scope_);
+    }
+    return obj->Eval(root_scope_);
+}
+
+void Interpreter::CollectGarbage() {
+    Collect(nullptr);
+}
+
+void Interpreter::Collect(const std::shared_ptr<Object> &value) {
+    heap_->Collect({root_scope_.get(), value.get()});
+    gc_threshold_ = std::max(kMinGcThreshold, 2 * heap_->Size());
+}
+
+void Interpreter::MaybeCollectGarbage(const std::shared_ptr<Object> &value) {
+    if (gc_stress_ || heap_->Size() >= gc_threshold_) {
+        Collect(value);
+    }
+}
+
+void Interpreter::SetGcStressMode(bool enabled) {
+    gc_stress_ = enabled;
+}
+
+size_t Interpreter::GetHeapSize() const {
+    return heap_->Size();
+}
+
+void Interpreter::SetEngine(Engine engine) {
+    engine_ = engine;
+}
+
+void Interpreter::SetMaxNesting(size_t max_nesting) {
+    max_nesting_ = max_nesting;
+    if (parse_cache_) {
+        // the cached forms were read with the old limit
+        parse_cache_ = std::make_unique<ParseCache>(parse_cache_->GetBudget());
+    }
+}
+
+void Interpreter::SetParseCacheBudget(size_t budget) {
+    parse_cache_ = budget ? std::make_unique<ParseCache>(budget) : nullptr;
+}
+
+ParseCacheStats Interpreter::GetParseCacheStats() const {
+    return parse_cache_ ? parse_cache_->GetStats() : ParseCacheStats{};
+}
+
+void Interpreter::SaveImage(const std::string &path) {
+    std::string image = ::SaveImage(root_scope_, GetBuiltins());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(image.data(), image.size());
+    out.close();
+    if (!out) {
+        throw std::system_error(errno, std::generic_category(), "Can't write " + path);
+    }
+}
+
+void Interpreter::LoadImage(const std::string &path) {
+    MappedFile file(path);
+    HeapGuard heap_guard(heap_.get());
+    EngineGuard engine_guard(engine_);
+    root_scope_ = ::LoadImage(file.Get(), GetBuiltins());
+    // everything loaded is reachable, the next collection can wait as long as after one
+    gc_threshold_ = std::max(kMinGcThreshold, 2 * heap_->Size());
+}
+
+void Interpreter::StartProfiler(ProfileMode mode) {
+    profiler_ = std::make_unique<Profiler>(mode, GetBuiltins());
+}
+
+Profile Interpreter::StopProfiler() {
+    if (!profiler_) {
+        return {};
+    }
+    Profile res = profiler_->GetProfile();
+    profiler_ = nullptr;
+    return res;
+}
+
+Interpreter::~Interpreter() {
+    // the heap breaks the cycles between the remaining objects
+    root_scope_ = nullptr;
+}
+
+Interpreter::Interpreter()
+    : heap_(std::make_unique<Heap>()),
+      gc_threshold_(kMinGcThreshold),
+      max_nesting_(kDefaultMaxNesting) {
+    HeapGuard heap_guard(heap_.get());
+    root_scope_ = std::shared_ptr<Scope>(new Scope(nullptr, GetBuiltins()));
+}
+
+std::vector<RunResult> RunMany(const std::vector<std::string> &programs, ThreadPool *pool) {
+    std::vector<RunResult> results(programs.size());
+    pool->Run(programs.size(), [&programs, &results](size_t i) {
+        try {
+            Interpreter interpreter;
+            results[i].value = interpreter.RunAll(programs[i]);
+        } catch (...) {
+            results[i].error = std::current_exception();
+        }
+    });
+    return results;
+}
+
+std::vector<RunResult> RunMany(const std::vector<std::string> &programs) {
+    static ThreadPool pool;
+    return RunMany(programs, &pool);
+}
+
+void Interpreter::EnableOptimizer(OptimizerPasses passes) {
+    optimizer_ = std::make_unique<Optimizer>(passes, GetBuiltins());
+}
+
+void Interpreter::DisableOptimizer() {
+    optimizer_ = nullptr;
+}
+
+OptimizerStats Interpreter::GetOptimizerStats() const {
+    return optimizer_ ? optimizer_->GetStats() : OptimizerStats{};
+}
+
+void Interpreter::SetFuel(uint64_t steps) {
+    budget_.SetFuel(steps);
+}
+
+void Interpreter::SetTimeout(std::chrono::nanoseconds timeout) {
+    budget_.SetTimeout(timeout);
+}
+
+void Interpreter::Interrupt() {
+    budget_.Interrupt();
 }
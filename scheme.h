@@ -1,17 +1,152 @@
 #pragma once
 #define SCHEME_FUZZING_2_PRINT_REQUESTS
 
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <vector>
+#include "budget.h"
+#include "cache.h"
+#include "engine.h"
+#include "gc.h"
+#include "optimizer.h"
+#include "profiler.h"
 
+class MappedFile;
+class Object;
 class Scope;
+class ThreadPool;
 
 class Interpreter {
 public:
     Interpreter();
 
+    ~Interpreter();
+
     std::string Run(const std::string&);
 
+    // Same as Run, but the result is written to `out` while it is serialized, so a big
+    // one is never held in memory as a whole. On a failure a part of it may be written.
+    void Run(const std::string& s, std::ostream* out);
+
+    // Reads and evaluates the top-level forms of `source` one at a time, dropping each
+    // once it is evaluated. Returns the value of the last form, "()" if there are none.
+    // Forms before one that fails stay evaluated.
+    std::string RunAll(std::string_view source);
+
+    // RunAll on the contents of the file at `path`, mapped into memory
+    std::string RunFile(const std::string& path);
+
+    // Frees everything unreachable from the global scope. Runs automatically after Run
+    // once enough objects were created since the last collection.
+    void CollectGarbage();
+
+    // Collect after every Run, to shake out objects that escape the collector's roots
+    void SetGcStressMode(bool enabled);
+
+    // Number of live objects the interpreter knows of
+    size_t GetHeapSize() const;
+
+    // Engine for the following Run calls, kBytecode by default. Lambdas keep running on
+    // the engine they were created with.
+    void SetEngine(Engine engine);
+
+    // Writes the global scope, with the definitions and everything reachable from them, to an
+    // image file at `path` (see snapshot.h)
+    void SaveImage(const std::string& path);
+
+    // Replaces the global scope with the one from an image written by SaveImage, the file
+    // is mapped into memory. The lambdas are compiled for the current engine.
+    void LoadImage(const std::string& path);
+
+    // Deepest nesting of lists and quotes the following Run calls accept in the source,
+    // kDefaultMaxNesting by default
+    void SetMaxNesting(size_t max_nesting);
+
+    // Keeps the forms read by Run in a cache of about `budget` bytes, so a source that is run
+    // again isn't read again (see cache.h). 0, the default, turns the cache off. The compiled
+    // code isn't kept: it depends on the global bindings at the time of the run.
+    void SetParseCacheBudget(size_t budget);
+
+    // Hits, misses and size of the cache of SetParseCacheBudget, zeros if it's off
+    ParseCacheStats GetParseCacheStats() const;
+
+    // Profiles the following runs (see profiler.h) until StopProfiler, discarding the
+    // profile of a previous StartProfiler that wasn't stopped
+    void StartProfiler(ProfileMode mode = ProfileMode::kExact);
+
+    // The profile of the runs since StartProfiler, empty if it wasn't called
+    Profile StopProfiler();
+
+    // Rewrites the forms of the following runs with `passes` before evaluating them (see
+    // optimizer.h), until DisableOptimizer. The optimizer is off by default.
+    void EnableOptimizer(OptimizerPasses passes = {});
+
+    void DisableOptimizer();
+
+    // Rewrites done by each pass since EnableOptimizer, zeros if it's off
+    OptimizerStats GetOptimizerStats() const;
+
+    // Limits each following run to `steps` calls of lambdas, 0 (the default) for no limit.
+    // A run out of them fails with an InterruptedError (see budget.h).
+    void SetFuel(uint64_t steps);
+
+    // Each following run fails with an InterruptedError once it has taken longer than
+    // `timeout`, 0 (the default) for no limit
+    void SetTimeout(std::chrono::nanoseconds timeout);
+
+    // Makes the run in progress fail with an InterruptedError within a few calls of lambdas.
+    // The only method that can be called from another thread while a run is in progress, it
+    // does nothing if there is none. The interpreter can be used again after the failure.
+    void Interrupt();
+
 private:
+    std::unique_ptr<Heap> heap_;
     std::shared_ptr<Scope> root_scope_;
+    size_t gc_threshold_;
+    bool gc_stress_ = false;
+    Engine engine_ = Engine::kBytecode;
+    size_t max_nesting_;
+    std::unique_ptr<Profiler> profiler_;
+    std::unique_ptr<ParseCache> parse_cache_;
+    std::unique_ptr<Optimizer> optimizer_;
+    Budget budget_;
+
+    struct CollectOnExit;
+
+    // `value` is kept alive as well as the global scope
+    void Collect(const std::shared_ptr<Object>& value);
+
+    void MaybeCollectGarbage(const std::shared_ptr<Object>& value = nullptr);
+
+    // RunAll, releasing the parts of `file` already read if it is given
+    std::string RunSource(std::string_view source, MappedFile* file);
+
+    // The single form of `s`, from the parse cache if it's on
+    std::shared_ptr<Object> ReadForm(const std::string& s);
+
+    std::shared_ptr<Object> EvalForm(const std::shared_ptr<Object>& form);
+
+    // Reads and evaluates the single form of `s`, then prints the value with `print`
+    // before the garbage is collected
+    void RunForm(const std::string& s, const std::function<void(const Object*)>& print);
 };
+
+// Outcome of one of the programs run by RunMany
+struct RunResult {
+    std::string value;         // what RunAll returned, empty if the program failed
+    std::exception_ptr error;  // what the program failed with, nullptr if it didn't
+};
+
+// Runs every program with RunAll in a fresh Interpreter of its own, spread over the threads
+// of `pool`. The programs share nothing but the builtins and the symbol table, which are
+// safe to use from several threads. Results are in the order of `programs`.
+std::vector<RunResult> RunMany(const std::vector<std::string>& programs, ThreadPool* pool);
+
+// RunMany on a pool with a thread per core, started on the first call
+std::vector<RunResult> RunMany(const std::vector<std::string>& programs);
@@ -0,0 +1,693 @@
+#include "snapshot.h"
+#include "error.h"
+#include "functors.h"
+#include "hashtable.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Layout of an image, numbers are LEB128 varints:
+//   magic
+//   checksum of the rest, 8 bytes: a damaged image could describe code that never
+//   compiles, like a cyclic list, so it is rejected before anything is built
+//   symbols:    count, names
+//   frames:     count, each a count and symbols
+//   prototypes: count, each the arguments (a count and symbols), a frame and the origin:
+//               0 or 1 and the symbol of the name, the line and the column
+//   objects:    count, a creation record per object
+//   contents of the cells, vectors and scopes, in the order of the objects; a cell has its
+//   line after the references, and the column if the line isn't 0; a lambda frame starts
+//   with its unassigned slots (a count and indices), the other slots follow
+//   bodies of the prototypes
+//   contents of the hash tables, last: the hashes of the keys depend on their contents
+//   root
+// A reference to an object is its number plus one, 0 is the empty list. Objects are
+// created before they are filled, so cycles need no special care; the parents of scopes
+// and lambdas, which are set on creation, are numbered before them.
+
+namespace {
+
+constexpr std::string_view kMagic = "SCMIMG3\n";
+
+enum class Tag : uint8_t {
+    kNumber,
+    kBigNumber,
+    kSymbol,
+    kLocalSymbol,
+    kBoolean,
+    kString,
+    kCharacter,
+    kCell,
+    kVector,
+    kHashTable,
+    kScope,
+    kLambda,
+    kBuiltin,
+};
+
+// FNV-1a
+uint64_t Checksum(std::string_view data) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * 0x100000001b3;
+    }
+    return hash;
+}
+
+void PutNumber(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *out += static_cast<char>(value);
+}
+
+void PutString(std::string* out, std::string_view text) {
+    PutNumber(out, text.size());
+    *out += text;
+}
+
+void PutTag(std::string* out, Tag tag) {
+    *out += static_cast<char>(tag);
+}
+
+class ImageWriter {
+public:
+    explicit ImageWriter(const BuiltinTable& builtins) {
+        for (auto& [name, obj] : builtins) {
+            builtin_names_.emplace(obj.get(), name);
+        }
+    }
+
+    std::string Save(const std::shared_ptr<Scope>& root) {
+        NumberAll(root.get());
+
+        std::string objects;
+        PutNumber(&objects, objects_.size());
+        for (const Object* obj : objects_) {
+            PutCreation(&objects, obj);
+        }
+        std::string contents;
+        for (const Object* obj : objects_) {
+            if (obj->GetType() != ObjectType::kHashTable) {
+                PutContents(&contents, obj);
+            }
+        }
+        for (const LambdaPrototype* prototype : prototypes_) {
+            PutNumber(&contents, prototype->body.size());
+            PutReferences(&contents, prototype->body);
+        }
+        for (const Object* obj : objects_) {
+            if (obj->GetType() == ObjectType::kHashTable) {
+                PutContents(&contents, obj);
+            }
+        }
+        PutReference(&contents, root.get());
+
+        std::string tables;
+        PutNumber(&tables, frames_.size());
+        for (const SlotNames* frame : frames_) {
+            PutSymbols(&tables, *frame);
+        }
+        PutNumber(&tables, prototypes_.size());
+        for (const LambdaPrototype* prototype : prototypes_) {
+            PutSymbols(&tables, prototype->args);
+            PutNumber(&tables, frame_ids_.at(prototype->frame.get()));
+            const LambdaOrigin& origin = prototype->origin;
+            PutNumber(&tables, origin.name != nullptr);
+            if (origin.name) {
+                PutSymbol(&tables, origin.name->GetId());
+            }
+            PutNumber(&tables, origin.location.line);
+            PutNumber(&tables, origin.location.column);
+        }
+
+        std::string payload;
+        PutNumber(&payload, symbols_.size());
+        for (SymbolId id : symbols_) {
+            PutString(&payload, Symbol::FromId(id)->GetName());
+        }
+        payload += tables + objects + contents;
+        std::string res(kMagic);
+        uint64_t checksum = Checksum(payload);
+        for (int i = 0; i < 8; i++) {
+            res += static_cast<char>(checksum >> (8 * i));
+        }
+        return res + payload;
+    }
+
+private:
+    std::unordered_map<const Object*, SymbolId> builtin_names_;
+    std::unordered_map<const Object*, uint64_t> ids_;
+    std::vector<const Object*> objects_;
+    std::unordered_map<SymbolId, uint64_t> symbol_ids_;
+    std::vector<SymbolId> symbols_;
+    std::unordered_map<const SlotNames*, uint64_t> frame_ids_;
+    std::vector<const SlotNames*> frames_;
+    std::unordered_map<const LambdaPrototype*, uint64_t> prototype_ids_;
+    std::vector<const LambdaPrototype*> prototypes_;
+
+    // Object that has to exist before `obj` is created
+    static const Object* GetCreationParent(const Object* obj) {
+        if (obj->GetType() == ObjectType::kScope) {
+            return static_cast<const Scope*>(obj)->GetParent().get();
+        }
+        if (obj->GetType() == ObjectType::kLambda) {
+            return static_cast<const LambdaFunctor*>(obj)->GetParentScope().get();
+        }
+        return nullptr;
+    }
+
+    // Numbers everything reachable from `root`, with an explicit stack: lists may be
+    // millions of cells long
+    void NumberAll(const Object* root) {
+        std::vector<const Object*> stack{root};
+        auto push = [this, &stack](const std::shared_ptr<Object>& obj) {
+            if (obj && !ids_.contains(obj.get())) {
+                stack.push_back(obj.get());
+            }
+        };
+        while (!stack.empty()) {
+            const Object* obj = stack.back();
+            if (ids_.contains(obj)) {
+                stack.pop_back();
+                continue;
+            }
+            const Object* parent = builtin_names_.contains(obj) ? nullptr : GetCreationParent(obj);
+            if (parent && !ids_.contains(parent)) {
+                stack.push_back(parent);
+                continue;
+            }
+            stack.pop_back();
+            ids_.emplace(obj, objects_.size());
+            objects_.push_back(obj);
+            if (builtin_names_.contains(obj)) {
+                continue;
+            }
+            switch (obj->GetType()) {
+                case ObjectType::kCell:
+                    push(static_cast<const Cell*>(obj)->GetFirst());
+                    push(static_cast<const Cell*>(obj)->GetSecond());
+                    break;
+                case ObjectType::kVector:
+                    std::ranges::for_each(static_cast<const Vector*>(obj)->GetElements(), push);
+                    break;
+                case ObjectType::kHashTable:
+                    for (auto& [key, value] : static_cast<const HashTable*>(obj)->GetEntries()) {
+                        push(key);
+                        push(value);
+                    }
+                    break;
+                case ObjectType::kScope: {
+                    const Scope* scope = static_cast<const Scope*>(obj);
+                    if (const SlotNames* frame = scope->GetSlotNames()) {
+                        AddFrame(frame);
+                        for (size_t i = 0; i < frame->size(); i++) {
+                            if (scope->GetSlotValue(i) != Scope::Unassigned()) {
+                                push(scope->GetSlotValue(i));
+                            }
+                        }
+                    }
+                    for (auto& [name, value] : scope->GetObjects()) {
+                        push(value);
+                    }
+                    break;
+                }
+                case ObjectType::kLambda: {
+                    const LambdaPrototype* prototype =
+                        static_cast<const LambdaFunctor*>(obj)->GetPrototype().get();
+                    if (!prototype_ids_.contains(prototype)) {
+                        prototype_ids_.emplace(prototype, prototypes_.size());
+                        prototypes_.push_back(prototype);
+                        AddFrame(prototype->frame.get());
+                        std::ranges::for_each(prototype->body, push);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    void AddFrame(const SlotNames* frame) {
+        if (!frame_ids_.contains(frame)) {
+            frame_ids_.emplace(frame, frames_.size());
+            frames_.push_back(frame);
+        }
+    }
+
+    void PutSymbol(std::string* out, SymbolId id) {
+        auto [it, inserted] = symbol_ids_.emplace(id, symbols_.size());
+        if (inserted) {
+            symbols_.push_back(id);
+        }
+        PutNumber(out, it->second);
+    }
+
+    void PutSymbols(std::string* out, const SlotNames& names) {
+        PutNumber(out, names.size());
+        for (SymbolId id : names) {
+            PutSymbol(out, id);
+        }
+    }
+
+    void PutReference(std::string* out, const Object* obj) {
+        PutNumber(out, obj ? ids_.at(obj) + 1 : 0);
+    }
+
+    void PutReferences(std::string* out, const ObjectVector& objects) {
+        for (auto& obj : objects) {
+            PutReference(out, obj.get());
+        }
+    }
+
+    void PutCreation(std::string* out, const Object* obj) {
+        if (auto it = builtin_names_.find(obj); it != builtin_names_.end()) {
+            PutTag(out, Tag::kBuiltin);
+            PutSymbol(out, it->second);
+            return;
+        }
+        switch (obj->GetType()) {
+            case ObjectType::kNumber: {
+                // zigzag, so small negative numbers are short too
+                int64_t value = static_cast<const Number*>(obj)->GetValue();
+                PutTag(out, Tag::kNumber);
+                PutNumber(out, (static_cast<uint64_t>(value) << 1) ^ (value < 0 ? ~0ull : 0));
+                return;
+            }
+            case ObjectType::kBigNumber:
+                PutTag(out, Tag::kBigNumber);
+                PutString(out, obj->Serialize());
+                return;
+            case ObjectType::kSymbol:
+                PutTag(out, Tag::kSymbol);
+                PutSymbol(out, static_cast<const Symbol*>(obj)->GetId());
+                return;
+            case ObjectType::kLocalSymbol: {
+                const LocalSymbol* local = static_cast<const LocalSymbol*>(obj);
+                PutTag(out, Tag::kLocalSymbol);
+                PutSymbol(out, local->GetId());
+                PutNumber(out, local->GetDepth());
+                PutNumber(out, local->GetSlot());
+                return;
+            }
+            case ObjectType::kBoolean:
+                PutTag(out, Tag::kBoolean);
+                *out += static_cast<char>(static_cast<const Boolean*>(obj)->GetValue());
+                return;
+            case ObjectType::kString: {
+                const Rope& text = static_cast<const String*>(obj)->GetValue();
+                PutTag(out, Tag::kString);
+                PutNumber(out, text.Size());
+                text.ForEachPiece([out](std::string_view piece) { *out += piece; });
+                return;
+            }
+            case ObjectType::kCharacter:
+                PutTag(out, Tag::kCharacter);
+                *out += static_cast<const Character*>(obj)->GetValue();
+                return;
+            case ObjectType::kCell:
+                PutTag(out, Tag::kCell);
+                return;
+            case ObjectType::kVector:
+                PutTag(out, Tag::kVector);
+                PutNumber(out, static_cast<const Vector*>(obj)->GetElements().size());
+                return;
+            case ObjectType::kHashTable:
+                PutTag(out, Tag::kHashTable);
+                return;
+            case ObjectType::kScope: {
+                const Scope* scope = static_cast<const Scope*>(obj);
+                const SlotNames* frame = scope->GetSlotNames();
+                PutTag(out, Tag::kScope);
+                PutReference(out, scope->GetParent().get());
+                PutNumber(out, frame ? frame_ids_.at(frame) + 1 : 0);
+                return;
+            }
+            case ObjectType::kLambda: {
+                const LambdaFunctor* lambda = static_cast<const LambdaFunctor*>(obj);
+                PutTag(out, Tag::kLambda);
+                PutNumber(out, prototype_ids_.at(lambda->GetPrototype().get()));
+                PutReference(out, lambda->GetParentScope().get());
+                return;
+            }
+            default:
+                throw RuntimeError("Can't save an object of type " +
+                                   std::to_string(static_cast<int>(obj->GetType())) +
+                                   " to an image");
+        }
+    }
+
+    void PutContents(std::string* out, const Object* obj) {
+        if (builtin_names_.contains(obj)) {
+            return;
+        }
+        switch (obj->GetType()) {
+            case ObjectType::kCell: {
+                const Cell* cell = static_cast<const Cell*>(obj);
+                PutReference(out, cell->GetFirst().get());
+                PutReference(out, cell->GetSecond().get());
+                SourceLocation location = cell->GetLocation();
+                PutNumber(out, location.line);
+                if (location.line) {
+                    PutNumber(out, location.column);
+                }
+                return;
+            }
+            case ObjectType::kVector:
+                PutReferences(out, static_cast<const Vector*>(obj)->GetElements());
+                return;
+            case ObjectType::kHashTable: {
+                auto entries = static_cast<const HashTable*>(obj)->GetEntries();
+                PutNumber(out, entries.size());
+                for (auto& [key, value] : entries) {
+                    PutReference(out, key.get());
+                    PutReference(out, value.get());
+                }
+                return;
+            }
+            case ObjectType::kScope: {
+                const Scope* scope = static_cast<const Scope*>(obj);
+                if (const SlotNames* frame = scope->GetSlotNames()) {
+                    std::vector<size_t> unassigned;
+                    for (size_t i = 0; i < frame->size(); i++) {
+                        if (scope->GetSlotValue(i) == Scope::Unassigned()) {
+                            unassigned.push_back(i);
+                        }
+                    }
+                    PutNumber(out, unassigned.size());
+                    for (size_t i : unassigned) {
+                        PutNumber(out, i);
+                    }
+                    for (size_t i = 0; i < frame->size(); i++) {
+                        if (scope->GetSlotValue(i) != Scope::Unassigned()) {
+                            PutReference(out, scope->GetSlotValue(i).get());
+                        }
+                    }
+                }
+                auto objects = scope->GetObjects();
+                PutNumber(out, objects.size());
+                for (auto& [name, value] : objects) {
+                    PutSymbol(out, name);
+                    PutReference(out, value.get());
+                }
+                return;
+            }
+            default:
+                return;
+        }
+    }
+};
+
+class ImageReader {
+public:
+    ImageReader(std::string_view image, const BuiltinTable& builtins)
+        : image_(image), builtins_(builtins) {
+    }
+
+    std::shared_ptr<Scope> Load() {
+        if (!image_.starts_with(kMagic) || image_.size() < kMagic.size() + 8) {
+            Fail();
+        }
+        uint64_t checksum = 0;
+        for (int i = 0; i < 8; i++) {
+            checksum |= static_cast<uint64_t>(static_cast<uint8_t>(image_[kMagic.size() + i]))
+                        << (8 * i);
+        }
+        pos_ = kMagic.size() + 8;
+        if (Checksum(image_.substr(pos_)) != checksum) {
+            Fail();
+        }
+        for (uint64_t count = GetNumber(); count > 0; count--) {
+            symbols_.push_back(Symbol::Intern(GetString()));
+        }
+        for (uint64_t count = GetNumber(); count > 0; count--) {
+            frames_.push_back(std::make_shared<const SlotNames>(GetSymbols()));
+        }
+        for (uint64_t count = GetNumber(); count > 0; count--) {
+            SlotNames args = GetSymbols();
+            std::shared_ptr<const SlotNames> frame = frames_[GetIndex(frames_.size())];
+            LambdaOrigin origin;
+            if (GetIndex(2)) {
+                origin.name = symbols_[GetIndex(symbols_.size())];
+            }
+            origin.location.line = GetNumber();
+            origin.location.column = GetNumber();
+            prototypes_.push_back(
+                std::make_shared<LambdaPrototype>(std::move(args), frame, std::move(origin)));
+        }
+        prototype_parents_.resize(prototypes_.size());
+
+        uint64_t count = GetNumber();
+        if (count > image_.size()) {
+            Fail();  // at least a byte each
+        }
+        objects_.reserve(count);
+        for (uint64_t i = 0; i < count; i++) {
+            objects_.push_back(Create());
+        }
+        for (auto& obj : objects_) {
+            if (obj->GetType() != ObjectType::kHashTable) {
+                Fill(obj);
+            }
+        }
+        for (auto& prototype : prototypes_) {
+            prototype->body = GetReferences(GetNumber());
+        }
+        for (auto& obj : objects_) {
+            if (obj->GetType() == ObjectType::kHashTable) {
+                Fill(obj);
+            }
+        }
+        std::shared_ptr<Scope> root = As<Scope>(GetReference());
+        if (!root || pos_ != image_.size()) {
+            Fail();
+        }
+        // everything is in place now, as the compilers expect
+        for (size_t i = 0; i < prototypes_.size(); i++) {
+            if (prototype_parents_[i]) {
+                prototypes_[i]->Prepare(prototype_parents_[i]);
+            }
+        }
+        return root;
+    }
+
+private:
+    std::string_view image_;
+    size_t pos_ = 0;
+    const BuiltinTable& builtins_;
+    std::vector<std::shared_ptr<Symbol>> symbols_;
+    std::vector<std::shared_ptr<const SlotNames>> frames_;
+    std::vector<std::shared_ptr<LambdaPrototype>> prototypes_;
+    std::vector<std::shared_ptr<Scope>> prototype_parents_;  // of a lambda made from each
+    ObjectVector objects_;
+
+    [[noreturn]] static void Fail() {
+        throw RuntimeError("Malformed image");
+    }
+
+    uint8_t GetByte() {
+        if (pos_ == image_.size()) {
+            Fail();
+        }
+        return image_[pos_++];
+    }
+
+    uint64_t GetNumber() {
+        uint64_t res = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = GetByte();
+            res |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return res;
+            }
+        }
+        Fail();
+    }
+
+    uint64_t GetIndex(size_t size) {
+        uint64_t res = GetNumber();
+        if (res >= size) {
+            Fail();
+        }
+        return res;
+    }
+
+    std::string_view GetString() {
+        uint64_t size = GetNumber();
+        if (size > image_.size() - pos_) {
+            Fail();
+        }
+        std::string_view res = image_.substr(pos_, size);
+        pos_ += size;
+        return res;
+    }
+
+    const Symbol& GetSymbol() {
+        return *symbols_[GetIndex(symbols_.size())];
+    }
+
+    SlotNames GetSymbols() {
+        uint64_t count = GetNumber();
+        if (count > image_.size() - pos_) {
+            Fail();
+        }
+        SlotNames res(count);
+        for (auto& id : res) {
+            id = GetSymbol().GetId();
+        }
+        return res;
+    }
+
+    // An object created so far
+    std::shared_ptr<Object> GetReference() {
+        uint64_t ref = GetIndex(objects_.size() + 1);
+        return ref ? objects_[ref - 1] : nullptr;
+    }
+
+    ObjectVector GetReferences(uint64_t count) {
+        if (count > image_.size() - pos_) {
+            Fail();
+        }
+        ObjectVector res(count);
+        for (auto& obj : res) {
+            obj = GetReference();
+        }
+        return res;
+    }
+
+    std::shared_ptr<Object> Create() {
+        switch (static_cast<Tag>(GetByte())) {
+            case Tag::kNumber: {
+                uint64_t value = GetNumber();
+                return Number::FromValue(static_cast<int64_t>(value >> 1) ^
+                                         -static_cast<int64_t>(value & 1));
+            }
+            case Tag::kBigNumber: {
+                std::string_view text = GetString();
+                std::string_view digits = text.substr(text.starts_with('-'));
+                auto is_digit = [](char c) { return '0' <= c && c <= '9'; };
+                if (digits.empty() || !std::ranges::all_of(digits, is_digit)) {
+                    Fail();
+                }
+                return Make<BigNumber>(BigInt::FromString(text));
+            }
+            case Tag::kSymbol:
+                return symbols_[GetIndex(symbols_.size())];
+            case Tag::kLocalSymbol: {
+                const Symbol& symbol = GetSymbol();
+                size_t depth = GetNumber();
+                return Make<LocalSymbol>(symbol, depth, GetNumber());
+            }
+            case Tag::kBoolean:
+                return Boolean::FromValue(GetByte());
+            case Tag::kString:
+                return Make<String>(Rope(GetString()));
+            case Tag::kCharacter:
+                return Character::FromValue(GetByte());
+            case Tag::kCell:
+                return Make<Cell>();
+            case Tag::kVector: {
+                uint64_t size = GetNumber();
+                if (size > image_.size()) {
+                    Fail();
+                }
+                return Make<Vector>(ObjectVector(size));
+            }
+            case Tag::kHashTable:
+                return Make<HashTable>();
+            case Tag::kScope: {
+                std::shared_ptr<Object> parent = GetReference();
+                if (parent && !Is<Scope>(parent)) {
+                    Fail();
+                }
+                uint64_t frame = GetIndex(frames_.size() + 1);
+                if (!frame) {
+                    return Make<Scope>(As<Scope>(parent));
+                }
+                return Make<Scope>(As<Scope>(parent), frames_[frame - 1],
+                                   frames_[frame - 1]->size());
+            }
+            case Tag::kLambda: {
+                uint64_t prototype = GetIndex(prototypes_.size());
+                std::shared_ptr<Scope> parent = As<Scope>(GetReference());
+                if (!parent) {
+                    Fail();
+                }
+                if (!prototype_parents_[prototype]) {
+                    prototype_parents_[prototype] = parent;
+                }
+                return Make<LambdaFunctor>(prototypes_[prototype], parent);
+            }
+            case Tag::kBuiltin: {
+                auto it = builtins_.find(GetSymbol().GetId());
+                if (it == builtins_.end()) {
+                    Fail();
+                }
+                return it->second;
+            }
+            default:
+                Fail();
+        }
+    }
+
+    void Fill(const std::shared_ptr<Object>& obj) {
+        switch (obj->GetType()) {
+            case ObjectType::kCell: {
+                Cell* cell = AsPtr<Cell>(obj);
+                cell->SetFirst(GetReference());
+                cell->SetSecond(GetReference());
+                SourceLocation location;
+                location.line = GetNumber();
+                if (location.line) {
+                    location.column = GetNumber();
+                }
+                cell->SetLocation(location);
+                return;
+            }
+            case ObjectType::kVector: {
+                ObjectVector& elements = AsPtr<Vector>(obj)->GetElements();
+                elements = GetReferences(elements.size());
+                return;
+            }
+            case ObjectType::kHashTable: {
+                HashTable* table = AsPtr<HashTable>(obj);
+                for (uint64_t count = GetNumber(); count > 0; count--) {
+                    std::shared_ptr<Object> key = GetReference();
+                    table->Set(key, GetReference());
+                }
+                return;
+            }
+            case ObjectType::kScope: {
+                Scope* scope = AsPtr<Scope>(obj);
+                if (const SlotNames* frame = scope->GetSlotNames()) {
+                    std::vector<bool> unassigned(frame->size());
+                    for (uint64_t count = GetNumber(); count > 0; count--) {
+                        unassigned[GetIndex(frame->size())] = true;
+                    }
+                    for (size_t i = 0; i < frame->size(); i++) {
+                        scope->SetSlot(0, i, unassigned[i] ? Scope::Unassigned() : GetReference());
+                    }
+                }
+                for (uint64_t count = GetNumber(); count > 0; count--) {
+                    const Symbol& name = GetSymbol();
+                    scope->Define(name, GetReference());
+                }
+                return;
+            }
+            default:
+                return;
+        }
+    }
+};
+
+}  // namespace
+
+std::string SaveImage(const std::shared_ptr<Scope>& root, const BuiltinTable& builtins) {
+    return ImageWriter(builtins).Save(root);
+}
+
+std::shared_ptr<Scope> LoadImage(std::string_view image, const BuiltinTable& builtins) {
+    return ImageReader(image, builtins).Load();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "object.h"
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Images of a global scope: the scope and everything reachable from it (definitions,
+// closures with their frames, data) in a compact binary form, so an interpreter can be
+// warmed up once and then restored without reading and evaluating the source again.
+//
+// Objects are numbered and refer to each other by number, symbols by their index in a
+// table of names stored once. The builtins are stored by the name they are bound to in
+// `builtins` and bound to the instances of the loading process. Lambdas keep their
+// resolved bodies and are compiled again when loaded.
+
+// Throws RuntimeError if something reachable from `root` can't be stored
+std::string SaveImage(const std::shared_ptr<Scope>& root, const BuiltinTable& builtins);
+
+// Rebuilds a scope saved by SaveImage. Its objects are registered in the current heap and
+// its lambdas compiled for the current engine. Throws RuntimeError if `image` is malformed.
+std::shared_ptr<Scope> LoadImage(std::string_view image, const BuiltinTable& builtins);
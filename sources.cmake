@@ -7,4 +7,23 @@ add_library(scheme_advanced
         functors.cpp
         helpers.cpp
         object.cpp
+        resolver.cpp
+        gc.cpp
+        engine.cpp
+        compiler.cpp
+        vm.cpp
+        ast.cpp
+        args.cpp
+        file.cpp
+        bigint.cpp
+        numeric.cpp
+        rope.cpp
+        hashtable.cpp
+        printer.cpp
+        pool.cpp
+        snapshot.cpp
+        profiler.cpp
+        cache.cpp
+        optimizer.cpp
+        budget.cpp
 )
@@ -1,8 +1,143 @@
 #include <tokenizer.h>
 #include "error.h"
+#include <bit>
+#include <iterator>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool IsSpace(char c) {
+    return c == ' ' || ('\t' <= c && c <= '\r');
+}
+
+bool IsDigit(char c) {
+    return '0' <= c && c <= '9';
+}
+
+bool IsFirstSymbolChar(char c) {
+    if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+        return true;
+    }
+    return c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+}
+
+bool IsSymbolChar(char c) {
+    if (IsFirstSymbolChar(c)) {
+        return true;
+    }
+    return IsDigit(c) || c == '?' || c == '!' || c == '-';
+}
+
+// The scanners below look at 16 bytes at a time where SSE2 is available. Both end with
+// the scalar loop, which also handles the tail of the buffer.
+
+#ifdef __SSE2__
+constexpr size_t kBlockSize = 16;
+
+__m128i Load(std::string_view source, size_t pos) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source.data() + pos));
+}
+
+// Bytes of `block` in [first, first + count)
+__m128i InRange(__m128i block, char first, char count) {
+    __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8(first));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(count - 1)), offset);
+}
+
+__m128i Equal(__m128i block, char c) {
+    return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+// Index of the first byte not set in `matches`, kBlockSize if all of them are
+size_t FirstMismatch(__m128i matches) {
+    return std::countr_zero(static_cast<unsigned>(~_mm_movemask_epi8(matches)));
+}
+#endif
+
+// Position of the first non-space byte at `pos` or after it
+size_t SkipSpaces(std::string_view source, size_t pos) {
+#ifdef __SSE2__
+    // tokens are mostly separated by a single space
+    if (pos + 1 < source.size() && !IsSpace(source[pos + 1])) {
+        return IsSpace(source[pos]) ? pos + 1 : pos;
+    }
+    for (; pos + kBlockSize <= source.size(); pos += kBlockSize) {
+        __m128i block = Load(source, pos);
+        size_t skip = FirstMismatch(_mm_or_si128(Equal(block, ' '), InRange(block, '\t', 5)));
+        if (skip < kBlockSize) {
+            return pos + skip;
+        }
+    }
+#endif
+    while (pos < source.size() && IsSpace(source[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+// Position of the first byte at `pos` or after it that can't be a part of a symbol
+size_t SkipSymbolChars(std::string_view source, size_t pos) {
+#ifdef __SSE2__
+    for (; pos + kBlockSize <= source.size(); pos += kBlockSize) {
+        __m128i block = Load(source, pos);
+        __m128i letters = InRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 26);
+        __m128i digits = InRange(block, '0', 10);
+        __m128i comparisons = InRange(block, '<', 4);  // < = > ?
+        __m128i others = _mm_or_si128(
+            _mm_or_si128(Equal(block, '*'), Equal(block, '/')),
+            _mm_or_si128(Equal(block, '#'), _mm_or_si128(Equal(block, '!'), Equal(block, '-'))));
+        size_t skip = FirstMismatch(_mm_or_si128(_mm_or_si128(letters, digits),
+                                                 _mm_or_si128(comparisons, others)));
+        if (skip < kBlockSize) {
+            return pos + skip;
+        }
+    }
+#endif
+    while (pos < source.size() && IsSymbolChar(source[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+// Value of the escape sequence `\\c` in a string literal
+char Unescape(char c) {
+    switch (c) {
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case '"':
+        case '\\':
+            return c;
+        default:
+            throw SyntaxError(std::string("unknown escape sequence \\") + c);
+    }
+}
+
+// Character named `name` in a #\name literal
+char CharByName(std::string_view name) {
+    if (name.size() == 1) {
+        return name[0];
+    }
+    if (name == "space") {
+        return ' ';
+    }
+    if (name == "newline") {
+        return '\n';
+    }
+    if (name == "tab") {
+        return '\t';
+    }
+    throw SyntaxError("unknown character #\\" + std::string(name));
+}
+
+}  // namespace
 
 bool SymbolToken::operator==(const SymbolToken& other) const {
-    return name == other.name;
+    return symbol == other.symbol;
 }
 
 bool QuoteToken::operator==(const QuoteToken&) const {
@@ -17,105 +152,138 @@ bool ConstantToken::operator==(const ConstantToken& other) const {
     return value == other.value;
 }
 
-Tokenizer::Tokenizer(std::istream* in) : in_(in) {
+bool BigConstantToken::operator==(const BigConstantToken& other) const {
+    return value == other.value;
+}
+
+bool StringToken::operator==(const StringToken& other) const {
+    return value == other.value;
+}
+
+bool CharToken::operator==(const CharToken& other) const {
+    return value == other.value;
+}
+
+Tokenizer::Tokenizer(std::istream* in)
+    : storage_(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>()),
+      source_(storage_) {
     Next();
 }
 
-bool Tokenizer::IsEnd() {
-    try {
-        return std::get<NoToken>(last_token_) == NoToken();
-    } catch (...) {
-        return false;
-    }
+Tokenizer::Tokenizer(std::string_view source) : source_(source) {
+    Next();
 }
 
-void Tokenizer::SkipSpaces() {
-    while (isspace(in_->peek())) {
-        (void)in_->get();
-    }
+bool Tokenizer::IsEnd() const {
+    return std::holds_alternative<NoToken>(last_token_);
 }
 
 void Tokenizer::Next() {
-    SkipSpaces();
-    if (in_->peek() == EOF) {
+    pos_ = SkipSpaces(source_, pos_);
+    start_ = pos_;
+    if (pos_ == source_.size()) {
         last_token_ = NoToken();
         return;
     }
-    if (in_->peek() == '+' || in_->peek() == '-') {
-        char c = in_->get();
-        // operator or number
-        if (!isdigit(in_->peek())) {
-            last_token_ = SymbolToken{std::string(1, c)};
-            return;
-        }
-        // number
-        long long num = 0;
-        while (in_->peek() != EOF && isdigit(in_->peek())) {
-            num = num * 10 + (in_->get() - '0');
-        }
-        if (c == '-') {
-            num *= -1;
-        }
-        last_token_ = ConstantToken{static_cast<int>(num)};
+    size_t start = pos_;
+    char c = source_[pos_];
+    bool sign = c == '+' || c == '-';
+    if (sign && (pos_ + 1 == source_.size() || !IsDigit(source_[pos_ + 1]))) {
+        // operator
+        pos_++;
+        last_token_ = SymbolToken{Symbol::Intern(source_.substr(start, 1))};
         return;
     }
-    if (isdigit(in_->peek())) {
-        long long num = 0;
-        while (isdigit(in_->peek())) {
-            num = num * 10 + (in_->get() - '0');
+    if (sign || IsDigit(c)) {
+        pos_ += sign;
+        uint64_t magnitude = 0;
+        bool overflow = false;
+        while (pos_ < source_.size() && IsDigit(source_[pos_])) {
+            uint64_t digit = source_[pos_++] - '0';
+            overflow |= magnitude > (UINT64_MAX - digit) / 10;
+            magnitude = magnitude * 10 + digit;
+        }
+        uint64_t limit = uint64_t(INT64_MAX) + (c == '-');
+        if (overflow || magnitude > limit) {
+            last_token_ = BigConstantToken{BigInt::FromString(source_.substr(start, pos_ - start))};
+        } else {
+            last_token_ = ConstantToken{c == '-' ? static_cast<int64_t>(0 - magnitude)
+                                                 : static_cast<int64_t>(magnitude)};
         }
-        last_token_ = ConstantToken{static_cast<int>(num)};
         return;
     }
-    if (in_->peek() == '(') {
-        (void)in_->get();
+    if (c == '(') {
+        pos_++;
         last_token_ = BracketToken::OPEN;
         return;
     }
-    if (in_->peek() == ')') {
-        (void)in_->get();
+    if (c == ')') {
+        pos_++;
         last_token_ = BracketToken::CLOSE;
         return;
     }
-    if (in_->peek() == '\'') {
-        (void)in_->get();
+    if (c == '\'') {
+        pos_++;
         last_token_ = QuoteToken();
         return;
     }
-    if (in_->peek() == '.') {
-        (void)in_->get();
+    if (c == '.') {
+        pos_++;
         last_token_ = DotToken();
         return;
     }
-    if (IsFirstSymbolChar(in_->peek())) {
-        std::string res = std::string(1, in_->get());
-        while (IsSymbolChar(in_->peek())) {
-            res.push_back(in_->get());
+    if (c == '"') {
+        std::string value;
+        pos_++;
+        while (true) {
+            size_t end = source_.find_first_of("\"\\", pos_);
+            if (end == std::string_view::npos ||
+                (source_[end] == '\\' && end + 1 == source_.size())) {
+                throw SyntaxError("unterminated string literal");
+            }
+            value += source_.substr(pos_, end - pos_);
+            pos_ = end + 1;
+            if (source_[end] == '"') {
+                break;
+            }
+            value += Unescape(source_[pos_++]);
         }
-        last_token_ = SymbolToken{res};
+        last_token_ = StringToken{std::move(value)};
+        return;
+    }
+    if (c == '#' && pos_ + 2 < source_.size() && source_[pos_ + 1] == '\\') {
+        // the character after #\ is taken as is, unless it starts a name like #\space
+        pos_ = IsFirstSymbolChar(source_[pos_ + 2]) ? SkipSymbolChars(source_, pos_ + 3) : pos_ + 3;
+        last_token_ = CharToken{CharByName(source_.substr(start + 2, pos_ - start - 2))};
+        return;
+    }
+    if (IsFirstSymbolChar(c)) {
+        pos_ = SkipSymbolChars(source_, pos_ + 1);
+        last_token_ = SymbolToken{Symbol::Intern(source_.substr(start, pos_ - start))};
         return;
     }
 
-    throw SyntaxError(std::string("found strange symbol '") + std::string(1, in_->peek()) +
+    throw SyntaxError(std::string("found strange symbol '") + std::string(1, c) +
                       std::string("'"));
 }
 
-Token Tokenizer::GetToken() {
+const Token& Tokenizer::GetToken() const {
     return last_token_;
 }
 
-bool Tokenizer::IsFirstSymbolChar(char c) {
-    if (isalpha(c)) {
-        return true;
-    }
-    return c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+size_t Tokenizer::GetPosition() const {
+    return pos_;
 }
 
-bool Tokenizer::IsSymbolChar(char c) {
-    if (IsFirstSymbolChar(c)) {
-        return true;
+SourceLocation Tokenizer::GetLocation() {
+    std::string_view before = source_.substr(0, start_);
+    for (size_t i = before.find('\n', counted_); i != std::string_view::npos;
+         i = before.find('\n', i + 1)) {
+        line_++;
+        line_start_ = i + 1;
     }
-    return isdigit(c) || c == '?' || c == '!' || c == '-';
+    counted_ = start_;
+    return {line_, static_cast<uint32_t>(start_ - line_start_ + 1)};
 }
 
 bool NoToken::operator==([[maybe_unused]] const NoToken& other) const {
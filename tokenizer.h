@@ -4,13 +4,16 @@
 #include <optional>
 #include <istream>
 #include <string>
+#include <string_view>
+#include <memory>
+#include "object.h"
 
 struct NoToken {
     bool operator==(const NoToken& other) const;
 };
 
 struct SymbolToken {
-    std::string name;
+    std::shared_ptr<Symbol> symbol;  // interned, so tokens are compared by pointer
 
     bool operator==(const SymbolToken& other) const;
 };
@@ -26,40 +29,71 @@ struct DotToken {
 enum class BracketToken { OPEN, CLOSE };
 
 struct ConstantToken {
-    int value;
+    int64_t value;
 
     bool operator==(const ConstantToken& other) const;
 };
 
-using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken, NoToken>;
+// Integer literal that doesn't fit into int64_t
+struct BigConstantToken {
+    BigInt value;
 
+    bool operator==(const BigConstantToken& other) const;
+};
+
+// String literal with the escapes replaced
+struct StringToken {
+    std::string value;
+
+    bool operator==(const StringToken& other) const;
+};
+
+struct CharToken {
+    char value;
+
+    bool operator==(const CharToken& other) const;
+};
+
+using Token = std::variant<ConstantToken, BigConstantToken, BracketToken, SymbolToken, QuoteToken,
+                           DotToken, StringToken, CharToken, NoToken>;
+
+// Splits a contiguous buffer into tokens. Symbol names are interned straight from the
+// buffer, only string literals are copied.
 class Tokenizer {
 public:
+    // Reads the whole stream into a buffer of its own
     Tokenizer(std::istream* in);
 
-    bool IsEnd();
+    // `source` must outlive the tokenizer
+    explicit Tokenizer(std::string_view source);
+
+    bool IsEnd() const;
 
     void Next();
 
-    Token GetToken();
+    const Token& GetToken() const;
 
-private:
-    std::istream* in_;
-    Token last_token_;
+    // Offset of the first character after the current token
+    size_t GetPosition() const;
 
-    void SkipSpaces();
+    // Line and column of the first character of the current token. The lines are counted
+    // on demand, from where the previous call stopped.
+    SourceLocation GetLocation();
 
-    static bool IsFirstSymbolChar(char c);
+private:
+    std::string storage_;  // the stream contents, if it was given one
+    std::string_view source_;
+    size_t pos_ = 0;
+    size_t start_ = 0;  // of the current token
+    Token last_token_;
 
-    static bool IsSymbolChar(char c);
+    // newlines before `counted_` are counted
+    size_t counted_ = 0;
+    uint32_t line_ = 1;
+    size_t line_start_ = 0;
 };
 
 template <class T>
 bool IsTokenT(const Token& obj) {
-    try {
-        (void)std::get<T>(obj);
-    } catch (std::bad_variant_access) {
-        return false;
-    }
-    return true;
+    return std::holds_alternative<T>(obj);
 }
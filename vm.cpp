@@ -0,0 +1,245 @@
+#include "bytecode.h"
+#include "functors.h"
+#include "profiler.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SCHEME_COMPUTED_GOTO
+#endif
+
+namespace {
+
+// Caller of the running code
+struct Frame {
+    std::shared_ptr<const Code> code;
+    size_t pc;
+    std::shared_ptr<Scope> scope;
+    size_t base;
+};
+
+constexpr size_t kInitialStackSize = 64;
+
+}  // namespace
+
+std::shared_ptr<Object> Execute(std::shared_ptr<const Code> code, std::shared_ptr<Scope> scope) {
+    ObjectVector stack;
+    stack.reserve(kInitialStackSize);
+    std::vector<Frame> frames;
+    const Instruction* instructions = code->instructions.data();
+    const Instruction* instruction = nullptr;
+    size_t pc = 0;
+    size_t base = 0;  // stack size when the running code was entered
+    // a compiled lambda is reported on entering, until its kReturn or a tail call
+    ProfileScope profile;
+
+    // Makes the compiled `lambda` the running code, its frame gets the `count` values on top
+    // of the stack. The values and the callee under them are popped.
+    auto enter = [&](const LambdaFunctor* lambda, size_t count) {
+        std::shared_ptr<Scope> frame = lambda->MakeFrame(ObjectSpan(stack).last(count));
+        code = lambda->GetPrototype()->code;
+        stack.resize(stack.size() - count - 1);
+        instructions = code->instructions.data();
+        pc = 0;
+        scope = std::move(frame);
+    };
+
+    // Calls a procedure or a tree-walked lambda, replacing it and its arguments with the result
+    auto call = [&](Object* callee, size_t count) {
+        ObjectSpan args = ObjectSpan(stack).last(count);
+        std::shared_ptr<Object> res;
+        if (callee->GetType() == ObjectType::kProcedure) {
+            profile.Call(callee);
+            res = static_cast<IProcedure*>(callee)->Apply(args);
+            profile.Return();
+        } else {
+            const LambdaFunctor* lambda = static_cast<const LambdaFunctor*>(callee);
+            res = lambda->Run(lambda->MakeFrame(args));
+        }
+        stack.resize(stack.size() - count);
+        stack.back() = std::move(res);
+    };
+
+#ifdef SCHEME_COMPUTED_GOTO
+    // same order as Op
+    static void* const kTargets[] = {
+        &&op_kConst,  &&op_kLocal,       &&op_kGlobal, &&op_kSetLocal,  &&op_kSetGlobal,
+        &&op_kDefine, &&op_kPop,         &&op_kJump,   &&op_kBranch,    &&op_kAnd,
+        &&op_kOr,     &&op_kPrepareCall, &&op_kCall,   &&op_kTailCall,  &&op_kReturn,
+        &&op_kLambda, &&op_kEval,        &&op_kGuard,
+    };
+#define TARGET(op) op_##op:
+#define DISPATCH()                                            \
+    do {                                                      \
+        instruction = &instructions[pc++];                    \
+        goto* kTargets[static_cast<size_t>(instruction->op)]; \
+    } while (false)
+#else
+#define TARGET(op) case Op::op:
+#define DISPATCH() continue
+#endif
+
+    while (true) {
+#ifdef SCHEME_COMPUTED_GOTO
+        DISPATCH();
+        {
+#else
+        instruction = &instructions[pc++];
+        switch (instruction->op) {
+#endif
+            TARGET(kConst) {
+                stack.push_back(code->constants[instruction->a]);
+                DISPATCH();
+            }
+            TARGET(kLocal) {
+                stack.push_back(scope->GetSlot(instruction->a, instruction->b));
+                DISPATCH();
+            }
+            TARGET(kGlobal) {
+                const std::shared_ptr<Object>& symbol = code->constants[instruction->a];
+                if (std::shared_ptr<Object>* binding = scope->FindGlobal(
+                        AsPtr<Symbol>(symbol)->GetId(), &code->globals[instruction->b])) {
+                    stack.push_back(*binding);
+                } else {
+                    symbol->Eval(scope);  // throws NameError
+                }
+                DISPATCH();
+            }
+            TARGET(kSetLocal) {
+                scope->AssignSlot(instruction->a, instruction->b, stack.back());
+                DISPATCH();
+            }
+            TARGET(kSetGlobal) {
+                const Symbol* symbol = AsPtr<Symbol>(code->constants[instruction->a]);
+                if (std::shared_ptr<Object>* binding =
+                        scope->FindGlobal(symbol->GetId(), &code->globals[instruction->b])) {
+                    *binding = stack.back();
+                } else {
+                    scope->Set(*symbol, stack.back());  // throws NameError
+                }
+                DISPATCH();
+            }
+            TARGET(kDefine) {
+                const std::shared_ptr<Object>& symbol = code->constants[instruction->a];
+                scope->Define(*AsPtr<Symbol>(symbol), std::move(stack.back()));
+                stack.back() = symbol;
+                DISPATCH();
+            }
+            TARGET(kPop) {
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(kJump) {
+                pc = instruction->a;
+                DISPATCH();
+            }
+            TARGET(kBranch) {
+                if (!Is<Boolean>(stack.back())) {
+                    throw RuntimeError("If statement returned not boolean");
+                }
+                if (!IsTrue(stack.back())) {
+                    pc = instruction->a;
+                }
+                stack.pop_back();
+                DISPATCH();
+            }
+            TARGET(kAnd) {
+                if (!IsTrue(stack.back())) {
+                    pc = instruction->a;
+                } else {
+                    stack.pop_back();
+                }
+                DISPATCH();
+            }
+            TARGET(kOr) {
+                if (IsTrue(stack.back())) {
+                    pc = instruction->a;
+                } else {
+                    stack.pop_back();
+                }
+                DISPATCH();
+            }
+            TARGET(kPrepareCall) {
+                const std::shared_ptr<Object>& callee = stack.back();
+                if (!Is<IFunctor>(callee)) {
+                    throw RuntimeError("Cell::first is not a functor");
+                }
+                if (callee->GetType() == ObjectType::kFunctor) {
+                    profile.Call(callee.get());
+                    stack.back() = AsPtr<IFunctor>(callee)->Calc(code->arguments[instruction->a],
+                                                                 scope);
+                    profile.Return();
+                    pc = instruction->b;
+                }
+                DISPATCH();
+            }
+            TARGET(kCall) {
+                Object* callee = stack[stack.size() - instruction->a - 1].get();
+                if (callee->GetType() == ObjectType::kLambda &&
+                    static_cast<LambdaFunctor*>(callee)->GetPrototype()->code) {
+                    frames.push_back({std::move(code), pc, std::move(scope), base});
+                    profile.Call(callee);
+                    enter(static_cast<LambdaFunctor*>(callee), instruction->a);
+                    base = stack.size();
+                } else {
+                    call(callee, instruction->a);
+                }
+                DISPATCH();
+            }
+            TARGET(kTailCall) {
+                Object* callee = stack[stack.size() - instruction->a - 1].get();
+                if (callee->GetType() == ObjectType::kLambda &&
+                    static_cast<LambdaFunctor*>(callee)->GetPrototype()->code) {
+                    profile.TailCall(callee);
+                    enter(static_cast<LambdaFunctor*>(callee), instruction->a);
+                    stack.resize(base);
+                } else {
+                    call(callee, instruction->a);
+                }
+                DISPATCH();
+            }
+            TARGET(kReturn) {
+                if (frames.empty()) {
+                    return std::move(stack.back());
+                }
+                std::shared_ptr<Object> res = std::move(stack.back());
+                stack.resize(base);
+                profile.Return();
+                Frame& frame = frames.back();
+                code = std::move(frame.code);
+                instructions = code->instructions.data();
+                pc = frame.pc;
+                scope = std::move(frame.scope);
+                base = frame.base;
+                frames.pop_back();
+                stack.push_back(std::move(res));
+                DISPATCH();
+            }
+            TARGET(kLambda) {
+                const LambdaSite& site = code->lambdas[instruction->a];
+                if (!site.prototype) {
+                    site.prototype =
+                        std::make_shared<LambdaPrototype>(site.args, site.body, scope, site.origin);
+                }
+                stack.push_back(Make<LambdaFunctor>(site.prototype, scope));
+                DISPATCH();
+            }
+            TARGET(kEval) {
+                stack.push_back(code->constants[instruction->a]->Eval(scope));
+                DISPATCH();
+            }
+            TARGET(kGuard) {
+                const GuardSite& guard = code->guards[instruction->a];
+                for (size_t i = 0; i < guard.names.size(); i++) {
+                    std::shared_ptr<Object>* binding =
+                        scope->FindGlobal(guard.names[i], &code->globals[guard.globals + i]);
+                    if (!HoldsGuard(binding, guard.values[i])) {
+                        pc = instruction->b;
+                        break;
+                    }
+                }
+                DISPATCH();
+            }
+        }
+    }
+#undef TARGET
+#undef DISPATCH
+}